@@ -0,0 +1,237 @@
+//
+// Created by X on 2025/11/26.
+//
+
+#ifndef LITECHAT_BINARYPROTOCOL_H
+#define LITECHAT_BINARYPROTOCOL_H
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "OutboundMessage.h"
+
+// 二进制协议仍使用 4 字节大端长度前缀分帧，帧体为：
+//
+//   [u8 opcode] [字段...]
+//
+// 字段: 整数为无符号 varint (LEB128)；字符串为 varint 长度 + UTF-8 字节；布尔为 u8。
+//
+// 协商: 连接建立后客户端发送的第一帧若为 HELLO，服务器回复 HELLO_ACK 并把该连接切换为
+// 二进制协议；否则一直使用文本协议。HELLO 没有 opcode 字节，帧体直接以魔数开头
+// (文本帧不会以 NUL 开头)：
+//
+//   "\0LCB" [u8 version] v1: [u8 flags]; v2: [varint capabilities]
+//
+// 文本客户端也可以用 "HELLO <版本> [能力,...]" 作为第一帧协商能力，服务器以同样以 HELLO
+// 开头的一行回复，之后仍使用文本协议。不发 HELLO 的旧客户端行为与之前完全相同。
+//
+// 双方取较小的版本号；能力位取客户端请求与服务器支持的交集，请求 ID、批量帧、
+// 会话令牌和压缩只对协商了对应能力的连接生效。v2 的 HELLO_ACK 同时下发服务器的限制
+// (最大帧长、心跳超时、流水线与批量上限) 和推荐的压缩阈值。
+// WHISPER、GROUP_SEND 成功时回复 ACK，失败时回复 ERROR；CHAT 不回复。
+//
+// 请求 ID: 客户端可把任意请求帧包进 TAGGED，服务器对它的回复 (TEXT/ACK/ERROR) 同样包进
+// 带相同 ID 的 TAGGED；带 ID 的请求在线程池中执行，回复可能乱序到达。
+// 文本协议对应的写法是在行首加 "@<id> "，回复同样以 "@<id> " 开头。
+//
+// 批量: BATCH 把多条请求放进一帧，服务器整体校验后逐条处理，对每条子帧的回复与单独发送时相同，
+// 期间产生的所有投递按接收方合并写出。文本协议对应的写法是首行为 "/batch"，之后每行一条消息。
+//
+// 压缩: 协商了 CAP_ZSTD 且服务器启用了压缩时，超过阈值的服务器帧会整帧压缩为 COMPRESSED，
+// 解压后得到原来的帧体。
+
+inline constexpr char BINARY_HELLO_MAGIC[4] = {'\0', 'L', 'C', 'B'};
+inline constexpr uint8_t MIN_PROTOCOL_VERSION = 1;
+inline constexpr uint8_t PROTOCOL_VERSION = 2;
+
+// 能力位。v1 的 HELLO 只有一个 u8 flags，其中 0x01 即 CAP_ZSTD，
+// v1 二进制会话默认具备请求 ID 与批量帧能力。
+inline constexpr uint32_t CAP_ZSTD = 0x01;
+inline constexpr uint32_t CAP_BATCH = 0x02;
+inline constexpr uint32_t CAP_TAGGED = 0x04;
+inline constexpr uint32_t CAP_RESUME = 0x08;
+
+// HELLO_ACK 中服务器下发的协商结果、限制与推荐设置。
+struct ServerHello
+{
+    uint8_t version = PROTOCOL_VERSION;
+    uint32_t capabilities = 0;
+    uint32_t dictionary_id = 0;
+    uint32_t max_frame_size = 0;
+    uint32_t heartbeat_timeout = 0;
+    uint32_t max_pipelined = 0;
+    uint32_t max_batch = 0;
+    uint32_t compression_threshold = 0;
+};
+
+enum class Opcode : uint8_t
+{
+    // 客户端 -> 服务器 (HELLO 以魔数开头，不占 opcode，见文件开头)
+    Command = 0x02,      // str line，按文本协议的命令行处理 (/login、/create ...)
+    Tagged = 0x03,       // varint request_id, 内层帧 (双向)
+    Batch = 0x04,        // varint count, count 个 str 子帧 (不能是 HELLO/TAGGED/BATCH)
+    Chat = 0x10,         // str text
+    Whisper = 0x11,      // str target, str text
+    GroupSend = 0x12,    // str group, str text
+
+    // 服务器 -> 客户端
+    HelloAck = 0x81,     // v1: u8 version, u8 flags, varint dictionary_id
+                         // v2: u8 version, varint capabilities, varint dictionary_id,
+                         //     varint max_frame_size, varint heartbeat_timeout (秒),
+                         //     varint max_pipelined, varint max_batch, varint compression_threshold
+    Text = 0x82,         // str text，命令的自由文本回复
+    Compressed = 0x83,   // varint raw_size, zstd frame (可能使用 dictionary_id 对应的字典)
+    ResumeToken = 0x84,  // str token, varint ttl_seconds，登录或 /resume 成功后下发
+    ChatEvent = 0x90,    // str from, str text
+    WhisperEvent = 0x91, // str from, str text
+    GroupEvent = 0x92,   // str group, str from, str text
+    Presence = 0x93,     // str user, bool online
+    Ack = 0xA0,          // u8 request_opcode
+    Error = 0xA1,        // u8 request_opcode, varint code, str message
+};
+
+enum class ProtocolError : uint16_t
+{
+    None = 0,
+    MalformedFrame = 1,
+    UnsupportedVersion = 2,
+    UnknownOpcode = 3,
+    NotLoggedIn = 4,
+    PermissionDenied = 5,
+    InvalidArgument = 6,
+    UserOffline = 7,
+    GroupNotFound = 8,
+    NotGroupMember = 9,
+    TooManyRequests = 10,
+};
+
+// 追加写入，只在构造时预留一次空间。
+class BinaryWriter
+{
+public:
+    explicit BinaryWriter(Opcode op, size_t reserve = 32)
+    {
+        out_.reserve(reserve);
+        out_.push_back(static_cast<char>(op));
+    }
+
+    BinaryWriter& u8(uint8_t v)
+    {
+        out_.push_back(static_cast<char>(v));
+        return *this;
+    }
+
+    BinaryWriter& varint(uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            out_.push_back(static_cast<char>((v & 0x7F) | 0x80));
+            v >>= 7;
+        }
+        out_.push_back(static_cast<char>(v));
+        return *this;
+    }
+
+    BinaryWriter& str(std::string_view s)
+    {
+        varint(s.size());
+        out_.append(s.data(), s.size());
+        return *this;
+    }
+
+    std::string take() { return std::move(out_); }
+
+private:
+    std::string out_;
+};
+
+// 只读视图上的解码器，字符串字段以 string_view 返回，不做拷贝。
+class BinaryReader
+{
+public:
+    explicit BinaryReader(std::string_view data) : data_(data)
+    {
+    }
+
+    bool u8(uint8_t& v)
+    {
+        if (pos_ >= data_.size())
+        {
+            return false;
+        }
+        v = static_cast<uint8_t>(data_[pos_++]);
+        return true;
+    }
+
+    bool varint(uint64_t& v)
+    {
+        v = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7)
+        {
+            if (pos_ >= data_.size())
+            {
+                return false;
+            }
+            auto byte = static_cast<uint8_t>(data_[pos_++]);
+            v |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool str(std::string_view& s)
+    {
+        uint64_t len = 0;
+        if (!varint(len) || len > data_.size() - pos_)
+        {
+            return false;
+        }
+        s = data_.substr(pos_, len);
+        pos_ += len;
+        return true;
+    }
+
+    [[nodiscard]] bool at_end() const { return pos_ == data_.size(); }
+    [[nodiscard]] size_t remaining() const { return data_.size() - pos_; }
+
+private:
+    std::string_view data_;
+    size_t pos_ = 0;
+};
+
+// 帧体以 HELLO magic 开头时返回 true 并取出客户端请求的版本号和能力位。
+bool parse_binary_hello(std::string_view frame, uint8_t& version, uint32_t& capabilities);
+
+// 文本 HELLO："HELLO <版本> [能力名,...]"，能力名为 zstd、batch、tagged、resume。
+bool parse_text_hello(std::string_view frame, uint8_t& version, uint32_t& capabilities);
+
+// 按 hello.version 编码 v1 或 v2 的 HELLO_ACK。
+std::string encode_hello_ack(const ServerHello& hello);
+// 文本协议的回复："HELLO <版本> caps=... max_frame=... heartbeat=... ..."。
+std::string format_text_hello(const ServerHello& hello);
+std::string encode_text_frame(std::string_view text);
+std::string encode_ack(Opcode request);
+std::string encode_error(Opcode request, ProtocolError code, std::string_view message);
+std::string encode_tagged(uint64_t request_id, std::string_view inner);
+std::string encode_resume_token(std::string_view token, uint64_t ttl_seconds);
+
+// 文本帧以 "@<数字> " 开头时返回 true，并取出请求 ID 与其后的内容。
+bool parse_text_request_tag(std::string_view frame, uint64_t& request_id,
+                            std::string_view& inner);
+
+// 以下同时生成文本和二进制两种编码，文本内容与原有的文本协议保持一致。
+OutboundMessage make_chat_message(const std::string& from, const std::string& text);
+OutboundMessage make_whisper_message(const std::string& from, const std::string& text);
+OutboundMessage make_group_message(std::string_view group, std::string_view from,
+                                   std::string_view text);
+OutboundMessage make_presence_message(const std::string& user, bool online);
+// 服务器或脚本发出的通知：文本协议原样发送，二进制协议为 TEXT 帧。
+OutboundMessage make_notice_message(std::string_view text);
+
+// 给文本协议的错误回复使用的默认中文描述。
+const char* protocol_error_text(ProtocolError code);
+
+#endif //LITECHAT_BINARYPROTOCOL_H
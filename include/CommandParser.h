@@ -0,0 +1,236 @@
+//
+// Created by X on 2025/11/27.
+//
+
+#ifndef LITECHAT_COMMANDPARSER_H
+#define LITECHAT_COMMANDPARSER_H
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// 命令行在接收缓冲区上原地分词，参数都是指向原缓冲区的 string_view，
+// 整个解析与分发过程不做堆分配。缓冲区必须在处理命令期间保持有效。
+class CommandArgs
+{
+public:
+    static constexpr size_t MAX_ARGS = 16;
+
+    [[nodiscard]] size_t size() const { return count_; }
+    [[nodiscard]] bool empty() const { return count_ == 0; }
+
+    std::string_view operator[](size_t i) const { return tokens_[i]; }
+
+    // 第 i 个参数到行尾的原始文本 (保留中间的空白)，用于消息正文。
+    [[nodiscard]] std::string_view rest(size_t i) const
+    {
+        if (i >= count_)
+        {
+            return {};
+        }
+        return line_.substr(static_cast<size_t>(tokens_[i].data() - line_.data()));
+    }
+
+    // 去掉首尾空白后的整行。
+    [[nodiscard]] std::string_view line() const { return line_; }
+
+    void set(size_t i, std::string_view token) { tokens_[i] = token; }
+
+    // 超过 MAX_ARGS 的参数不单独保存，但仍可通过 rest() 取到。
+    void tokenize(std::string_view text)
+    {
+        constexpr std::string_view whitespace = " \t\n\r\f\v";
+
+        count_ = 0;
+        size_t begin = text.find_first_not_of(whitespace);
+        if (begin == std::string_view::npos)
+        {
+            line_ = {};
+            return;
+        }
+        size_t end = text.find_last_not_of(whitespace);
+        line_ = text.substr(begin, end - begin + 1);
+
+        size_t pos = 0;
+        while (pos < line_.size() && count_ < MAX_ARGS)
+        {
+            size_t token_end = line_.find_first_of(whitespace, pos);
+            if (token_end == std::string_view::npos)
+            {
+                token_end = line_.size();
+            }
+            tokens_[count_++] = line_.substr(pos, token_end - pos);
+
+            pos = line_.find_first_not_of(whitespace, token_end);
+            if (pos == std::string_view::npos)
+            {
+                break;
+            }
+        }
+    }
+
+private:
+    std::array<std::string_view, MAX_ARGS> tokens_{};
+    size_t count_ = 0;
+    std::string_view line_;
+};
+
+enum class CommandId : uint8_t
+{
+    Register,
+    Login,
+    List,
+    Whoami,
+    Whisper,
+    Help,
+    Quit,
+    Create,
+    Join,
+    Send,
+    History,
+    ListGroups,
+    GroupKick,
+    Leave,
+    Transfer,
+    GroupUnban,
+    Kick,
+    Snapshot,
+    Resume,
+    Revoke,
+    ReloadLua,
+    LuaMem,
+    Count
+};
+
+struct CommandSpec
+{
+    std::string_view name;
+    CommandId id;
+    bool admin_only;
+};
+
+// 内置命令名。新增命令时只需在这里追加一项，完美哈希的种子在编译期重新搜索。
+inline constexpr CommandSpec BUILTIN_COMMANDS[] = {
+    {"/register", CommandId::Register, false},
+    {"/login", CommandId::Login, false},
+    {"/list", CommandId::List, false},
+    {"whoami", CommandId::Whoami, false},
+    {"/whoami", CommandId::Whoami, false},
+    {"/w", CommandId::Whisper, false},
+    {"/help", CommandId::Help, false},
+    {"/quit", CommandId::Quit, false},
+    {"/create", CommandId::Create, false},
+    {"/join", CommandId::Join, false},
+    {"/send", CommandId::Send, false},
+    {"/history", CommandId::History, false},
+    {"/listgroups", CommandId::ListGroups, false},
+    {"/groupkick", CommandId::GroupKick, false},
+    {"/leave", CommandId::Leave, false},
+    {"/transfer", CommandId::Transfer, false},
+    {"/groupunban", CommandId::GroupUnban, false},
+    {"/kick", CommandId::Kick, true},
+    {"/snapshot", CommandId::Snapshot, true},
+    {"/resume", CommandId::Resume, false},
+    {"/revoke", CommandId::Revoke, false},
+    {"/reloadlua", CommandId::ReloadLua, true},
+    {"/luamem", CommandId::LuaMem, true},
+};
+
+inline constexpr size_t BUILTIN_COMMAND_COUNT =
+    sizeof(BUILTIN_COMMANDS) / sizeof(BUILTIN_COMMANDS[0]);
+
+inline constexpr unsigned COMMAND_TABLE_BITS = 6;
+inline constexpr size_t COMMAND_TABLE_SIZE = size_t{1} << COMMAND_TABLE_BITS;
+static_assert(COMMAND_TABLE_SIZE >= BUILTIN_COMMAND_COUNT * 2, "命令表槽位不足");
+
+constexpr uint32_t command_hash(std::string_view name, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ seed;
+    for (char c : name)
+    {
+        h ^= static_cast<uint8_t>(c);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// FNV 的低位只受种子低位影响，因此取高位作为槽位。
+constexpr size_t command_slot(std::string_view name, uint32_t seed)
+{
+    return command_hash(name, seed) >> (32 - COMMAND_TABLE_BITS);
+}
+
+// 编译期搜索一个使所有内置命令互不冲突的种子。
+constexpr uint32_t find_command_seed()
+{
+    for (uint32_t seed = 0; seed < 100000; ++seed)
+    {
+        bool used[COMMAND_TABLE_SIZE] = {};
+        bool ok = true;
+        for (const CommandSpec& spec : BUILTIN_COMMANDS)
+        {
+            size_t slot = command_slot(spec.name, seed);
+            if (used[slot])
+            {
+                ok = false;
+                break;
+            }
+            used[slot] = true;
+        }
+        if (ok)
+        {
+            return seed;
+        }
+    }
+    return UINT32_MAX;
+}
+
+inline constexpr uint32_t COMMAND_HASH_SEED = find_command_seed();
+static_assert(COMMAND_HASH_SEED != UINT32_MAX, "找不到无冲突的命令哈希种子");
+
+constexpr std::array<int8_t, COMMAND_TABLE_SIZE> build_command_table()
+{
+    std::array<int8_t, COMMAND_TABLE_SIZE> table{};
+    for (auto& slot : table)
+    {
+        slot = -1;
+    }
+    for (size_t i = 0; i < BUILTIN_COMMAND_COUNT; ++i)
+    {
+        size_t slot = command_slot(BUILTIN_COMMANDS[i].name, COMMAND_HASH_SEED);
+        table[slot] = static_cast<int8_t>(i);
+    }
+    return table;
+}
+
+inline constexpr std::array<int8_t, COMMAND_TABLE_SIZE> COMMAND_TABLE =
+    build_command_table();
+
+// 一次哈希 + 一次字符串比较，未命中返回 nullptr (交给 Lua 处理)。
+inline const CommandSpec* find_command(std::string_view name)
+{
+    int8_t index = COMMAND_TABLE[command_slot(name, COMMAND_HASH_SEED)];
+    if (index < 0 || BUILTIN_COMMANDS[index].name != name)
+    {
+        return nullptr;
+    }
+    return &BUILTIN_COMMANDS[index];
+}
+
+// 大小写不敏感的查找，在栈上缓冲区里转成小写，不分配内存。
+inline const CommandSpec* find_command_icase(std::string_view name)
+{
+    char lower[32];
+    if (name.size() > sizeof(lower))
+    {
+        return nullptr;
+    }
+    for (size_t i = 0; i < name.size(); ++i)
+    {
+        char c = name[i];
+        lower[i] = (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+    }
+    return find_command(std::string_view(lower, name.size()));
+}
+
+#endif //LITECHAT_COMMANDPARSER_H
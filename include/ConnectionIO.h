@@ -0,0 +1,148 @@
+//
+// Created by X on 2025/11/30.
+//
+
+#ifndef LITECHAT_CONNECTIONIO_H
+#define LITECHAT_CONNECTIONIO_H
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/types.h>
+
+struct ssl_st;
+
+struct ConnectionLimits
+{
+    // 单帧最大长度，长度头超过它的连接直接断开，不会按不可信的长度分配内存。
+    size_t max_frame_size = 64 * 1024;
+    // 单连接接收缓冲区 + 排队中的带 ID 请求的字节数上限，达到后暂停读取。
+    size_t max_inbound_bytes = 256 * 1024;
+    // 单连接待发送字节数上限。超过一半时暂停读取该连接，超过上限时断开。
+    size_t max_outbound_bytes = 1024 * 1024;
+    // 所有连接缓冲区的总和上限，超过后暂停所有读取，并拒绝继续为积压的连接排队。
+    size_t max_global_bytes = 512ul * 1024 * 1024;
+    // 暂停读取持续超过该时长的连接会被断开。
+    std::chrono::seconds backpressure_timeout{10};
+};
+
+void configure_connection_limits(const ConnectionLimits& limits);
+const ConnectionLimits& connection_limits();
+
+// 当前所有连接缓冲区占用的字节数 (按容量计算)。
+size_t buffered_bytes();
+
+// epoll 实例，用于在有积压时注册/注销 EPOLLOUT。
+void set_connection_epoll_fd(int epoll_fd);
+
+// 因输出积压超限而需要断开的连接，由事件循环取走并断开。
+std::vector<int> take_overflowed_connections();
+
+// 连接所在的监听端口决定的传输层分帧方式。
+enum class Transport : uint8_t
+{
+    // 4 字节大端长度前缀。
+    Stream,
+    // HTTP Upgrade 握手之后使用 WebSocket 帧。
+    WebSocket,
+};
+
+// 单个连接的收发缓冲区。inbound 只由事件循环线程访问；
+// outbound 可能被多个线程同时写入，由 out_mtx 保护，一个完整帧在锁内写出或排队。
+// TLS 连接在用户态加解密时 SSL 对象不能并发使用，读也在 out_mtx 内进行；
+// 记录层交给 kTLS 之后收发与明文连接相同，直接走 socket 系统调用。
+class ConnectionIO
+{
+public:
+    explicit ConnectionIO(Transport transport = Transport::Stream) : transport_(transport)
+    {
+    }
+    ~ConnectionIO();
+
+    ConnectionIO(const ConnectionIO&) = delete;
+    ConnectionIO& operator=(const ConnectionIO&) = delete;
+
+    // 接管 SSL 的所有权，连接从握手开始。握手完成前写入的帧直接丢弃。
+    void attach_tls(ssl_st* ssl);
+    [[nodiscard]] bool tls_handshaking() const { return ssl_ != nullptr && !tls_ready_; }
+
+    // 连接关闭时由 SessionTable 调用，之后其他线程的写入不会落到复用了该 fd 的新连接上。
+    void close();
+
+    // 与 recv 语义相同：返回读到的字节数，0 表示对端关闭，-1 时 errno 为 EAGAIN 表示暂无数据。
+    // TLS 握手未完成时先推进握手。只由事件循环线程调用。
+    ssize_t read(int fd, char* buf, size_t len);
+
+    // 写出 header + payload。socket 写满时剩余部分排队并注册 EPOLLOUT，
+    // 积压超过限制时丢弃该帧、标记连接溢出并返回 false。
+    bool write(int fd, std::string_view header, std::string_view payload);
+    // 按顺序写出多个片段 (如合并投递的多帧)，明文连接一次 sendmsg，语义同上。
+    bool write(int fd, const std::string_view* parts, size_t count);
+
+    // EPOLLOUT 就绪时调用，写出积压数据，出错时返回 false。
+    bool flush(int fd);
+
+    [[nodiscard]] size_t outbound_pending() const
+    {
+        return outbound_pending_.load(std::memory_order_relaxed);
+    }
+
+    // 接收缓冲区需要的空间，调用者在 resize 之后必须调用 account_inbound()。
+    std::string inbound;
+    void account_inbound();
+    // 读完所有完整帧后调用，空闲时归还大块内存。
+    void shrink_inbound();
+
+    // 已拷贝到线程池中、尚未执行完的带 ID 请求的字节数。
+    std::atomic<size_t> pending_request_bytes{0};
+
+    // 由事件循环维护的暂停读取状态。
+    bool read_paused = false;
+    std::chrono::steady_clock::time_point paused_since;
+
+    // 是否应暂停读取该连接。
+    [[nodiscard]] bool should_pause_reading() const;
+
+    [[nodiscard]] Transport transport() const { return transport_; }
+
+    // 握手完成后由事件循环置位，之前其他线程发给该连接的帧 (如广播) 直接丢弃。
+    std::atomic<bool> ws_open{false};
+    // 分片消息的已收部分及其首帧的操作码，只由事件循环线程访问。
+    std::string ws_message;
+    uint8_t ws_message_opcode = 0;
+
+    // 会话协商为二进制协议后，服务器用 WebSocket 二进制消息发送，否则用文本消息。
+    std::atomic<bool> ws_binary{false};
+
+private:
+    void account_outbound();
+    void set_want_write(int fd, bool want);
+    bool send_plain(int fd, const std::string_view* parts, size_t count, size_t& sent);
+    bool send_tls(std::string_view data, size_t& sent);
+    ssize_t tls_status(int fd, int ret);
+    void on_handshake_complete(int fd);
+
+    const Transport transport_;
+
+    std::mutex out_mtx;
+    std::string outbound;
+    size_t out_offset = 0;
+    bool want_write = false;
+    bool overflowed = false;
+    bool closed = false;
+
+    ssl_st* ssl_ = nullptr;
+    std::atomic<bool> tls_ready_{false};
+    bool ktls_send_ = false;
+    bool ktls_recv_ = false;
+    std::atomic<size_t> outbound_pending_{0};
+
+    size_t accounted_inbound = 0;
+    size_t accounted_outbound = 0;
+};
+
+#endif //LITECHAT_CONNECTIONIO_H
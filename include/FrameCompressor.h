@@ -0,0 +1,59 @@
+//
+// Created by X on 2025/11/28.
+//
+
+#ifndef LITECHAT_FRAMECOMPRESSOR_H
+#define LITECHAT_FRAMECOMPRESSOR_H
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "OutboundMessage.h"
+
+struct ZSTD_CDict_s;
+
+struct CompressionConfig
+{
+    int level = 3;
+    // 帧体小于该字节数时不压缩，小消息压缩收益抵不上开销。
+    size_t threshold = 512;
+    // 用 `zstd --train` 基于聊天语料训练出的字典，客户端需持有同一份。为空表示不用字典。
+    std::string dictionary_file;
+};
+
+// 二进制会话的 zstd 压缩。CDict 只读，可被所有线程共享；每个线程各自持有一个 CCtx。
+class FrameCompressor
+{
+public:
+    static FrameCompressor& getInstance();
+
+    FrameCompressor(const FrameCompressor&) = delete;
+    FrameCompressor& operator=(const FrameCompressor&) = delete;
+
+    // 启动时调用一次。字典加载失败时退化为不带字典的压缩。
+    bool configure(const CompressionConfig& config);
+
+    [[nodiscard]] bool enabled() const { return enabled_; }
+
+    // 0 表示未使用字典，HELLO_ACK 会把它告诉客户端。
+    [[nodiscard]] uint32_t dictionary_id() const { return dictionary_id_; }
+
+    // 小于该字节数的帧不压缩，HELLO_ACK 把它作为推荐值告诉客户端。
+    [[nodiscard]] size_t threshold() const { return threshold_; }
+
+    // 把一个完整的二进制帧体压缩成 COMPRESSED 帧。低于阈值、
+    // 压缩后没有变小或出错时返回 nullptr，调用者应发送原帧。
+    [[nodiscard]] SharedFrame compress(std::string_view frame) const;
+
+private:
+    FrameCompressor() = default;
+    ~FrameCompressor();
+
+    bool enabled_ = false;
+    int level_ = 3;
+    size_t threshold_ = 512;
+    uint32_t dictionary_id_ = 0;
+    ZSTD_CDict_s* cdict_ = nullptr;
+};
+
+#endif //LITECHAT_FRAMECOMPRESSOR_H
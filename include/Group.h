@@ -0,0 +1,52 @@
+//
+// Created by X on 2025/11/20.
+//
+
+#ifndef LITECHAT_GROUP_H
+#define LITECHAT_GROUP_H
+#include <string>
+#include <unordered_set>
+#include "json.hpp"
+
+struct Group
+{
+    std::string name;
+
+    std::string owner_nickname;
+
+    std::unordered_set<std::string> members;
+
+    std::string password_hash;
+
+    std::unordered_set<std::string> banned_members;
+};
+
+inline void to_json(nlohmann::json& j, const Group& g)
+{
+    j = nlohmann::json{
+        {"name", g.name},
+        {"owner", g.owner_nickname},
+        {"members", g.members},
+        {"password_hash", g.password_hash},
+        {"banned_members", g.banned_members}
+    };
+}
+
+inline void from_json(const nlohmann::json& j, Group& g)
+{
+    j.at("name").get_to(g.name);
+    j.at("owner").get_to(g.owner_nickname);
+    j.at("members").get_to(g.members);
+    j.at("banned_members").get_to(g.banned_members);
+
+    if (j.count("password_hash"))
+    {
+        j.at("password_hash").get_to(g.password_hash);
+    }
+    else
+    {
+        g.password_hash = "";
+    }
+}
+
+#endif //LITECHAT_GROUP_H
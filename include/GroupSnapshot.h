@@ -0,0 +1,128 @@
+//
+// Created by X on 2025/11/20.
+//
+
+#ifndef LITECHAT_GROUPSNAPSHOT_H
+#define LITECHAT_GROUPSNAPSHOT_H
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Group.h"
+
+// 群组二进制快照 (groups_data.snap)，按主机字节序 (小端) 存储：
+//
+//   [Header 64B] [Index: group_count * 24B，按 name_hash 升序] [Records...]
+//
+// Index 项: { u64 name_hash, u64 record_offset, u32 record_size, u32 record_crc }
+// Record  : name, owner, password_hash 各为 u32 长度 + 字节；
+//           members、banned_members 各为 u32 个数 + 若干 (u32 长度 + 字节)。
+//
+// 打开时只校验 Header 与 Index，记录在首次访问时才解码并校验 CRC，
+// 因此启动耗时与实际访问的群组数量相关，而与群组总数无关。
+
+inline constexpr char GROUP_SNAPSHOT_MAGIC[8] = {'L', 'C', 'G', 'S', 'N', 'A', 'P', '\0'};
+inline constexpr uint32_t GROUP_SNAPSHOT_VERSION = 1;
+
+struct GroupSnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t group_count;
+    uint64_t index_offset;
+    uint64_t data_offset;
+    uint64_t file_size;
+    uint32_t index_crc;
+    uint32_t header_crc;
+    uint8_t reserved[8];
+};
+
+static_assert(sizeof(GroupSnapshotHeader) == 64, "快照头必须为 64 字节");
+
+struct GroupSnapshotIndexEntry
+{
+    uint64_t name_hash;
+    uint64_t record_offset;
+    uint32_t record_size;
+    uint32_t record_crc;
+};
+
+static_assert(sizeof(GroupSnapshotIndexEntry) == 24, "快照索引项必须为 24 字节");
+
+class GroupSnapshot
+{
+public:
+    // 打开并 mmap 快照文件，文件不存在或校验失败时返回 nullptr。
+    static std::unique_ptr<GroupSnapshot> open(const std::string& filename);
+
+    GroupSnapshot(const GroupSnapshot&) = delete;
+    GroupSnapshot& operator=(const GroupSnapshot&) = delete;
+    ~GroupSnapshot();
+
+    [[nodiscard]] size_t size() const { return count_; }
+
+    // 按群名 (小写) 查找并解码单个群组。
+    bool find(const std::string& name, Group& out) const;
+
+    bool load_at(size_t index, Group& out) const;
+
+    // 不解码整条记录，只取出群名。
+    [[nodiscard]] std::string_view name_at(size_t index) const;
+
+    // 只校验记录 CRC，不解码。
+    [[nodiscard]] bool verify(size_t index) const;
+
+    // 原始记录字节，用于未被修改的群组在重新写快照时直接拷贝。
+    [[nodiscard]] std::string_view raw_record(size_t index) const;
+
+    // 将全部群组并行解码，threads 为 0 时按 CPU 核数决定。
+    bool load_all(std::vector<Group>& out, unsigned threads = 0) const;
+
+    static uint64_t hash_name(std::string_view name);
+
+    static uint32_t crc32(const void* data, size_t len, uint32_t crc = 0);
+
+private:
+    GroupSnapshot(const uint8_t* base, size_t length);
+
+    [[nodiscard]] const GroupSnapshotIndexEntry& entry(size_t index) const;
+
+    const uint8_t* base_;
+    size_t length_;
+    size_t count_;
+    const GroupSnapshotIndexEntry* index_;
+};
+
+class GroupSnapshotWriter
+{
+public:
+    void add(const Group& group);
+
+    // record 必须是 GroupSnapshot::raw_record 返回的完整记录。
+    void add_raw(std::string_view name, std::string_view record);
+
+    [[nodiscard]] size_t size() const { return records_.size(); }
+
+    // 写入临时文件并 fsync 后原子重命名为 filename，避免覆盖正在被 mmap 的旧快照。
+    bool commit(const std::string& filename);
+
+    static std::string encode(const Group& group);
+
+private:
+    struct PendingRecord
+    {
+        uint64_t name_hash;
+        std::string bytes;
+    };
+
+    std::vector<PendingRecord> records_;
+};
+
+// 将旧的 JSON 群组文件转换为二进制快照，返回写入的群组数，失败返回 -1。
+long convert_groups_json_to_snapshot(const std::string& json_filename,
+                                     const std::string& snapshot_filename);
+
+#endif //LITECHAT_GROUPSNAPSHOT_H
@@ -0,0 +1,125 @@
+//
+// Created by X on 2025/11/22.
+//
+
+#ifndef LITECHAT_GROUPTABLE_H
+#define LITECHAT_GROUPTABLE_H
+#include <array>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "Group.h"
+#include "MessageHistory.h"
+
+// 单个群组的状态和它自己的锁。removed 置位后表示群组已解散，
+// 仍持有 shared_ptr 的线程必须在加锁后重新检查。
+//
+// state 是写时复制的：读者在锁内拷贝 shared_ptr 后即可在锁外使用，
+// 修改者通过 GroupManager::edit 取得可写副本，不影响已经发布出去的视图。
+struct GroupEntry
+{
+    std::mutex mtx;
+
+    std::shared_ptr<const Group> state;
+
+    // 最近消息的环形缓冲区，首次发消息或翻页时才创建。
+    std::unique_ptr<MessageHistory> history;
+
+    bool removed = false;
+};
+
+using GroupEntryPtr = std::shared_ptr<GroupEntry>;
+
+// 按群名分片的并发索引，分片锁只保护索引本身，不保护群组内容。
+class GroupTable
+{
+public:
+    GroupEntryPtr find(const std::string& name) const
+    {
+        const Shard& shard = shard_for(name);
+        std::shared_lock<std::shared_mutex> lock(shard.mtx);
+        auto it = shard.map.find(name);
+        return it == shard.map.end() ? nullptr : it->second;
+    }
+
+    // 已存在同名群组时返回已有的条目，inserted 为 false。
+    GroupEntryPtr insert(const std::string& name, GroupEntryPtr entry,
+                         bool& inserted)
+    {
+        Shard& shard = shard_for(name);
+        std::unique_lock<std::shared_mutex> lock(shard.mtx);
+        auto result = shard.map.emplace(name, std::move(entry));
+        inserted = result.second;
+        return result.first->second;
+    }
+
+    // 只有索引中仍是 expected 时才删除，避免误删同名的新群组。
+    bool erase(const std::string& name, const GroupEntryPtr& expected)
+    {
+        Shard& shard = shard_for(name);
+        std::unique_lock<std::shared_mutex> lock(shard.mtx);
+        auto it = shard.map.find(name);
+        if (it == shard.map.end() || it->second != expected)
+        {
+            return false;
+        }
+        shard.map.erase(it);
+        return true;
+    }
+
+    bool contains(const std::string& name) const
+    {
+        const Shard& shard = shard_for(name);
+        std::shared_lock<std::shared_mutex> lock(shard.mtx);
+        return shard.map.count(name) != 0;
+    }
+
+    // 拷贝出条目指针后再逐个加群组锁，避免持有分片锁时去拿群组锁。
+    std::vector<std::pair<std::string, GroupEntryPtr>> entries() const
+    {
+        std::vector<std::pair<std::string, GroupEntryPtr>> out;
+        for (const Shard& shard : shards)
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mtx);
+            out.insert(out.end(), shard.map.begin(), shard.map.end());
+        }
+        return out;
+    }
+
+    void clear()
+    {
+        for (Shard& shard : shards)
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mtx);
+            shard.map.clear();
+        }
+    }
+
+private:
+    static constexpr size_t SHARD_COUNT = 64;
+
+    struct Shard
+    {
+        mutable std::shared_mutex mtx;
+        std::unordered_map<std::string, GroupEntryPtr> map;
+    };
+
+    std::array<Shard, SHARD_COUNT> shards;
+
+    Shard& shard_for(const std::string& name)
+    {
+        return shards[std::hash<std::string>{}(name) % SHARD_COUNT];
+    }
+
+    const Shard& shard_for(const std::string& name) const
+    {
+        return shards[std::hash<std::string>{}(name) % SHARD_COUNT];
+    }
+};
+
+#endif //LITECHAT_GROUPTABLE_H
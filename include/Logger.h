@@ -27,6 +27,8 @@ public:
 
     static void setLogFile(const std::string& filename);
     static void setMinLevel(LogLevel level);
+    // 宏在拼接日志内容之前先检查级别，被过滤的日志不产生任何分配。
+    static bool isEnabled(LogLevel level) { return level >= minLogLevel_; }
     void log(LogLevel level, const std::string& msg, const char* file,
              int line);
 
@@ -47,6 +49,7 @@ private:
 
 #define  LOG_MESSAGE(level,...)\
     do{\
+        if (!Logger::isEnabled(level)) break;\
         std::stringstream ss;\
         ss<<__VA_ARGS__;\
         Logger::getInstance().log(level,ss.str(),__FILE__,__LINE__);\
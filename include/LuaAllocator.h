@@ -0,0 +1,89 @@
+//
+// Created by X on 2025/12/06.
+//
+
+#ifndef LITECHAT_LUAALLOCATOR_H
+#define LITECHAT_LUAALLOCATOR_H
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 一个 lua_State 专用的内存分配器 (lua_Alloc)。
+//
+// 不超过 MAX_SMALL_SIZE 的块按大小分级，从 64 KiB 的整块内存中切出，释放后挂到对应级别的
+// 空闲链表上复用，状态关闭时整块归还；更大的块直接走 malloc。
+// 分配量超过 limit 时返回 nullptr，Lua 会在脚本中抛出 "not enough memory"，只影响这个状态。
+// 一个状态同一时刻只在一个线程上运行，分配路径不加锁；统计值用原子变量，供其他线程读取。
+class LuaArena
+{
+public:
+    static constexpr size_t MAX_SMALL_SIZE = 512;
+    static constexpr size_t SLAB_SIZE = 64 * 1024;
+
+    explicit LuaArena(size_t limit) : limit_(limit) {}
+    ~LuaArena();
+
+    LuaArena(const LuaArena&) = delete;
+    LuaArena& operator=(const LuaArena&) = delete;
+
+    // 传给 lua_newstate 的分配函数，ud 为 LuaArena*。
+    static void* allocate(void* ud, void* ptr, size_t osize, size_t nsize);
+
+    // Lua 看到的已分配字节数 (小块按所在级别的大小计)。
+    [[nodiscard]] size_t used() const { return used_.load(std::memory_order_relaxed); }
+    [[nodiscard]] size_t peak() const { return peak_.load(std::memory_order_relaxed); }
+    // 向系统申请的字节数：整块内存加上大块。
+    [[nodiscard]] size_t reserved() const { return reserved_.load(std::memory_order_relaxed); }
+    [[nodiscard]] uint64_t failures() const { return failures_.load(std::memory_order_relaxed); }
+    [[nodiscard]] size_t limit() const { return limit_; }
+
+private:
+    static constexpr size_t SIZE_CLASSES = 14;
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    // 16 ~ 128 字节每 16 字节一级，129 ~ 512 字节每 64 字节一级。
+    static size_t class_of(size_t size)
+    {
+        if (size <= 128)
+        {
+            return (size + 15) / 16 - 1;
+        }
+        return 8 + (size - 128 + 63) / 64 - 1;
+    }
+
+    static size_t class_size(size_t index)
+    {
+        return index < 8 ? 16 * (index + 1) : 128 + 64 * (index - 7);
+    }
+
+    static size_t charged_size(size_t size)
+    {
+        return size <= MAX_SMALL_SIZE ? class_size(class_of(size)) : size;
+    }
+
+    void* allocate_block(size_t size);
+    void free_block(void* ptr, size_t size);
+    void* allocate_small(size_t index);
+
+    void charge(size_t bytes);
+
+    size_t limit_;
+
+    std::array<FreeBlock*, SIZE_CLASSES> free_lists_{};
+    std::vector<char*> slabs_;
+    char* bump_ = nullptr;
+    size_t bump_left_ = 0;
+
+    std::atomic<size_t> used_{0};
+    std::atomic<size_t> peak_{0};
+    std::atomic<size_t> reserved_{0};
+    std::atomic<uint64_t> failures_{0};
+};
+
+#endif //LITECHAT_LUAALLOCATOR_H
@@ -4,8 +4,20 @@
 
 #ifndef LITECHAT_LUAMANAGER_H
 #define LITECHAT_LUAMANAGER_H
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 extern "C"
 {
@@ -14,8 +26,68 @@ extern "C"
 #include "lauxlib.h"
 }
 
+#include "LuaAllocator.h"
+#include "MessagePipeline.h"
+#include "RequestContext.h"
+#include "TimerWheel.h"
+
 struct ServerContext;
 
+// Chat.shared_set 存入的值，只支持布尔、数字和字符串。
+struct LuaSharedValue
+{
+    int type = LUA_TNIL;
+    bool boolean = false;
+    bool is_integer = false;
+    lua_Integer integer = 0;
+    lua_Number number = 0;
+    std::string text;
+};
+
+// 单次 Lua 命令的执行预算，由计数钩子每 hook_interval 条指令检查一次。
+struct LuaBudget
+{
+    uint64_t max_instructions = 10'000'000;
+    std::chrono::milliseconds max_time{100};
+    int hook_interval = 1000;
+    // 同一命令累计超出预算这么多次后自动停用，直到脚本重新加载。0 表示不停用。
+    int max_strikes = 3;
+    // 每个 Lua 状态的内存上限，超出时脚本收到内存错误。
+    size_t max_memory = 64 * 1024 * 1024;
+    // Chat.after / Chat.every 同时存在的定时器上限，所有状态合计。
+    size_t max_timers = 256;
+};
+
+// 所有存活状态 (含热加载预建的状态) 的内存汇总。
+struct LuaMemoryStats
+{
+    size_t states = 0;
+    size_t used = 0;
+    size_t reserved = 0;
+    // 单个状态的最高用量。
+    size_t peak = 0;
+    size_t limit = 0;
+    // 因达到上限而失败的分配次数，只统计仍存活的状态。
+    uint64_t failures = 0;
+};
+
+// 执行 Lua 命令的每个线程 (事件循环线程和线程池的每个工作线程) 各自持有一个独立的 lua_State，
+// 都从同一份 commands.lua 加载。状态之间不共享任何 Lua 对象，命令在接到它的线程上直接执行，
+// 各状态互不干扰，可以并行；脚本之间需要共享的数据通过 Chat.shared_get / shared_set / shared_incr
+// 存放在 C++ 侧。
+//
+// 热加载 (/reloadlua 或 inotify 发现脚本被修改) 在调用线程上为新脚本预先建好状态并校验，
+// 成功后才递增脚本代数；各线程在执行下一条命令前发现代数变化，换上预建的新状态并关闭旧状态。
+// 正在执行的命令不受影响，加载失败时继续使用旧脚本。
+//
+// 每条命令在状态内的一个协程中执行。Chat.sleep、Chat.db_get_user 等需要等待的调用让出协程，
+// 不占用线程；等待结束后交回状态的所属线程恢复协程 (事件循环经 eventfd，工作线程经线程池的
+// 专属队列)，其他线程不会持有所属线程的状态锁执行脚本。每次进入 Lua 前仍要加锁。
+//
+// Chat.after / Chat.every 注册的定时器属于注册它的状态，到期时交给该状态的所属线程执行。
+// 脚本加载时 (顶层代码) 注册的定时器属于每个代数专门创建的定时器状态，它不被任何线程用来执行
+// 命令，回调在线程池中依次执行，不会让事件循环或执行命令的线程等待它的锁；
+// 其余状态执行顶层代码时得到相同的句柄但不启动，避免每个线程各执行一遍。
 class LuaManager
 {
 public:
@@ -26,6 +98,14 @@ public:
     LuaManager(const LuaManager&) = delete;
     LuaManager& operator=(const LuaManager&) = delete;
 
+    // 在 initialize() 之前调用。
+    void configure_budget(const LuaBudget& budget);
+
+    // 编译好的脚本缓存到 path，源码与 Lua 版本不变时启动和重新加载都直接载入字节码。
+    // path 为空时只在内存中复用。在 initialize() 之前调用。
+    void configure_bytecode_cache(std::string path);
+
+    // 为调用线程创建 Lua 状态并加载脚本，用于启动时检查脚本能否正常加载。
     bool initialize();
 
     [[nodiscard]] ServerContext& getServerContext() const
@@ -33,22 +113,310 @@ public:
         return ctx_ref;
     }
 
-    bool execute_command(const std::string& nickname, bool is_admin,
-                         const std::string& full_msg);
+    // 重新加载 commands.lua，失败时 error 为原因且旧脚本继续生效。可在任意线程调用，
+    // 多次调用依次执行。
+    bool reload(std::string& error);
+
+    // 监视脚本所在目录，返回 inotify fd 供事件循环监听，失败时返回 -1。
+    int watch_script();
+
+    // inotify fd 可读时调用：读出所有事件，脚本被改写时在线程池中重新加载。
+    void handle_watch_events();
+
+    // 在事件循环线程上调用：创建 eventfd 供事件循环监听，失败时返回 -1。
+    // 之后事件循环线程的状态上挂起的命令经它交回事件循环恢复。
+    int open_loop_queue();
+
+    // open_loop_queue 的 eventfd 可读时在事件循环上调用，执行积压的任务。
+    void run_loop_tasks();
+
+    // 命令未在脚本中定义时返回 false，此时不会调用任何 Lua API。
+    // fd 为发起命令的连接，脚本通过 Chat.reply 回复它。
+    bool execute_command(int fd, const std::string& nickname, bool is_admin,
+                         std::string_view full_msg);
+
+    // 当前脚本是否注册了该类事件的钩子，没有时调用方直接投递，不经过流水线。
+    [[nodiscard]] bool has_hook(PipelineEventType type) const
+    {
+        return (hook_mask.load(std::memory_order_acquire) >> static_cast<unsigned>(type)) & 1u;
+    }
+
+    // 在调用线程的状态上把 events 按类型分批交给已注册的钩子，每个钩子每类只调用一次。
+    // 钩子返回与批次等长的数组：false 丢弃该条，字符串替换正文，其他值照常投递。
+    // 钩子出错或超出预算时，该批消息照常投递。
+    void run_hooks(std::vector<PipelineEvent>& events);
+
+    [[nodiscard]] LuaMemoryStats memory_stats();
+
+    // 因超出预算被中止的命令总数。
+    [[nodiscard]] uint64_t budget_aborts() const
+    {
+        return budget_abort_count.load(std::memory_order_relaxed);
+    }
     ~LuaManager();
 
 private:
+    // 一条命令协程的调用信息，恢复时用于回复发起命令的连接。
+    struct LuaCommandCall
+    {
+        // 协程在注册表中的引用，挂起期间防止被回收。
+        int ref = LUA_NOREF;
+        int fd = -1;
+        uint64_t connection_id = 0;
+        // 协程正在等待的异步操作，完成回调带着相同的编号才能恢复它。
+        uint64_t wait_id = 0;
+        RequestTag tag;
+        std::string command;
+    };
+
+    struct LuaTimer
+    {
+        // 回调函数在注册表中的引用。
+        int ref = LUA_NOREF;
+        std::chrono::milliseconds interval{0};
+        bool periodic = false;
+    };
+
+    // 一个线程的 Lua 状态。脚本加载后即把所有 lua_cmd_* 函数存入注册表，
+    // 按命令名 (不含 "lua_cmd_" 前缀) 保存引用，执行时不再查找全局变量。
+    // 定时器和挂起的协程持有 shared_ptr，状态关闭后 L 为 nullptr。
+    struct LuaWorker : std::enable_shared_from_this<LuaWorker>
+    {
+        // 先于 arena 析构前由 lua_close 关闭。
+        std::unique_ptr<LuaArena> arena;
+        lua_State* L = nullptr;
+        // 加载时的脚本代数，落后于 script_generation 时在下一条命令前换新。
+        uint64_t generation = 0;
+        std::unordered_map<std::string, int> commands;
+        // Chat.on_message 等注册的钩子函数在注册表中的引用。
+        std::array<std::vector<int>, PIPELINE_EVENT_TYPES> hooks;
+
+        [[nodiscard]] uint32_t hook_mask() const
+        {
+            uint32_t mask = 0;
+            for (size_t i = 0; i < hooks.size(); ++i)
+            {
+                if (!hooks[i].empty())
+                {
+                    mask |= 1u << i;
+                }
+            }
+            return mask;
+        }
+
+        // 执行命令、钩子、恢复协程时持有。
+        std::mutex lua_mtx;
+        // 使用该状态执行命令的线程，由 local_state 设置。恢复挂起的协程等任务都交给它执行。
+        // 投递任务时不取 lua_mtx，以免事件循环等待正在执行脚本的状态。
+        std::atomic<std::thread::id> owner{};
+
+        // 没有所属线程 (定时器状态) 时，投递的任务在线程池中依次执行，同一时刻最多占用一个
+        // 工作线程，不会有工作线程空等这个状态的锁。
+        std::mutex strand_mtx;
+        std::deque<std::function<void()>> strand;
+        bool strand_scheduled = false;
+
+        // 正在执行的命令来自哪个连接，没有命令在执行时为 -1。
+        int caller_fd = -1;
+        uint64_t caller_connection_id = 0;
+
+        // 正在执行的命令协程，只有它可以调用会让出的 Chat.* 函数。
+        lua_State* running = nullptr;
+        // Chat.sleep 等本次让出前发起的异步操作编号，0 表示没有，让出后不会被恢复。
+        // 协程结束后 lua_State* 可能被新协程复用，恢复时以编号为准。
+        uint64_t pending_wait = 0;
+        uint64_t next_wait_id = 0;
+        // 等待异步操作完成的命令协程。
+        std::unordered_map<lua_State*, LuaCommandCall> suspended;
+        // 本状态注册的定时器，句柄 -> 回调。
+        std::unordered_map<lua_Integer, LuaTimer> timers;
+        // 正在执行脚本顶层代码，此时注册的定时器等加载完成后再决定是否启动。
+        bool loading = false;
+        uint32_t load_timers = 0;
+        // 已被新状态换下但仍有协程挂起或一次性定时器未到期，全部结束时关闭。
+        bool retired = false;
+
+        [[nodiscard]] bool idle() const
+        {
+            return suspended.empty() && timers.empty();
+        }
+
+        // 当前命令的预算，由 budget_hook 检查。
+        bool budget_active = false;
+        bool budget_exceeded = false;
+        uint64_t instructions = 0;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
     explicit LuaManager(ServerContext& ctx);
 
-    void register_c_functions();
+    // 返回当前线程的 Lua 状态，首次调用或脚本重新加载后创建，加载失败时返回 nullptr。
+    LuaWorker* local_state();
+
+    // 从预建状态中取一个当前代数的，没有时用当前代数的字节码现场创建。
+    std::shared_ptr<LuaWorker> acquire_state(uint64_t generation);
+
+    void retire_state(LuaWorker* worker);
+
+    // 停止状态的周期定时器，还有挂起的协程或一次性定时器时放入 retiring_states，否则立即关闭。
+    void retire(std::shared_ptr<LuaWorker> worker);
+
+    // 换上新代数的定时器状态并启动它在加载时注册的定时器，旧的定时器状态随之退役。
+    void install_timer_state(std::shared_ptr<LuaWorker> worker);
+
+    // 关闭已经没有挂起协程和定时器的退役状态。
+    void close_retired(LuaWorker* worker);
+
+    // 取消状态的全部定时器并关闭 lua_State。
+    void close_state(LuaWorker& worker);
+
+    // 读取脚本并编译成字节码，源码未变时直接使用磁盘缓存。
+    std::shared_ptr<const std::string> compile_script(std::string& error) const;
+
+    // 新建状态并执行已编译的脚本，只做字节码载入，不再解析源码。
+    // keep_timers 为 false 时丢弃顶层代码注册的定时器；为 true 时保留 (不启动)，用于定时器状态。
+    std::shared_ptr<LuaWorker> create_state(uint64_t generation, const std::string& chunk,
+                                            std::string& error, bool keep_timers = false);
+
+    // 以下两个在 create_state 中以保护模式调用，内存不足时加载失败。
+    static int open_state(lua_State* L);
+    static int cache_commands(lua_State* L);
+
+    // 以保护模式执行 build：它在 L 上压入若干值并返回个数。分配失败等错误不会走到 lua_panic。
+    // 成功时返回压入的个数，失败时返回 -1，error 为原因。
+    static int push_protected(lua_State* L, const std::function<int(lua_State*)>& build,
+                              std::string& error);
+
+    // 以保护模式新建协程并存入注册表 (引用写入 ref)，function_ref 指向的函数和 push_args 压入的
+    // nargs 个参数移到协程栈上。失败时返回 nullptr，不留下引用。
+    static lua_State* new_coroutine(lua_State* L, int function_ref,
+                                    const std::function<int(lua_State*)>& push_args,
+                                    int& ref, int& nargs, std::string& error);
+
+    static void budget_hook(lua_State* L, lua_Debug* ar);
+
+    // 在预算内执行栈顶的函数调用，超出预算时按 name 计数。
+    int call_with_budget(LuaWorker& worker, int nargs, int nresults, const std::string& name);
+
+    // 在预算内恢复协程，每次恢复各有一份完整的预算，等待的时间不计入。
+    int resume_with_budget(LuaWorker& worker, lua_State* co, int nargs, const std::string& name);
+
+    void begin_budget(LuaWorker& worker);
+    void end_budget(LuaWorker& worker, lua_State* L, const std::string& name);
+
+    // 启动或恢复命令协程，调用者持有 worker.lua_mtx。协程让出时返回 true (命令已被受理)，
+    // 执行完毕时返回命令的返回值。
+    bool resume_command(LuaWorker& worker, lua_State* co, int nargs, LuaCommandCall call);
+
+    // 把要进入 worker 的任务交给它的所属线程：事件循环线程的状态经 eventfd 交回事件循环，
+    // 工作线程的状态放入该线程的专属队列，没有所属线程的状态放入线程池公共队列。
+    void post_to_owner(const std::shared_ptr<LuaWorker>& worker, std::function<void()> task);
+
+    // 在线程池中依次执行没有所属线程的状态积压的任务。
+    static void drain_strand(const std::shared_ptr<LuaWorker>& worker);
+
+    // 异步操作完成后在所属线程上调用 (经 post_to_owner)：push_results 以保护模式在给定的栈上压入结果并返回个数，
+    // 结果移到协程栈上后恢复协程。内存不足时命令中止。
+    // wait_id 与协程正在等待的操作不符时 (过期的完成回调) 直接返回。
+    void resume_suspended(const std::shared_ptr<LuaWorker>& worker, lua_State* co,
+                          uint64_t wait_id, const std::function<int(lua_State*)>& push_results);
+
+    // 把定时器放上时间轮并登记句柄。limited 为 true 且定时器总数已达上限时返回 false。
+    bool schedule_timer(const std::shared_ptr<LuaWorker>& worker, lua_Integer handle,
+                        std::chrono::milliseconds delay, bool limited);
+
+    TimerWheel::TimerId start_wheel_timer(lua_Integer handle, std::chrono::milliseconds delay);
+
+    // 时间轮到期后经 post_to_owner 在所属状态的线程上调用，执行回调。
+    void run_timer(lua_Integer handle);
+
+    // 可以取消其他状态的定时器，回调引用由所属状态稍后释放。caller 持有自己的锁。
+    bool cancel_timer(LuaWorker* caller, lua_Integer handle);
+
+    // 从 worker.timers 中删除并释放回调引用，调用者持有 worker.lua_mtx。
+    static void release_timer(LuaWorker& worker, lua_Integer handle);
+
+    // 从句柄表和时间轮上移除，不碰 Lua 状态。
+    void unschedule_timer(lua_Integer handle);
+
+    // 在会让出的 Chat.* 函数中、发起异步操作之前调用：L 不是当前命令协程或此处不能让出
+    // (如 table.sort 的比较函数中) 时报错，否则返回状态并登记一个新的等待编号。
+    static LuaWorker* yieldable_worker(lua_State* L, const char* function, uint64_t& wait_id);
+
+    bool is_disabled(const std::string& command);
+
+    void record_budget_abort(const std::string& command);
+
+    static void register_c_functions(lua_State* L);
+
+    static LuaWorker* worker_of(lua_State* L);
+
+    static int lua_panic(lua_State* L);
 
     static int lua_broadcast_message(lua_State* L);
+    static int lua_send_to(lua_State* L);
+    static int lua_send_group(lua_State* L);
+    static int lua_reply(lua_State* L);
+    static int lua_is_online(lua_State* L);
+    static int lua_register_hook(lua_State* L);
+    static int lua_shared_get(lua_State* L);
+    static int lua_shared_set(lua_State* L);
+    static int lua_shared_incr(lua_State* L);
+    static int lua_sleep(lua_State* L);
+    static int lua_db_get_user(lua_State* L);
+    static int lua_add_timer(lua_State* L);
+    static int lua_cancel_timer(lua_State* L);
 
     ServerContext& ctx_ref;
 
-    lua_State* L;
-
+    // 所有线程正在使用的 Lua 状态，以及热加载时预建、尚未被取走的状态。
+    std::vector<std::shared_ptr<LuaWorker>> states;
+    std::vector<std::shared_ptr<LuaWorker>> spare_states;
+    // 已换下、等待挂起协程和定时器结束的状态。
+    std::vector<std::shared_ptr<LuaWorker>> retiring_states;
+    // 当前代数的定时器状态，执行加载时注册的定时器。
+    std::shared_ptr<LuaWorker> timer_state;
     std::mutex mtx;
+
+    // 当前代数的脚本字节码，所有状态都从它创建，由 mtx 保护。
+    std::shared_ptr<const std::string> current_chunk;
+    std::string bytecode_cache_path;
+
+    std::atomic<uint64_t> script_generation{1};
+    std::atomic<uint32_t> hook_mask{0};
+    std::mutex reload_mtx;
+
+    int watch_fd = -1;
+
+    // 交回事件循环执行的任务，由 loop_mtx 保护。
+    int loop_fd = -1;
+    std::thread::id loop_thread;
+    std::vector<std::function<void()>> loop_tasks;
+    std::mutex loop_mtx;
+
+    LuaBudget budget;
+    std::atomic<uint64_t> budget_abort_count{0};
+    // 命令名 (钩子为 "hook:类型#序号"，定时器为 "timer:类型#句柄") -> 超出预算的次数，
+    // 以及已停用的命令；重新加载脚本时清空。
+    std::unordered_map<std::string, int> budget_strikes;
+    std::unordered_set<std::string> disabled_commands;
+    std::shared_mutex budget_mtx;
+
+    std::unordered_map<std::string, LuaSharedValue> shared_values;
+    std::shared_mutex shared_mtx;
+
+    struct TimerEntry
+    {
+        std::weak_ptr<LuaWorker> worker;
+        TimerWheel::TimerId wheel_id = 0;
+    };
+
+    // 所有已启动的定时器，句柄 -> 所属状态。运行时注册的句柄从 1 开始递增；
+    // 加载时注册的句柄为 (代数 << 32) | 序号，同一代数的各状态算出的句柄相同。
+    // 持有 timers_mtx 时不得再取任何状态的 lua_mtx。
+    std::unordered_map<lua_Integer, TimerEntry> timer_index;
+    std::mutex timers_mtx;
+    std::atomic<lua_Integer> next_timer_handle{1};
 };
 
 
@@ -0,0 +1,90 @@
+//
+// Created by X on 2025/11/24.
+//
+
+#ifndef LITECHAT_MESSAGEHISTORY_H
+#define LITECHAT_MESSAGEHISTORY_H
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "OutboundMessage.h"
+
+struct HistoryConfig
+{
+    // 每个群组内存中最多保留的消息条数与字节数。
+    size_t max_messages = 200;
+    size_t max_bytes = 256 * 1024;
+
+    // 被挤出环形缓冲区的消息溢写到 spill_dir/<群名hex>/NNNNNN.seg。
+    std::string spill_dir = "history";
+    size_t segment_bytes = 1024 * 1024;
+    size_t max_segments = 16;
+
+    // 溢写先在内存中攒批，达到该大小后才落盘。
+    size_t spill_flush_bytes = 64 * 1024;
+};
+
+struct HistoryEntry
+{
+    uint64_t seq = 0;
+    int64_t timestamp_ms = 0;
+    SharedFrame frame;
+};
+
+// 单个群组的有界消息历史。槽位在构造时一次性分配，之后只做覆盖写，
+// 不随消息数量增长。本类不加锁，由所属群组的 GroupEntry::mtx 保护。
+class MessageHistory
+{
+public:
+    MessageHistory(const HistoryConfig& config, const std::string& group_name);
+
+    MessageHistory(const MessageHistory&) = delete;
+    MessageHistory& operator=(const MessageHistory&) = delete;
+
+    uint64_t append(SharedFrame frame, int64_t timestamp_ms);
+
+    // 返回 seq < before_seq 的最近 n 条 (before_seq 为 0 表示从最新开始)，按 seq 升序。
+    // 内存中不足 n 条时 need_disk 置为 true，调用者应在释放群组锁后调用 read_spilled。
+    std::vector<HistoryEntry> page(uint64_t before_seq, size_t n,
+                                   bool& need_disk) const;
+
+    [[nodiscard]] uint64_t oldest_seq() const;
+
+    void flush_spill();
+
+    // 关闭服务器时把内存中的全部消息溢写到磁盘，重启后仍可翻页查看。
+    void spill_all();
+
+    // 群组解散时删除所有已溢写的段文件。
+    void discard();
+
+    [[nodiscard]] const std::string& spill_path() const { return dir_; }
+
+    // 从段文件读取 seq < before_seq 的最近 n 条，不需要持有群组锁。
+    static std::vector<HistoryEntry> read_spilled(const std::string& dir,
+                                                  uint64_t before_seq, size_t n);
+
+private:
+    void evict_oldest();
+
+    void write_spill(const char* data, size_t len);
+
+    void recover_from_disk();
+
+    HistoryConfig config_;
+    std::string dir_;
+
+    std::vector<HistoryEntry> slots_;
+    size_t head_ = 0;
+    size_t count_ = 0;
+    size_t bytes_ = 0;
+    uint64_t next_seq_ = 1;
+
+    std::string spill_buffer_;
+    uint64_t segment_index_ = 0;
+    size_t segment_size_ = 0;
+};
+
+#endif //LITECHAT_MESSAGEHISTORY_H
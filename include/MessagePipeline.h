@@ -0,0 +1,66 @@
+//
+// Created by X on 2025/12/05.
+//
+
+#ifndef LITECHAT_MESSAGEPIPELINE_H
+#define LITECHAT_MESSAGEPIPELINE_H
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// 注册了 Lua 钩子的事件类型。取值同时是 Chat.on_message 等钩子的下标。
+enum class PipelineEventType : uint8_t
+{
+    Message,   // 公共聊天消息，Chat.on_message
+    Join,      // 用户登录或恢复会话，Chat.on_join，只通知不拦截
+    GroupSend, // 群消息，Chat.on_group_send
+    Count
+};
+
+inline constexpr size_t PIPELINE_EVENT_TYPES = static_cast<size_t>(PipelineEventType::Count);
+
+struct PipelineEvent
+{
+    PipelineEventType type = PipelineEventType::Message;
+    int fd = -1;
+    std::string from;
+    std::string group;
+    std::string text;
+    // 回显到服务器控制台 (与直接投递时的行为保持一致)。
+    bool echo = false;
+    // 钩子返回 false 时置位，不再投递。
+    bool dropped = false;
+};
+
+// 等待交给 Lua 钩子的事件。任意线程都可以提交，队列由空变为非空时写 eventfd 唤醒事件循环，
+// 事件循环一次取走所有事件，每种钩子每拍只调用一次。
+class MessagePipeline
+{
+public:
+    static MessagePipeline& getInstance();
+
+    MessagePipeline(const MessagePipeline&) = delete;
+    MessagePipeline& operator=(const MessagePipeline&) = delete;
+    ~MessagePipeline();
+
+    // 创建 eventfd，失败时返回 false。
+    bool open();
+
+    [[nodiscard]] int event_fd() const { return event_fd_; }
+
+    void submit(PipelineEvent event);
+
+    // eventfd 可读时调用，取走目前积压的全部事件。
+    std::vector<PipelineEvent> take();
+
+private:
+    MessagePipeline() = default;
+
+    int event_fd_ = -1;
+    std::mutex mtx_;
+    std::vector<PipelineEvent> pending_;
+};
+
+#endif //LITECHAT_MESSAGEPIPELINE_H
@@ -0,0 +1,29 @@
+//
+// Created by X on 2025/11/26.
+//
+
+#ifndef LITECHAT_OUTBOUNDMESSAGE_H
+#define LITECHAT_OUTBOUNDMESSAGE_H
+#include <memory>
+#include <string>
+
+// 群消息在投递和历史记录之间共享同一份字节，不做额外拷贝。
+using SharedFrame = std::shared_ptr<const std::string>;
+
+// 一条待投递的消息同时携带文本协议和二进制协议两种编码，
+// 广播时每种编码只生成一次，按接收方会话协商的协议选择发送哪一份。
+struct OutboundMessage
+{
+    SharedFrame text;
+    SharedFrame binary;
+
+    // 支持压缩的二进制会话使用的编码：首次调用时压缩一次，之后所有接收方复用。
+    // 未达到压缩阈值时返回 binary。一条消息只在一个线程里投递，这里不加锁。
+    const SharedFrame& compressed_binary() const;
+
+private:
+    mutable SharedFrame compressed;
+    mutable bool compression_checked = false;
+};
+
+#endif //LITECHAT_OUTBOUNDMESSAGE_H
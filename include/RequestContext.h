@@ -0,0 +1,43 @@
+//
+// Created by X on 2025/11/29.
+//
+
+#ifndef LITECHAT_REQUESTCONTEXT_H
+#define LITECHAT_REQUESTCONTEXT_H
+#include <cstdint>
+
+// 当前线程正在处理的请求。带请求 ID 的请求在线程池中执行，
+// 其间发往同一连接的回复都会带上该 ID，客户端据此匹配乱序完成的回复。
+struct RequestTag
+{
+    int fd = -1;
+    uint64_t connection_id = 0;
+    uint64_t id = 0;
+    bool tagged = false;
+};
+
+inline RequestTag& current_request()
+{
+    thread_local RequestTag tag;
+    return tag;
+}
+
+// 在作用域内设置当前请求，退出时恢复，异步任务用它把请求 ID 带到执行线程上。
+class RequestScope
+{
+public:
+    explicit RequestScope(const RequestTag& tag) : previous_(current_request())
+    {
+        current_request() = tag;
+    }
+
+    ~RequestScope() { current_request() = previous_; }
+
+    RequestScope(const RequestScope&) = delete;
+    RequestScope& operator=(const RequestScope&) = delete;
+
+private:
+    RequestTag previous_;
+};
+
+#endif //LITECHAT_REQUESTCONTEXT_H
@@ -0,0 +1,69 @@
+//
+// Created by X on 2025/12/02.
+//
+
+#ifndef LITECHAT_RESUMETOKEN_H
+#define LITECHAT_RESUMETOKEN_H
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// 断线重连用的会话令牌，登录成功后签发，/resume 时代替 Argon2 校验。
+//
+// 令牌格式: base64url(payload) "." base64url(HMAC-SHA256(key, payload))，
+// payload 为 "用户名\n过期时间(unix 秒)\n代数"。令牌只证明身份，不携带权限：
+// 管理员身份在兑换时重新从数据库读取，降级后不能靠连续 /resume 保留。
+//
+// 每个用户有一个代数下限，只接受代数不低于它的令牌。签发新令牌、兑换和撤销都会抬高下限，
+// 因此在同一次运行中，同一用户只有最新签发的令牌有效，且只能兑换一次 (兑换成功后会签发新令牌)。
+// 代数取签发时的毫秒时间 (同一毫秒内递增)，撤销把下限抬到当前时间，因此跨越重启代数仍然递增：
+// 重启后登录、撤销或被踢出都会作废重启前签发的令牌。
+// 下限只保存在内存中：配置了固定密钥时，重启前的撤销和兑换记录会丢失，此前已撤销或已兑换、
+// 尚未过期的令牌在重启后、该用户再次登录或撤销之前还能兑换一次。需要在重启时作废全部令牌
+// (例如怀疑令牌泄露) 时，同时更换 RESUME_TOKEN_SECRET。
+struct ResumeClaims
+{
+    std::string username;
+    uint64_t generation = 0;
+};
+
+class ResumeTokenManager
+{
+public:
+    static ResumeTokenManager& getInstance();
+
+    ResumeTokenManager(const ResumeTokenManager&) = delete;
+    ResumeTokenManager& operator=(const ResumeTokenManager&) = delete;
+
+    // secret 为空时使用随机密钥，令牌在重启后全部失效。
+    void configure(std::string_view secret, std::chrono::seconds ttl);
+
+    [[nodiscard]] std::chrono::seconds ttl() const { return ttl_; }
+    [[nodiscard]] bool enabled() const { return !key_.empty(); }
+
+    std::string issue(const std::string& username_raw);
+
+    // 校验签名、有效期和代数，成功时令牌立即作废。
+    bool redeem(std::string_view token, ResumeClaims& claims);
+
+    // 作废该用户已签发的所有令牌。
+    void revoke(const std::string& username_raw);
+
+private:
+    ResumeTokenManager() = default;
+
+    std::string sign(std::string_view payload) const;
+
+    std::vector<unsigned char> key_;
+    std::chrono::seconds ttl_{900};
+
+    std::mutex mtx_;
+    // 小写用户名 -> 可接受的最小代数。
+    std::unordered_map<std::string, uint64_t> min_generation_;
+};
+
+#endif //LITECHAT_RESUMETOKEN_H
@@ -13,14 +13,20 @@
 #include <functional>
 #include "client.h"
 #include "DatabaseManager.h"
+#include "threadpool.h"
+#include "OutboundMessage.h"
 
-class ThreadPool;
 class GroupManager;
 class UserManager;
 
+constexpr size_t PASSWORD_POOL_THREADS = 2;
+
 using MessageSender = std::function<void(int, const std::string&)>;
 
-void send_message_with_length(int fd, const std::string& msg);
+void send_message_with_length(int fd, std::string_view msg);
+
+// 按接收方会话协商的协议选择 msg 的文本或二进制编码发送。
+void send_outbound(int fd, const OutboundMessage& msg);
 
 struct ServerContext
 {
@@ -41,12 +47,17 @@ struct ServerContext
     std::unique_ptr<UserManager> user_manager;
     std::unique_ptr<GroupManager> group_manager;
 
+    // 专用于 Argon2 等 CPU 密集的密码运算，声明在 group_manager 之后，
+    // 析构时先排空其中的任务。
+    ThreadPool password_pool{PASSWORD_POOL_THREADS};
+
     DatabaseManager& db_manager;
 
     explicit ServerContext(ThreadPool& p, const MessageSender& sender,
                            DatabaseManager& db_m);
 
     void broadcast(const std::string& msg, int sender_fd) const;
+    void broadcast(const OutboundMessage& msg, int sender_fd) const;
     std::string get_username(int fd);
     void set_username(int fd, const std::string& username);
     void remove_client(int fd);
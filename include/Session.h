@@ -0,0 +1,76 @@
+//
+// Created by X on 2025/11/26.
+//
+
+#ifndef LITECHAT_SESSION_H
+#define LITECHAT_SESSION_H
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+#include "ConnectionIO.h"
+
+enum class ProtocolMode : uint8_t
+{
+    Text,
+    Binary,
+};
+
+// 每个连接在传输层协商出的状态，与 ServerContext::clients 中的用户状态分开保存。
+struct Session
+{
+    // fd 会被复用，异步回复用它确认连接仍是发起请求的那一个。
+    uint64_t connection_id = 0;
+    ProtocolMode protocol = ProtocolMode::Text;
+    uint8_t version = 0;
+    // HELLO 协商出的能力位 (CAP_*)，未发 HELLO 的旧客户端为 0。
+    uint32_t capabilities = 0;
+    // 由 capabilities 推出的发送快速路径：服务器发往该连接的大帧使用 zstd 压缩。
+    bool compression = false;
+    // 是否已经收到过第一帧，协商只允许发生在第一帧。
+    bool negotiated = false;
+    // 正在线程池中执行的带 ID 请求数。
+    uint32_t in_flight = 0;
+    // 收发缓冲区，连接关闭后仍被持有的线程可以安全访问。
+    std::shared_ptr<ConnectionIO> io;
+};
+
+// 发送路径上每条消息都要查询会话协议，因此使用独立的读写锁，
+// 不与 clients_mtx 互相嵌套 (broadcast 持有 clients_mtx 时也会发送)。
+class SessionTable
+{
+public:
+    static SessionTable& getInstance();
+
+    SessionTable(const SessionTable&) = delete;
+    SessionTable& operator=(const SessionTable&) = delete;
+
+    // tls 为 true 时创建 TLS 会话，失败时返回 false，调用者应关闭该连接。
+    bool open(int fd, Transport transport = Transport::Stream, bool tls = false);
+    void close(int fd);
+
+    [[nodiscard]] ProtocolMode protocol(int fd) const;
+    // 未知的 fd 返回默认会话 (文本协议、已协商)。
+    [[nodiscard]] Session get(int fd) const;
+
+    void mark_negotiated(int fd);
+
+    // 带 ID 的请求开始执行前调用，超过 limit 时返回 false。
+    bool begin_request(int fd, uint32_t limit);
+    void end_request(int fd, uint64_t connection_id);
+
+    // 连接已关闭时返回 nullptr。
+    [[nodiscard]] std::shared_ptr<ConnectionIO> io(int fd) const;
+    void set_protocol(int fd, ProtocolMode mode, uint8_t version, uint32_t capabilities);
+
+private:
+    SessionTable() = default;
+
+    mutable std::shared_mutex mtx;
+    std::unordered_map<int, Session> sessions;
+    std::atomic<uint64_t> next_connection_id{1};
+
+};
+
+#endif //LITECHAT_SESSION_H
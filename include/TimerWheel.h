@@ -0,0 +1,80 @@
+//
+// Created by X on 2025/12/06.
+//
+
+#ifndef LITECHAT_TIMERWHEEL_H
+#define LITECHAT_TIMERWHEEL_H
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// 服务器的定时器。单层时间轮，每格 TICK，共 SLOTS 格；到期时刻相隔整圈的定时器落在同一格，
+// 转到该格时只取出已经到期的。添加和取消都是 O(1)，不论有多少定时器，事件循环每拍只检查经过的格子。
+//
+// 时间轮由一个 timerfd 驱动，只在有定时器时按 TICK 周期触发，空闲时不唤醒事件循环。
+// 回调在事件循环线程上执行，必须很快返回，耗时的工作应交给线程池。
+class TimerWheel
+{
+public:
+    using TimerId = uint64_t;
+    using Callback = std::function<void()>;
+
+    static constexpr std::chrono::milliseconds TICK{10};
+    static constexpr size_t SLOTS = 512;
+
+    static TimerWheel& getInstance();
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+    ~TimerWheel();
+
+    // 创建 timerfd，失败时返回 false。open 之前添加的定时器在 open 之后照常到期。
+    bool open();
+
+    [[nodiscard]] int timer_fd() const { return timer_fd_; }
+
+    // delay 之后 (向上取整到 TICK) 执行 callback。可在任意线程调用，返回的 ID 用于取消。
+    TimerId schedule(std::chrono::milliseconds delay, Callback callback);
+
+    // 定时器已经执行或已被取消时返回 false。
+    bool cancel(TimerId id);
+
+    // timerfd 可读时调用，执行所有已到期的定时器。
+    void expire();
+
+    [[nodiscard]] size_t pending();
+
+private:
+    TimerWheel() : start_(std::chrono::steady_clock::now()) {}
+
+    struct Timer
+    {
+        TimerId id = 0;
+        uint64_t expires = 0;
+        Callback callback;
+    };
+
+    [[nodiscard]] uint64_t now_tick() const;
+
+    // 有无定时器时分别启动和停止 timerfd，调用者持有 mtx_。
+    void arm(bool enable);
+
+    int timer_fd_ = -1;
+    std::chrono::steady_clock::time_point start_;
+
+    std::mutex mtx_;
+    std::array<std::vector<Timer>, SLOTS> slots_;
+    // 定时器 ID -> 所在的格子，用于取消。
+    std::unordered_map<TimerId, size_t> index_;
+    // 已经处理到的格子序号 (自 start_ 起的 TICK 数)。
+    uint64_t current_tick_ = 0;
+    TimerId next_id_ = 1;
+    bool armed_ = false;
+};
+
+#endif //LITECHAT_TIMERWHEEL_H
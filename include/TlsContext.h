@@ -0,0 +1,49 @@
+//
+// Created by X on 2025/12/03.
+//
+
+#ifndef LITECHAT_TLSCONTEXT_H
+#define LITECHAT_TLSCONTEXT_H
+#include <chrono>
+#include <string>
+
+struct ssl_ctx_st;
+struct ssl_st;
+
+struct TlsConfig
+{
+    std::string cert_file;
+    std::string key_file;
+    // 握手完成后尝试把记录层交给内核 (kTLS)，之后收发直接走 socket 系统调用。
+    bool ktls = true;
+    // 会话票据的有效期，客户端在此期间重连只需一次简短握手。
+    std::chrono::seconds session_timeout{7200};
+};
+
+// 服务器端 TLS。SSL_CTX 只读共享，每个连接各自持有一个 SSL。
+// 会话票据由 OpenSSL 用进程内随机密钥加密，服务器不保存会话状态，
+// 因此重启后票据失效，多实例之间也不能互相恢复。
+class TlsContext
+{
+public:
+    static TlsContext& getInstance();
+
+    TlsContext(const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+    ~TlsContext();
+
+    // 启动时调用一次，证书或私钥加载失败时返回 false。
+    bool configure(const TlsConfig& config);
+
+    [[nodiscard]] bool enabled() const { return ctx_ != nullptr; }
+
+    // 为新连接创建处于服务器握手状态的 SSL，失败时返回 nullptr。
+    ssl_st* new_session(int fd) const;
+
+private:
+    TlsContext() = default;
+
+    ssl_ctx_st* ctx_ = nullptr;
+};
+
+#endif //LITECHAT_TLSCONTEXT_H
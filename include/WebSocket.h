@@ -0,0 +1,70 @@
+//
+// Created by X on 2025/12/01.
+//
+
+#ifndef LITECHAT_WEBSOCKET_H
+#define LITECHAT_WEBSOCKET_H
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// WebSocket (RFC 6455) 传输。一个 WebSocket 消息对应原协议中的一帧，
+// 文本消息走文本协议，二进制消息走二进制协议 (HELLO 协商方式不变)。
+
+enum class WsOpcode : uint8_t
+{
+    Continuation = 0x0,
+    Text = 0x1,
+    Binary = 0x2,
+    Close = 0x8,
+    Ping = 0x9,
+    Pong = 0xA,
+};
+
+// 服务器发出的帧不带掩码，头部最长 2 + 8 字节。
+inline constexpr size_t WS_MAX_HEADER_SIZE = 10;
+// 握手请求的上限，超过仍未读到空行的连接直接断开。
+inline constexpr size_t WS_MAX_HANDSHAKE_SIZE = 8 * 1024;
+
+enum class WsHandshakeResult
+{
+    Incomplete,
+    Accepted,
+    Rejected,
+};
+
+// 解析 HTTP Upgrade 请求。Accepted 时 response 为 101 应答，Rejected 时为 400 应答，
+// consumed 为请求占用的字节数。
+WsHandshakeResult parse_ws_handshake(std::string_view request, std::string& response,
+                                     size_t& consumed);
+
+// 写出帧头，返回头部长度。
+size_t encode_ws_header(WsOpcode opcode, size_t payload_size, char* out);
+
+enum class WsParseResult
+{
+    Incomplete,
+    Frame,
+    Error,
+};
+
+struct WsFrame
+{
+    bool fin = false;
+    WsOpcode opcode = WsOpcode::Continuation;
+    // 指向输入缓冲区内已原地去掉掩码的负载。
+    char* payload = nullptr;
+    size_t payload_size = 0;
+    // 整帧 (头部 + 负载) 长度。
+    size_t frame_size = 0;
+};
+
+// 从 data 开头解析一个客户端帧，完整时原地去掉负载的掩码。
+// 未带掩码、使用保留位、控制帧不合法或负载超过 max_payload 时返回 Error。
+WsParseResult parse_ws_frame(char* data, size_t size, size_t max_payload, WsFrame& frame);
+
+// 用 4 字节掩码原地异或，SSE2 可用时每次处理 16 字节。
+void ws_unmask(char* data, size_t size, const uint8_t mask[4]);
+
+#endif //LITECHAT_WEBSOCKET_H
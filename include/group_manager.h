@@ -10,86 +10,151 @@
 #include <vector>
 #include <mutex>
 #include <functional>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
 #include "ServerContext.h"
 #include "json.hpp"
+#include "Group.h"
+#include "GroupSnapshot.h"
+#include "GroupTable.h"
+#include "MessageHistory.h"
+#include "BinaryProtocol.h"
+#include "CommandParser.h"
 
 struct ServerContext;
+class ThreadPool;
 
 using MessageSender = std::function<void(int, const std::string&)>;
 
 using json = nlohmann::json;
 
 inline const std::string JSON_FILE = "groups_data.json";
-
-struct Group
-{
-    std::string name;
-
-    std::string owner_nickname;
-
-    std::unordered_set<std::string> members;
-
-    std::string password_hash;
-
-    std::unordered_set<std::string> banned_members;
-};
-
-inline void to_json(json& j, const Group& g)
-{
-    j = json{
-        {"name", g.name},
-        {"owner", g.owner_nickname},
-        {"members", g.members},
-        {"password_hash", g.password_hash},
-        {"banned_members", g.banned_members}
-    };
-}
-
-inline void from_json(const json& j, Group& g)
-{
-    j.at("name").get_to(g.name);
-    j.at("owner").get_to(g.owner_nickname);
-    j.at("members").get_to(g.members);
-    j.at("banned_members").get_to(g.banned_members);
-
-    if (j.count("password_hash"))
-    {
-        j.at("password_hash").get_to(g.password_hash);
-    }
-    else
-    {
-        g.password_hash = "";
-    }
-}
+inline const std::string SNAPSHOT_FILE = "groups_data.snap";
 
 class GroupManager
 {
 public:
     explicit GroupManager(MessageSender sender, const ServerContext& ctx_ref);
-    ~GroupManager() = default;
+    ~GroupManager();
 
     std::string handle_create_group(const std::string& username,
-                                    const std::vector<std::string>& parts);
+                                    const CommandArgs& parts);
     std::string handle_join_group(const std::string& username,
-                                  const std::vector<std::string>& parts);
-    std::string handle_send_message(const std::string& username,
-                                    const std::vector<std::string>& parts);
+                                  const CommandArgs& parts);
+    // 二进制协议的 GROUP_SEND 与 /send 共用，返回结构化的错误码。
+    ProtocolError send_group_message(const std::string& username_raw,
+                                     const std::string& group_name_raw,
+                                     const std::string& content);
+    // 只检查群是否存在以及 username_raw 是否为成员，不发送。
+    ProtocolError check_member(const std::string& username_raw,
+                               const std::string& group_name_raw);
+    // 把已编码好的消息投递给群内所有在线成员 (不记录历史)，供脚本等非成员发送者使用。
+    ProtocolError deliver_to_group(const std::string& group_name_raw,
+                                   const OutboundMessage& msg);
     std::string handle_list_groups() const;
+    std::string handle_history(const std::string& username,
+                               const CommandArgs& parts);
     static void remove_client_from_groups(const std::string& username);
     std::string handle_group_kick(const std::string& kicker_nickname,
-                                  const std::vector<std::string>& parts);
+                                  const CommandArgs& parts);
     std::string handle_group_leave(const std::string& username,
-                                   const std::vector<std::string>& parts);
+                                   const CommandArgs& parts);
     std::string handle_group_unban(const std::string& kicker_nickname,
-                                   const std::vector<std::string>& parts);
+                                   const CommandArgs& parts);
     std::string handle_group_transfer(const std::string& kicker_nickname_raw,
-                                      const std::vector<std::string>& parts);
+                                      const CommandArgs& parts);
     void load_groups_from_file(const std::string& filename);
     void save_groups_to_file(const std::string& filename) const;
 
+    // 优先 mmap 二进制快照，快照不存在时从 JSON 加载并立即转换为快照。
+    void load_groups(const std::string& snapshot_filename,
+                     const std::string& json_filename);
+    bool save_snapshot(const std::string& filename) const;
+
+    // 后台线程每隔 interval 检查一次，有变更时写快照；/snapshot 可立即触发。
+    void start_background_snapshots(const std::string& filename,
+                                    std::chrono::seconds interval);
+    // 唤醒后台线程立即写快照，后台线程未启动时返回 false。
+    bool request_snapshot();
+    void stop_background_snapshots();
+
+    // 群组密码的 Argon2 哈希/校验在该线程池中执行，为空时同步执行。
+    void set_password_executor(ThreadPool* executor);
+
+    void configure_history(const HistoryConfig& config);
+    // 将所有已加载群组的历史消息落盘，关闭服务器时调用。
+    void flush_history();
+
 private:
-    std::unordered_map<std::string, Group> groups;
-    mutable std::mutex mtx;
+    // 群组索引按群名分片，每个群组有自己的锁，不同群组之间互不阻塞。
+    GroupTable groups;
+
+    // 保护 snapshot 与 snapshot_tombstones，只在懒加载和解散群组时使用。
+    mutable std::mutex snapshot_mtx;
+
+    // 启动时映射的快照，群组在首次访问时才解码进 groups。
+    std::shared_ptr<const GroupSnapshot> snapshot;
+    // 已解散但仍存在于快照中的群组，防止被再次懒加载。
+    std::unordered_set<std::string> snapshot_tombstones;
+
+    GroupEntryPtr find_group(const std::string& group_name);
+    // 调用者必须持有 entry->mtx。
+    void remove_group(const std::string& group_name, const GroupEntryPtr& entry);
+    std::vector<Group> materialize_all() const;
+
+    // 某一时刻的群组只读视图：已加载群组的 state 指针 + 仍未被访问的快照记录。
+    struct GroupStateView
+    {
+        std::vector<std::shared_ptr<const Group>> groups;
+        std::shared_ptr<const GroupSnapshot> base;
+        std::vector<size_t> raw_indices;
+    };
+
+    GroupStateView capture_view() const;
+    static bool write_view(const GroupStateView& view, const std::string& filename);
+
+    // 调用者必须持有 entry.mtx。仅当有快照仍引用旧状态时才真正复制。
+    Group& edit(GroupEntry& entry);
+
+    std::atomic<uint64_t> mutation_epoch{0};
+
+    mutable std::mutex snapshot_write_mtx;
+
+    std::thread snapshot_thread;
+    std::mutex snapshot_thread_mtx;
+    std::condition_variable snapshot_cv;
+    bool snapshot_requested = false;
+    bool snapshot_stop = false;
+    std::string snapshot_filename;
+    std::chrono::seconds snapshot_interval{60};
+
+    void snapshot_loop();
+
+    HistoryConfig history_config;
+
+    ThreadPool* password_executor = nullptr;
+
+    void run_password_task(std::function<void()> task);
+    void reply_async(const std::string& username_raw, const std::string& msg) const;
+
+    std::string commit_create(const std::string& group_name,
+                              const std::string& group_name_raw,
+                              const std::string& creator_nickname,
+                              const std::string& password_hash);
+    std::string commit_join(const GroupEntryPtr& entry, const std::string& username,
+                            const std::string& group_name,
+                            const std::string& group_name_raw,
+                            const std::string& verified_hash);
+
+    // 调用者必须持有 entry.mtx。
+    MessageHistory& history_of(GroupEntry& entry) const;
+
+    template <typename Names>
+    void notify_members(const Names& members, const std::string& msg) const;
+    template <typename Names>
+    void notify_members(const Names& members, const OutboundMessage& msg) const;
 
     MessageSender message_sender;
 
@@ -97,7 +162,7 @@ private:
 
     static std::vector<std::string> split(const std::string& s, char delimiter);
 
-    static std::string to_lower_nickname(const std::string& nickname);
+    static std::string to_lower_nickname(std::string_view nickname);
 };
 
 #endif  // LITECHAT_GROUP_MANAGER_H
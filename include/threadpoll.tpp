@@ -10,13 +10,21 @@
 
 inline ThreadPool::ThreadPool(size_t n) : stop(false)
 {
+    // 登记完所有线程的专属队列后工作线程才能取任务。
+    std::unique_lock<std::mutex> lock(mtx);
     for (size_t i = 0; i < n; i++)
     {
         workers.emplace_back([this]() { worker_loop(); });
+        pinned[workers.back().get_id()];
     }
 }
 
 inline ThreadPool::~ThreadPool()
+{
+    shutdown();
+}
+
+inline void ThreadPool::shutdown()
 {
     {
         std::unique_lock<std::mutex> lock(mtx);
@@ -44,22 +52,48 @@ inline void ThreadPool::enqueue(std::function<void()> task)
     cv.notify_one();
 }
 
+inline void ThreadPool::enqueue_to(std::thread::id id, std::function<void()> task)
+{
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        auto it = pinned.find(id);
+        if (it == pinned.end())
+        {
+            tasks.push(std::move(task));
+        }
+        else
+        {
+            it->second.push(std::move(task));
+        }
+    }
+
+    // 条件变量是共用的，notify_one 可能唤醒别的线程，只能全部唤醒。
+    cv.notify_all();
+}
+
 inline void ThreadPool::worker_loop()
 {
+    std::queue<std::function<void()>>* own;
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        own = &pinned[std::this_thread::get_id()];
+    }
+
     while (true)
     {
         std::function<void()> task;
         {
             std::unique_lock<std::mutex> lock(mtx);
-            cv.wait(lock, [this]() { return stop || !tasks.empty(); });
+            cv.wait(lock, [this, own]() { return stop || !own->empty() || !tasks.empty(); });
 
-            if (stop && tasks.empty())
+            if (stop && own->empty() && tasks.empty())
             {
                 return;
             }
 
-            task = std::move(tasks.front());
-            tasks.pop();
+            std::queue<std::function<void()>>& queue = own->empty() ? tasks : *own;
+            task = std::move(queue.front());
+            queue.pop();
         }
 
         try
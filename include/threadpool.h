@@ -9,6 +9,7 @@
 #include <mutex>
 #include <queue>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 class ThreadPool
@@ -20,9 +21,18 @@ public:
 
     void enqueue(std::function<void()> task);
 
+    // 只交给指定的工作线程执行，该线程优先处理发给自己的任务。
+    // id 不是本线程池的工作线程时放入公共队列，由任意线程执行。
+    void enqueue_to(std::thread::id id, std::function<void()> task);
+
+    // 执行完队列中剩余的任务后停止所有线程，可重复调用。
+    void shutdown();
+
 private:
     std::vector<std::thread> workers;
     std::queue<std::function<void()>> tasks;
+    // 每个工作线程专属的队列，构造后不再增删键。
+    std::unordered_map<std::thread::id, std::queue<std::function<void()>>> pinned;
 
     std::mutex mtx;
     std::condition_variable cv;
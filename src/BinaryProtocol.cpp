@@ -0,0 +1,294 @@
+//
+// Created by X on 2025/11/26.
+//
+#include "../include/BinaryProtocol.h"
+
+#include <charconv>
+#include <cstring>
+
+namespace
+{
+    struct CapabilityName
+    {
+        uint32_t bit;
+        std::string_view name;
+    };
+
+    constexpr CapabilityName CAPABILITY_NAMES[] = {
+        {CAP_ZSTD, "zstd"},
+        {CAP_BATCH, "batch"},
+        {CAP_TAGGED, "tagged"},
+        {CAP_RESUME, "resume"},
+    };
+}
+
+bool parse_binary_hello(std::string_view frame, uint8_t& version, uint32_t& capabilities)
+{
+    constexpr size_t magic_size = sizeof(BINARY_HELLO_MAGIC);
+    if (frame.size() < magic_size + 1 ||
+        std::memcmp(frame.data(), BINARY_HELLO_MAGIC, magic_size) != 0)
+    {
+        return false;
+    }
+    version = static_cast<uint8_t>(frame[magic_size]);
+
+    BinaryReader reader(frame.substr(magic_size + 1));
+    if (version < 2)
+    {
+        // v1 的 flags 只有压缩一位，请求 ID 与批量帧当时不需要协商。
+        uint8_t flags = 0;
+        reader.u8(flags);
+        capabilities = (flags & CAP_ZSTD) | CAP_BATCH | CAP_TAGGED;
+        return true;
+    }
+
+    uint64_t caps = 0;
+    reader.varint(caps);
+    capabilities = static_cast<uint32_t>(caps);
+    return true;
+}
+
+bool parse_text_hello(std::string_view frame, uint8_t& version, uint32_t& capabilities)
+{
+    constexpr std::string_view prefix = "HELLO ";
+    if (frame.substr(0, prefix.size()) != prefix)
+    {
+        return false;
+    }
+    frame.remove_prefix(prefix.size());
+
+    size_t end = frame.find_first_of(" \r\n");
+    std::string_view version_text = frame.substr(0, end);
+    unsigned parsed = 0;
+    auto [ptr, ec] = std::from_chars(version_text.data(),
+                                     version_text.data() + version_text.size(), parsed);
+    if (ec != std::errc() || ptr != version_text.data() + version_text.size() || parsed > 255)
+    {
+        return false;
+    }
+    version = static_cast<uint8_t>(parsed);
+
+    capabilities = 0;
+    std::string_view rest = end == std::string_view::npos ? std::string_view() : frame.substr(end);
+    size_t begin = rest.find_first_not_of(" \r\n");
+    if (begin == std::string_view::npos)
+    {
+        return true;
+    }
+    rest = rest.substr(begin, rest.find_first_of(" \r\n", begin) - begin);
+    while (!rest.empty())
+    {
+        size_t comma = rest.find(',');
+        std::string_view name = rest.substr(0, comma);
+        for (const CapabilityName& cap : CAPABILITY_NAMES)
+        {
+            if (cap.name == name)
+            {
+                capabilities |= cap.bit;
+            }
+        }
+        if (comma == std::string_view::npos)
+        {
+            break;
+        }
+        rest.remove_prefix(comma + 1);
+    }
+    return true;
+}
+
+std::string encode_hello_ack(const ServerHello& hello)
+{
+    if (hello.version < 2)
+    {
+        return BinaryWriter(Opcode::HelloAck, 8)
+               .u8(hello.version)
+               .u8(static_cast<uint8_t>(hello.capabilities & CAP_ZSTD))
+               .varint(hello.dictionary_id)
+               .take();
+    }
+    return BinaryWriter(Opcode::HelloAck, 32)
+           .u8(hello.version)
+           .varint(hello.capabilities)
+           .varint(hello.dictionary_id)
+           .varint(hello.max_frame_size)
+           .varint(hello.heartbeat_timeout)
+           .varint(hello.max_pipelined)
+           .varint(hello.max_batch)
+           .varint(hello.compression_threshold)
+           .take();
+}
+
+std::string format_text_hello(const ServerHello& hello)
+{
+    std::string caps;
+    for (const CapabilityName& cap : CAPABILITY_NAMES)
+    {
+        if (hello.capabilities & cap.bit)
+        {
+            if (!caps.empty())
+            {
+                caps += ',';
+            }
+            caps.append(cap.name.data(), cap.name.size());
+        }
+    }
+
+    return "HELLO " + std::to_string(hello.version) +
+           " caps=" + caps +
+           " max_frame=" + std::to_string(hello.max_frame_size) +
+           " heartbeat=" + std::to_string(hello.heartbeat_timeout) +
+           " max_pipelined=" + std::to_string(hello.max_pipelined) +
+           " max_batch=" + std::to_string(hello.max_batch);
+}
+
+std::string encode_text_frame(std::string_view text)
+{
+    return BinaryWriter(Opcode::Text, text.size() + 6).str(text).take();
+}
+
+std::string encode_ack(Opcode request)
+{
+    return BinaryWriter(Opcode::Ack, 2).u8(static_cast<uint8_t>(request)).take();
+}
+
+std::string encode_error(Opcode request, ProtocolError code, std::string_view message)
+{
+    return BinaryWriter(Opcode::Error, message.size() + 10)
+           .u8(static_cast<uint8_t>(request))
+           .varint(static_cast<uint16_t>(code))
+           .str(message)
+           .take();
+}
+
+std::string encode_tagged(uint64_t request_id, std::string_view inner)
+{
+    std::string out = BinaryWriter(Opcode::Tagged, inner.size() + 12).varint(request_id).take();
+    out.append(inner.data(), inner.size());
+    return out;
+}
+
+std::string encode_resume_token(std::string_view token, uint64_t ttl_seconds)
+{
+    return BinaryWriter(Opcode::ResumeToken, token.size() + 16).str(token).varint(ttl_seconds).take();
+}
+
+bool parse_text_request_tag(std::string_view frame, uint64_t& request_id,
+                            std::string_view& inner)
+{
+    // 最多 19 位十进制数，不会溢出 uint64_t。
+    constexpr size_t max_digits = 19;
+    if (frame.size() < 3 || frame[0] != '@')
+    {
+        return false;
+    }
+
+    uint64_t id = 0;
+    size_t pos = 1;
+    while (pos < frame.size() && pos <= max_digits && frame[pos] >= '0' && frame[pos] <= '9')
+    {
+        id = id * 10 + static_cast<uint64_t>(frame[pos] - '0');
+        ++pos;
+    }
+    if (pos == 1 || pos >= frame.size() || frame[pos] != ' ')
+    {
+        return false;
+    }
+
+    request_id = id;
+    inner = frame.substr(pos + 1);
+    return true;
+}
+
+OutboundMessage make_chat_message(const std::string& from, const std::string& text)
+{
+    OutboundMessage out;
+    out.text = std::make_shared<const std::string>(from + ": " + text);
+    out.binary = std::make_shared<const std::string>(
+        BinaryWriter(Opcode::ChatEvent, from.size() + text.size() + 12)
+        .str(from)
+        .str(text)
+        .take());
+    return out;
+}
+
+OutboundMessage make_whisper_message(const std::string& from, const std::string& text)
+{
+    OutboundMessage out;
+    out.text = std::make_shared<const std::string>(
+        "来自 " + from + " 的私聊：" + text + "\n");
+    out.binary = std::make_shared<const std::string>(
+        BinaryWriter(Opcode::WhisperEvent, from.size() + text.size() + 12)
+        .str(from)
+        .str(text)
+        .take());
+    return out;
+}
+
+OutboundMessage make_group_message(std::string_view group, std::string_view from,
+                                   std::string_view text)
+{
+    std::string line;
+    line.reserve(group.size() + from.size() + text.size() + 5);
+    line.append("[").append(group).append("]").append(from).append(": ").append(text).append("\n");
+
+    OutboundMessage out;
+    out.text = std::make_shared<const std::string>(std::move(line));
+    out.binary = std::make_shared<const std::string>(
+        BinaryWriter(Opcode::GroupEvent, group.size() + from.size() + text.size() + 16)
+        .str(group)
+        .str(from)
+        .str(text)
+        .take());
+    return out;
+}
+
+OutboundMessage make_presence_message(const std::string& user, bool online)
+{
+    OutboundMessage out;
+    out.text = std::make_shared<const std::string>(
+        user + (online ? " 加入聊天室" : " 退出聊天室"));
+    out.binary = std::make_shared<const std::string>(
+        BinaryWriter(Opcode::Presence, user.size() + 8)
+        .str(user)
+        .u8(online ? 1 : 0)
+        .take());
+    return out;
+}
+
+OutboundMessage make_notice_message(std::string_view text)
+{
+    OutboundMessage out;
+    out.text = std::make_shared<const std::string>(text);
+    out.binary = std::make_shared<const std::string>(encode_text_frame(text));
+    return out;
+}
+
+const char* protocol_error_text(ProtocolError code)
+{
+    switch (code)
+    {
+    case ProtocolError::None:
+        return "";
+    case ProtocolError::MalformedFrame:
+        return "错误：消息格式不正确。";
+    case ProtocolError::UnsupportedVersion:
+        return "错误：不支持的协议版本。";
+    case ProtocolError::UnknownOpcode:
+        return "错误：未知的操作码。";
+    case ProtocolError::NotLoggedIn:
+        return "请先使用 /register <用户名> <密码> 或 /login <用户名> <密码>。";
+    case ProtocolError::PermissionDenied:
+        return "错误：权限不足。";
+    case ProtocolError::InvalidArgument:
+        return "错误：参数无效。";
+    case ProtocolError::UserOffline:
+        return "错误：用户不在线或不存在。";
+    case ProtocolError::GroupNotFound:
+        return "错误：该群不存在。\n";
+    case ProtocolError::NotGroupMember:
+        return "错误：您不是该群的成员。\n";
+    case ProtocolError::TooManyRequests:
+        return "错误：未完成的请求过多，请稍后再试。";
+    }
+    return "错误：未知错误。";
+}
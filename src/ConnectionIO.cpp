@@ -0,0 +1,455 @@
+//
+// Created by X on 2025/11/30.
+//
+#include "../include/ConnectionIO.h"
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include "../include/Logger.h"
+
+namespace
+{
+    ConnectionLimits limits;
+    std::atomic<size_t> global_buffered{0};
+    std::atomic<int> epoll_instance{-1};
+
+    std::mutex overflow_mtx;
+    std::vector<int> overflowed_fds;
+
+    // 空闲时保留的缓冲区容量，超过它的部分会归还给分配器。
+    constexpr size_t IDLE_BUFFER_CAPACITY = 4096;
+
+    void update_accounting(size_t& accounted, size_t now)
+    {
+        if (now > accounted)
+        {
+            global_buffered.fetch_add(now - accounted, std::memory_order_relaxed);
+        }
+        else
+        {
+            global_buffered.fetch_sub(accounted - now, std::memory_order_relaxed);
+        }
+        accounted = now;
+    }
+
+    void release_if_idle(std::string& buffer)
+    {
+        if (buffer.empty() && buffer.capacity() > IDLE_BUFFER_CAPACITY)
+        {
+            std::string().swap(buffer);
+        }
+    }
+}
+
+void configure_connection_limits(const ConnectionLimits& new_limits)
+{
+    limits = new_limits;
+    // 接收缓冲区至少要能放下一个最大帧及其帧头 (客户端 WebSocket 帧头最长 14 字节)。
+    constexpr size_t max_frame_header = 14;
+    if (limits.max_inbound_bytes < limits.max_frame_size + max_frame_header)
+    {
+        limits.max_inbound_bytes = limits.max_frame_size + max_frame_header;
+    }
+}
+
+const ConnectionLimits& connection_limits()
+{
+    return limits;
+}
+
+size_t buffered_bytes()
+{
+    return global_buffered.load(std::memory_order_relaxed);
+}
+
+void set_connection_epoll_fd(int epoll_fd)
+{
+    epoll_instance = epoll_fd;
+}
+
+std::vector<int> take_overflowed_connections()
+{
+    std::lock_guard<std::mutex> lock(overflow_mtx);
+    std::vector<int> out;
+    out.swap(overflowed_fds);
+    return out;
+}
+
+ConnectionIO::~ConnectionIO()
+{
+    global_buffered.fetch_sub(accounted_inbound + accounted_outbound,
+                              std::memory_order_relaxed);
+    SSL_free(ssl_);
+}
+
+void ConnectionIO::attach_tls(ssl_st* ssl)
+{
+    ssl_ = ssl;
+}
+
+void ConnectionIO::close()
+{
+    std::lock_guard<std::mutex> lock(out_mtx);
+    if (closed)
+    {
+        return;
+    }
+    closed = true;
+    // 尽力发出 close_notify，不等待对方回应。
+    if (ssl_ && tls_ready_)
+    {
+        SSL_shutdown(ssl_);
+        ERR_clear_error();
+    }
+}
+
+ssize_t ConnectionIO::tls_status(int fd, int ret)
+{
+    switch (SSL_get_error(ssl_, ret))
+    {
+    case SSL_ERROR_WANT_READ:
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_WANT_WRITE:
+        set_want_write(fd, true);
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    default:
+        ERR_clear_error();
+        errno = EPROTO;
+        return -1;
+    }
+}
+
+void ConnectionIO::on_handshake_complete(int fd)
+{
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    ktls_send_ = BIO_get_ktls_send(SSL_get_wbio(ssl_)) == 1;
+    ktls_recv_ = BIO_get_ktls_recv(SSL_get_rbio(ssl_)) == 1;
+#endif
+    tls_ready_ = true;
+    LOG_DEBUG("客户端 fd=" << fd << " TLS 握手完成: " << SSL_get_version(ssl_)
+              << (SSL_session_reused(ssl_) ? " (会话恢复)" : "")
+              << "，kTLS 发送=" << ktls_send_ << " 接收=" << ktls_recv_);
+}
+
+ssize_t ConnectionIO::read(int fd, char* buf, size_t len)
+{
+    if (!ssl_ || ktls_recv_)
+    {
+        return recv(fd, buf, len, 0);
+    }
+
+    std::lock_guard<std::mutex> lock(out_mtx);
+    if (!tls_ready_)
+    {
+        int ret = SSL_do_handshake(ssl_);
+        if (ret != 1)
+        {
+            ssize_t status = tls_status(fd, ret);
+            if (status == -1 && errno == EPROTO)
+            {
+                LOG_WARNING("客户端 fd=" << fd << " TLS 握手失败。");
+            }
+            return status;
+        }
+        on_handshake_complete(fd);
+        if (ktls_recv_)
+        {
+            return recv(fd, buf, len, 0);
+        }
+    }
+
+    int n = SSL_read(ssl_, buf, static_cast<int>(std::min<size_t>(len, INT_MAX)));
+    if (n > 0)
+    {
+        return n;
+    }
+    return tls_status(fd, n);
+}
+
+void ConnectionIO::account_inbound()
+{
+    update_accounting(accounted_inbound, inbound.capacity() + ws_message.capacity());
+}
+
+void ConnectionIO::shrink_inbound()
+{
+    release_if_idle(inbound);
+    release_if_idle(ws_message);
+    account_inbound();
+}
+
+void ConnectionIO::account_outbound()
+{
+    update_accounting(accounted_outbound, outbound.capacity());
+    outbound_pending_.store(outbound.size() - out_offset, std::memory_order_relaxed);
+}
+
+bool ConnectionIO::should_pause_reading() const
+{
+    return outbound_pending() > limits.max_outbound_bytes / 2 ||
+           inbound.size() + pending_request_bytes.load(std::memory_order_relaxed) >=
+           limits.max_inbound_bytes ||
+           buffered_bytes() > limits.max_global_bytes;
+}
+
+void ConnectionIO::set_want_write(int fd, bool want)
+{
+    if (want_write == want)
+    {
+        return;
+    }
+    want_write = want;
+
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLET | (want ? EPOLLOUT : 0);
+    ev.data.fd = fd;
+    epoll_ctl(epoll_instance.load(), EPOLL_CTL_MOD, fd, &ev);
+}
+
+bool ConnectionIO::send_plain(int fd, const std::string_view* parts, size_t count,
+                              size_t& sent)
+{
+    // 每次 sendmsg 最多携带的片段数，远小于 IOV_MAX。
+    constexpr size_t max_iov = 64;
+
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        total += parts[i].size();
+    }
+
+    while (sent < total)
+    {
+        iovec iov[max_iov];
+        size_t iov_count = 0;
+        size_t skip = sent;
+        for (size_t i = 0; i < count && iov_count < max_iov; ++i)
+        {
+            if (skip >= parts[i].size())
+            {
+                skip -= parts[i].size();
+                continue;
+            }
+            iov[iov_count].iov_base = const_cast<char*>(parts[i].data() + skip);
+            iov[iov_count].iov_len = parts[i].size() - skip;
+            skip = 0;
+            ++iov_count;
+        }
+
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iov_count;
+
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n > 0)
+        {
+            sent += static_cast<size_t>(n);
+            continue;
+        }
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return true;
+        }
+        // 对端已关闭，读事件会负责清理连接。
+        return false;
+    }
+    return true;
+}
+
+// SSL_write 不支持分散写，帧头和负载分成两条记录发出，以免为拼接再拷贝一次负载。
+bool ConnectionIO::send_tls(std::string_view data, size_t& sent)
+{
+    while (sent < data.size())
+    {
+        int n = SSL_write(ssl_, data.data() + sent,
+                          static_cast<int>(std::min<size_t>(data.size() - sent, INT_MAX)));
+        if (n > 0)
+        {
+            sent += static_cast<size_t>(n);
+            continue;
+        }
+        int err = SSL_get_error(ssl_, n);
+        if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ)
+        {
+            // 未写完的部分会原样排入输出缓冲区，重试时内容一致。
+            return true;
+        }
+        ERR_clear_error();
+        return false;
+    }
+    return true;
+}
+
+bool ConnectionIO::write(int fd, std::string_view header, std::string_view payload)
+{
+    std::string_view parts[2] = {header, payload};
+    return write(fd, parts, 2);
+}
+
+bool ConnectionIO::write(int fd, const std::string_view* parts, size_t count)
+{
+    std::lock_guard<std::mutex> lock(out_mtx);
+    if (overflowed || closed)
+    {
+        return false;
+    }
+    if (ssl_ && !tls_ready_)
+    {
+        return true;
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        total += parts[i].size();
+    }
+    size_t sent = 0;
+
+    // 没有积压时直接写 socket，不经过缓冲区。
+    if (outbound.size() == out_offset)
+    {
+        bool ok = true;
+        if (ssl_ && !ktls_send_)
+        {
+            // 单帧时帧头和负载各成一条记录，避免为拼接拷贝负载；多帧时拼成一条记录。
+            if (count <= 2)
+            {
+                for (size_t i = 0; i < count && ok; ++i)
+                {
+                    size_t part_sent = 0;
+                    ok = send_tls(parts[i], part_sent);
+                    sent += part_sent;
+                    if (part_sent < parts[i].size())
+                    {
+                        break;
+                    }
+                }
+            }
+            else
+            {
+                std::string joined;
+                joined.reserve(total);
+                for (size_t i = 0; i < count; ++i)
+                {
+                    joined.append(parts[i].data(), parts[i].size());
+                }
+                ok = send_tls(joined, sent);
+            }
+        }
+        else
+        {
+            ok = send_plain(fd, parts, count, sent);
+        }
+        if (!ok)
+        {
+            return false;
+        }
+    }
+
+    if (sent == total)
+    {
+        return true;
+    }
+
+    size_t remaining = total - sent;
+    size_t pending = outbound.size() - out_offset;
+    if (pending + remaining > limits.max_outbound_bytes ||
+        buffered_bytes() + remaining > limits.max_global_bytes)
+    {
+        overflowed = true;
+        LOG_WARNING("客户端 fd=" << fd << " 待发送数据积压 " << pending
+                    << " 字节，超过限制，将断开连接。");
+        std::lock_guard<std::mutex> overflow_lock(overflow_mtx);
+        overflowed_fds.push_back(fd);
+        return false;
+    }
+
+    if (out_offset > 0 && out_offset >= outbound.size() / 2)
+    {
+        outbound.erase(0, out_offset);
+        out_offset = 0;
+    }
+
+    size_t skip = sent;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (skip >= parts[i].size())
+        {
+            skip -= parts[i].size();
+            continue;
+        }
+        outbound.append(parts[i].data() + skip, parts[i].size() - skip);
+        skip = 0;
+    }
+    account_outbound();
+    set_want_write(fd, true);
+    return true;
+}
+
+bool ConnectionIO::flush(int fd)
+{
+    std::lock_guard<std::mutex> lock(out_mtx);
+    if (closed)
+    {
+        return true;
+    }
+
+    if (ssl_ && tls_ready_ && !ktls_send_)
+    {
+        size_t sent = 0;
+        std::string_view pending(outbound.data() + out_offset, outbound.size() - out_offset);
+        if (!send_tls(pending, sent))
+        {
+            return false;
+        }
+        out_offset += sent;
+    }
+    else
+    {
+        while (out_offset < outbound.size())
+        {
+            ssize_t n = send(fd, outbound.data() + out_offset, outbound.size() - out_offset,
+                             MSG_NOSIGNAL);
+            if (n > 0)
+            {
+                out_offset += static_cast<size_t>(n);
+                continue;
+            }
+            if (n == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                break;
+            }
+            return false;
+        }
+    }
+
+    if (out_offset == outbound.size())
+    {
+        outbound.clear();
+        out_offset = 0;
+        release_if_idle(outbound);
+        set_want_write(fd, false);
+    }
+    account_outbound();
+    return true;
+}
@@ -0,0 +1,127 @@
+//
+// Created by X on 2025/11/28.
+//
+#include "../include/FrameCompressor.h"
+
+#include <zstd.h>
+
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include "../include/BinaryProtocol.h"
+#include "../include/Logger.h"
+
+namespace
+{
+    struct CCtxDeleter
+    {
+        void operator()(ZSTD_CCtx* cctx) const { ZSTD_freeCCtx(cctx); }
+    };
+
+    ZSTD_CCtx* thread_cctx()
+    {
+        thread_local std::unique_ptr<ZSTD_CCtx, CCtxDeleter> cctx(ZSTD_createCCtx());
+        return cctx.get();
+    }
+}
+
+FrameCompressor& FrameCompressor::getInstance()
+{
+    static FrameCompressor instance;
+    return instance;
+}
+
+FrameCompressor::~FrameCompressor()
+{
+    if (cdict_)
+    {
+        ZSTD_freeCDict(cdict_);
+    }
+}
+
+bool FrameCompressor::configure(const CompressionConfig& config)
+{
+    level_ = config.level;
+    threshold_ = config.threshold;
+    enabled_ = true;
+
+    if (config.dictionary_file.empty())
+    {
+        LOG_INFO("zstd 压缩已启用 (level=" << level_ << ", 阈值=" << threshold_
+                 << " 字节, 无字典)。");
+        return true;
+    }
+
+    std::ifstream in(config.dictionary_file, std::ios::binary);
+    if (!in.is_open())
+    {
+        LOG_WARNING("无法打开压缩字典 " << config.dictionary_file << "，将不使用字典压缩。");
+        return false;
+    }
+    std::string dict((std::istreambuf_iterator<char>(in)),
+                     std::istreambuf_iterator<char>());
+
+    cdict_ = ZSTD_createCDict(dict.data(), dict.size(), level_);
+    if (!cdict_)
+    {
+        LOG_WARNING("压缩字典 " << config.dictionary_file << " 无效，将不使用字典压缩。");
+        return false;
+    }
+    dictionary_id_ = ZSTD_getDictID_fromDict(dict.data(), dict.size());
+
+    LOG_INFO("zstd 压缩已启用 (level=" << level_ << ", 阈值=" << threshold_
+             << " 字节, 字典 ID=" << dictionary_id_ << ")。");
+    return true;
+}
+
+SharedFrame FrameCompressor::compress(std::string_view frame) const
+{
+    if (!enabled_ || frame.size() < threshold_)
+    {
+        return nullptr;
+    }
+
+    ZSTD_CCtx* cctx = thread_cctx();
+    if (!cctx)
+    {
+        return nullptr;
+    }
+
+    // COMPRESSED 帧: [u8 opcode] [varint 原始长度] [zstd frame]
+    std::string out = BinaryWriter(Opcode::Compressed, 12).varint(frame.size()).take();
+    size_t header = out.size();
+    out.resize(header + ZSTD_compressBound(frame.size()));
+
+    size_t written = cdict_
+                         ? ZSTD_compress_usingCDict(cctx, out.data() + header,
+                                                    out.size() - header, frame.data(),
+                                                    frame.size(), cdict_)
+                         : ZSTD_compressCCtx(cctx, out.data() + header,
+                                             out.size() - header, frame.data(),
+                                             frame.size(), level_);
+    if (ZSTD_isError(written))
+    {
+        LOG_ERROR("zstd 压缩失败: " << ZSTD_getErrorName(written));
+        return nullptr;
+    }
+
+    out.resize(header + written);
+    if (out.size() >= frame.size())
+    {
+        return nullptr;
+    }
+    return std::make_shared<const std::string>(std::move(out));
+}
+
+const SharedFrame& OutboundMessage::compressed_binary() const
+{
+    if (!compression_checked)
+    {
+        compression_checked = true;
+        if (binary)
+        {
+            compressed = FrameCompressor::getInstance().compress(*binary);
+        }
+    }
+    return compressed ? compressed : binary;
+}
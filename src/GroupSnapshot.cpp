@@ -0,0 +1,562 @@
+//
+// Created by X on 2025/11/20.
+//
+#include "../include/GroupSnapshot.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include "../include/Logger.h"
+#include "../include/json.hpp"
+
+namespace
+{
+    std::array<uint32_t, 256> make_crc_table()
+    {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+            {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        return table;
+    }
+
+    void put_u32(std::string& out, uint32_t v)
+    {
+        out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+
+    void put_str(std::string& out, const std::string& s)
+    {
+        put_u32(out, static_cast<uint32_t>(s.size()));
+        out += s;
+    }
+
+    void put_set(std::string& out, const std::unordered_set<std::string>& set)
+    {
+        put_u32(out, static_cast<uint32_t>(set.size()));
+        for (const auto& s : set)
+        {
+            put_str(out, s);
+        }
+    }
+
+    // 带边界检查的记录读取器，任何越界都视为记录损坏。
+    class RecordReader
+    {
+    public:
+        RecordReader(const uint8_t* data, size_t len) : p_(data), end_(data + len)
+        {
+        }
+
+        bool u32(uint32_t& v)
+        {
+            if (static_cast<size_t>(end_ - p_) < sizeof(v))
+            {
+                return false;
+            }
+            std::memcpy(&v, p_, sizeof(v));
+            p_ += sizeof(v);
+            return true;
+        }
+
+        bool view(std::string_view& out)
+        {
+            uint32_t len = 0;
+            if (!u32(len) || static_cast<size_t>(end_ - p_) < len)
+            {
+                return false;
+            }
+            out = std::string_view(reinterpret_cast<const char*>(p_), len);
+            p_ += len;
+            return true;
+        }
+
+        bool str(std::string& out)
+        {
+            std::string_view v;
+            if (!view(v))
+            {
+                return false;
+            }
+            out.assign(v.data(), v.size());
+            return true;
+        }
+
+        bool set(std::unordered_set<std::string>& out)
+        {
+            uint32_t n = 0;
+            if (!u32(n))
+            {
+                return false;
+            }
+            out.clear();
+            out.reserve(n);
+            for (uint32_t i = 0; i < n; ++i)
+            {
+                std::string s;
+                if (!str(s))
+                {
+                    return false;
+                }
+                out.insert(std::move(s));
+            }
+            return true;
+        }
+
+    private:
+        const uint8_t* p_;
+        const uint8_t* end_;
+    };
+}
+
+uint32_t GroupSnapshot::crc32(const void* data, size_t len, uint32_t crc)
+{
+    static const std::array<uint32_t, 256> table = make_crc_table();
+
+    const auto* p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < len; ++i)
+    {
+        crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+uint64_t GroupSnapshot::hash_name(std::string_view name)
+{
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : name)
+    {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+std::unique_ptr<GroupSnapshot> GroupSnapshot::open(const std::string& filename)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        LOG_INFO("未找到群组快照文件 (" << filename << ")。");
+        return nullptr;
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) == -1 ||
+        static_cast<size_t>(st.st_size) < sizeof(GroupSnapshotHeader))
+    {
+        LOG_ERROR("群组快照文件过小或无法读取: " << filename);
+        ::close(fd);
+        return nullptr;
+    }
+
+    size_t length = static_cast<size_t>(st.st_size);
+    void* addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (addr == MAP_FAILED)
+    {
+        LOG_ERROR("mmap 群组快照失败: " << filename);
+        return nullptr;
+    }
+
+    // 按需解码，访问模式基本是随机的。
+    madvise(addr, length, MADV_RANDOM);
+
+    std::unique_ptr<GroupSnapshot> snapshot(
+        new GroupSnapshot(static_cast<const uint8_t*>(addr), length));
+
+    GroupSnapshotHeader header{};
+    std::memcpy(&header, addr, sizeof(header));
+
+    uint32_t stored_header_crc = header.header_crc;
+    header.header_crc = 0;
+
+    if (std::memcmp(header.magic, GROUP_SNAPSHOT_MAGIC, sizeof(header.magic)) != 0)
+    {
+        LOG_ERROR("群组快照魔数不匹配: " << filename);
+        return nullptr;
+    }
+
+    if (header.version != GROUP_SNAPSHOT_VERSION ||
+        header.header_size != sizeof(GroupSnapshotHeader))
+    {
+        LOG_ERROR("不支持的群组快照版本: " << header.version);
+        return nullptr;
+    }
+
+    if (crc32(&header, sizeof(header)) != stored_header_crc ||
+        header.file_size != length)
+    {
+        LOG_ERROR("群组快照头校验失败 (文件可能被截断): " << filename);
+        return nullptr;
+    }
+
+    uint64_t index_bytes = header.group_count * sizeof(GroupSnapshotIndexEntry);
+    if (header.index_offset != sizeof(GroupSnapshotHeader) ||
+        header.group_count > length / sizeof(GroupSnapshotIndexEntry) ||
+        header.index_offset + index_bytes > header.data_offset ||
+        header.data_offset > length)
+    {
+        LOG_ERROR("群组快照索引越界: " << filename);
+        return nullptr;
+    }
+
+    const uint8_t* index_ptr = snapshot->base_ + header.index_offset;
+    if (crc32(index_ptr, index_bytes) != header.index_crc)
+    {
+        LOG_ERROR("群组快照索引校验失败: " << filename);
+        return nullptr;
+    }
+
+    snapshot->count_ = header.group_count;
+    snapshot->index_ = reinterpret_cast<const GroupSnapshotIndexEntry*>(index_ptr);
+
+    for (size_t i = 0; i < snapshot->count_; ++i)
+    {
+        const auto& e = snapshot->index_[i];
+        // 偏移和长度都来自文件，分开比较以免相加溢出绕过检查。
+        if (e.record_offset < header.data_offset || e.record_offset > length ||
+            e.record_size > length - e.record_offset)
+        {
+            LOG_ERROR("群组快照记录 #" << i << " 越界: " << filename);
+            return nullptr;
+        }
+    }
+
+    LOG_INFO("已映射群组快照 " << filename << "，共 " << snapshot->count_ << " 个群组。");
+    return snapshot;
+}
+
+GroupSnapshot::GroupSnapshot(const uint8_t* base, size_t length)
+    : base_(base), length_(length), count_(0), index_(nullptr)
+{
+}
+
+GroupSnapshot::~GroupSnapshot()
+{
+    if (base_)
+    {
+        munmap(const_cast<uint8_t*>(base_), length_);
+    }
+}
+
+const GroupSnapshotIndexEntry& GroupSnapshot::entry(size_t index) const
+{
+    return index_[index];
+}
+
+std::string_view GroupSnapshot::raw_record(size_t index) const
+{
+    const auto& e = entry(index);
+    return {reinterpret_cast<const char*>(base_ + e.record_offset), e.record_size};
+}
+
+std::string_view GroupSnapshot::name_at(size_t index) const
+{
+    std::string_view record = raw_record(index);
+    RecordReader reader(reinterpret_cast<const uint8_t*>(record.data()),
+                        record.size());
+    std::string_view name;
+    if (!reader.view(name))
+    {
+        return {};
+    }
+    return name;
+}
+
+bool GroupSnapshot::verify(size_t index) const
+{
+    if (index >= count_)
+    {
+        return false;
+    }
+    const auto& e = entry(index);
+    return crc32(base_ + e.record_offset, e.record_size) == e.record_crc;
+}
+
+bool GroupSnapshot::load_at(size_t index, Group& out) const
+{
+    if (index >= count_)
+    {
+        return false;
+    }
+
+    const auto& e = entry(index);
+    const uint8_t* record = base_ + e.record_offset;
+
+    if (!verify(index))
+    {
+        LOG_ERROR("群组快照记录 #" << index << " CRC 校验失败，已跳过。");
+        return false;
+    }
+
+    RecordReader reader(record, e.record_size);
+    if (!reader.str(out.name) || !reader.str(out.owner_nickname) ||
+        !reader.str(out.password_hash) || !reader.set(out.members) ||
+        !reader.set(out.banned_members))
+    {
+        LOG_ERROR("群组快照记录 #" << index << " 结构损坏，已跳过。");
+        return false;
+    }
+    return true;
+}
+
+bool GroupSnapshot::find(const std::string& name, Group& out) const
+{
+    uint64_t h = hash_name(name);
+
+    const GroupSnapshotIndexEntry* first = index_;
+    const GroupSnapshotIndexEntry* last = index_ + count_;
+    auto it = std::lower_bound(first, last, h,
+                               [](const GroupSnapshotIndexEntry& e, uint64_t v)
+                               {
+                                   return e.name_hash < v;
+                               });
+
+    for (; it != last && it->name_hash == h; ++it)
+    {
+        size_t i = static_cast<size_t>(it - first);
+        if (name_at(i) == name)
+        {
+            return load_at(i, out);
+        }
+    }
+    return false;
+}
+
+bool GroupSnapshot::load_all(std::vector<Group>& out, unsigned threads) const
+{
+    out.clear();
+    out.resize(count_);
+
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // 群组数量不多时开线程反而更慢。
+    constexpr size_t MIN_PER_THREAD = 1024;
+    threads = static_cast<unsigned>(
+        std::min<size_t>(threads, std::max<size_t>(1, count_ / MIN_PER_THREAD)));
+
+    std::vector<char> ok(count_, 0);
+    auto worker = [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            ok[i] = load_at(i, out[i]) ? 1 : 0;
+        }
+    };
+
+    if (threads <= 1)
+    {
+        worker(0, count_);
+    }
+    else
+    {
+        std::vector<std::thread> workers;
+        size_t chunk = (count_ + threads - 1) / threads;
+        for (size_t begin = 0; begin < count_; begin += chunk)
+        {
+            workers.emplace_back(worker, begin, std::min(count_, begin + chunk));
+        }
+        for (auto& t : workers)
+        {
+            t.join();
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < count_; ++i)
+    {
+        if (ok[i])
+        {
+            if (kept != i)
+            {
+                out[kept] = std::move(out[i]);
+            }
+            ++kept;
+        }
+    }
+    out.resize(kept);
+    return kept == count_;
+}
+
+std::string GroupSnapshotWriter::encode(const Group& group)
+{
+    std::string out;
+    put_str(out, group.name);
+    put_str(out, group.owner_nickname);
+    put_str(out, group.password_hash);
+    put_set(out, group.members);
+    put_set(out, group.banned_members);
+    return out;
+}
+
+void GroupSnapshotWriter::add(const Group& group)
+{
+    records_.push_back({GroupSnapshot::hash_name(group.name), encode(group)});
+}
+
+void GroupSnapshotWriter::add_raw(std::string_view name, std::string_view record)
+{
+    records_.push_back({GroupSnapshot::hash_name(name), std::string(record)});
+}
+
+bool GroupSnapshotWriter::commit(const std::string& filename)
+{
+    std::sort(records_.begin(), records_.end(),
+              [](const PendingRecord& a, const PendingRecord& b)
+              {
+                  return a.name_hash < b.name_hash;
+              });
+
+    GroupSnapshotHeader header{};
+    std::memcpy(header.magic, GROUP_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = GROUP_SNAPSHOT_VERSION;
+    header.header_size = sizeof(GroupSnapshotHeader);
+    header.group_count = records_.size();
+    header.index_offset = sizeof(GroupSnapshotHeader);
+    header.data_offset = header.index_offset +
+                         records_.size() * sizeof(GroupSnapshotIndexEntry);
+
+    std::vector<GroupSnapshotIndexEntry> index(records_.size());
+    uint64_t offset = header.data_offset;
+    for (size_t i = 0; i < records_.size(); ++i)
+    {
+        const std::string& bytes = records_[i].bytes;
+        index[i].name_hash = records_[i].name_hash;
+        index[i].record_offset = offset;
+        index[i].record_size = static_cast<uint32_t>(bytes.size());
+        index[i].record_crc = GroupSnapshot::crc32(bytes.data(), bytes.size());
+        offset += bytes.size();
+    }
+
+    header.file_size = offset;
+    header.index_crc = GroupSnapshot::crc32(
+        index.data(), index.size() * sizeof(GroupSnapshotIndexEntry));
+    header.header_crc = 0;
+    header.header_crc = GroupSnapshot::crc32(&header, sizeof(header));
+
+    const std::string tmp_filename = filename + ".tmp";
+    int fd = ::open(tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+    if (fd == -1)
+    {
+        LOG_ERROR("无法打开文件进行写入: " << tmp_filename);
+        return false;
+    }
+
+    auto write_all = [fd](const void* data, size_t len)
+    {
+        const char* p = static_cast<const char*>(data);
+        while (len > 0)
+        {
+            ssize_t n = ::write(fd, p, len);
+            if (n == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            p += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    };
+
+    bool ok = write_all(&header, sizeof(header)) &&
+              write_all(index.data(), index.size() * sizeof(GroupSnapshotIndexEntry));
+    for (size_t i = 0; ok && i < records_.size(); ++i)
+    {
+        ok = write_all(records_[i].bytes.data(), records_[i].bytes.size());
+    }
+
+    // 先确保数据落盘再重命名，崩溃后看到的要么是旧快照要么是完整的新快照。
+    if (!ok || ::fsync(fd) != 0)
+    {
+        LOG_ERROR("写入群组快照失败: " << tmp_filename << " (" << std::strerror(errno) << ")");
+        ::close(fd);
+        std::remove(tmp_filename.c_str());
+        return false;
+    }
+    ::close(fd);
+
+    if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0)
+    {
+        LOG_ERROR("群组快照重命名失败: " << tmp_filename << " -> " << filename);
+        std::remove(tmp_filename.c_str());
+        return false;
+    }
+
+    // 重命名本身也要持久化到所在目录。
+    std::string::size_type slash = filename.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." : filename.substr(0, slash);
+    int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd != -1)
+    {
+        ::fsync(dir_fd);
+        ::close(dir_fd);
+    }
+
+    LOG_INFO("群组快照成功保存到: " << filename << " (" << records_.size() << " 个群组)");
+    return true;
+}
+
+long convert_groups_json_to_snapshot(const std::string& json_filename,
+                                     const std::string& snapshot_filename)
+{
+    std::ifstream i(json_filename);
+    if (!i.is_open())
+    {
+        LOG_ERROR("无法打开群组 JSON 文件: " << json_filename);
+        return -1;
+    }
+
+    GroupSnapshotWriter writer;
+    try
+    {
+        nlohmann::json root_json;
+        i >> root_json;
+
+        for (const auto& item : root_json.at("groups").items())
+        {
+            Group group = item.value().get<Group>();
+            if (group.name.empty())
+            {
+                group.name = item.key();
+            }
+            writer.add(group);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        LOG_ERROR("转换群组数据失败，JSON 解析或数据结构错误: " << e.what());
+        return -1;
+    }
+
+    if (!writer.commit(snapshot_filename))
+    {
+        return -1;
+    }
+    return static_cast<long>(writer.size());
+}
@@ -0,0 +1,152 @@
+//
+// Created by X on 2025/12/06.
+//
+#include "../include/LuaAllocator.h"
+
+#include <cstdlib>
+#include <cstring>
+
+LuaArena::~LuaArena()
+{
+    for (char* slab : slabs_)
+    {
+        std::free(slab);
+    }
+}
+
+void* LuaArena::allocate(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+    auto* arena = static_cast<LuaArena*>(ud);
+
+    // ptr 为空时 osize 表示对象类型，不是块大小。
+    size_t old_size = ptr ? osize : 0;
+
+    if (nsize == 0)
+    {
+        if (ptr)
+        {
+            arena->free_block(ptr, old_size);
+        }
+        return nullptr;
+    }
+
+    if (ptr && old_size <= MAX_SMALL_SIZE && nsize <= MAX_SMALL_SIZE &&
+        class_of(old_size) == class_of(nsize))
+    {
+        return ptr;
+    }
+
+    // Lua 要求缩小永远成功，只有增长才受上限约束。
+    size_t old_charge = ptr ? charged_size(old_size) : 0;
+    size_t new_charge = charged_size(nsize);
+    if (new_charge > old_charge &&
+        arena->used_.load(std::memory_order_relaxed) + (new_charge - old_charge) > arena->limit_)
+    {
+        arena->failures_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    if (ptr && old_size > MAX_SMALL_SIZE && nsize > MAX_SMALL_SIZE)
+    {
+        void* grown = std::realloc(ptr, nsize);
+        if (!grown)
+        {
+            arena->failures_.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        arena->reserved_.fetch_add(nsize, std::memory_order_relaxed);
+        arena->reserved_.fetch_sub(old_size, std::memory_order_relaxed);
+        arena->used_.fetch_sub(old_size, std::memory_order_relaxed);
+        arena->charge(nsize);
+        return grown;
+    }
+
+    void* block = arena->allocate_block(nsize);
+    if (!block)
+    {
+        arena->failures_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    if (ptr)
+    {
+        std::memcpy(block, ptr, old_size < nsize ? old_size : nsize);
+        arena->free_block(ptr, old_size);
+    }
+    return block;
+}
+
+void* LuaArena::allocate_block(size_t size)
+{
+    void* block;
+    if (size <= MAX_SMALL_SIZE)
+    {
+        block = allocate_small(class_of(size));
+    }
+    else
+    {
+        block = std::malloc(size);
+        if (block)
+        {
+            reserved_.fetch_add(size, std::memory_order_relaxed);
+        }
+    }
+    if (block)
+    {
+        charge(charged_size(size));
+    }
+    return block;
+}
+
+void LuaArena::free_block(void* ptr, size_t size)
+{
+    used_.fetch_sub(charged_size(size), std::memory_order_relaxed);
+    if (size > MAX_SMALL_SIZE)
+    {
+        reserved_.fetch_sub(size, std::memory_order_relaxed);
+        std::free(ptr);
+        return;
+    }
+
+    size_t index = class_of(size);
+    auto* block = static_cast<FreeBlock*>(ptr);
+    block->next = free_lists_[index];
+    free_lists_[index] = block;
+}
+
+void* LuaArena::allocate_small(size_t index)
+{
+    if (FreeBlock* block = free_lists_[index])
+    {
+        free_lists_[index] = block->next;
+        return block;
+    }
+
+    size_t size = class_size(index);
+    if (bump_left_ < size)
+    {
+        // 旧块剩下的不足一个块的尾部直接放弃，最多浪费 MAX_SMALL_SIZE 字节。
+        auto* slab = static_cast<char*>(std::malloc(SLAB_SIZE));
+        if (!slab)
+        {
+            return nullptr;
+        }
+        slabs_.push_back(slab);
+        reserved_.fetch_add(SLAB_SIZE, std::memory_order_relaxed);
+        bump_ = slab;
+        bump_left_ = SLAB_SIZE;
+    }
+
+    void* block = bump_;
+    bump_ += size;
+    bump_left_ -= size;
+    return block;
+}
+
+void LuaArena::charge(size_t bytes)
+{
+    size_t now = used_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    size_t peak = peak_.load(std::memory_order_relaxed);
+    while (now > peak && !peak_.compare_exchange_weak(peak, now, std::memory_order_relaxed))
+    {
+    }
+}
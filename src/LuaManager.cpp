@@ -4,19 +4,83 @@
 #include "../include/LuaManager.h"
 #include "../include/ServerContext.h"
 #include "../include/Logger.h"
+#include "../include/BinaryProtocol.h"
+#include "../include/group_manager.h"
+#include "../include/Session.h"
+#include "../include/TimerWheel.h"
+#include "../include/UserManager.h"
+
+#include <openssl/evp.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
 
 LuaManager* global_lua_manager_instance = nullptr;
 
-static std::vector<std::string> split_message(const std::string& str)
+static constexpr const char* LUA_SCRIPT_PATH = "src/commands.lua";
+static constexpr const char* LUA_CHUNK_NAME = "@src/commands.lua";
+
+// 字节码缓存文件: 魔数 + SHA-256(Lua 版本 + 源码) + lua_dump 的输出。
+static constexpr char BYTECODE_MAGIC[8] = {'L', 'C', 'H', 'U', 'N', 'K', '0', '1'};
+static constexpr size_t BYTECODE_KEY_SIZE = 32;
+static constexpr size_t BYTECODE_HEADER_SIZE = sizeof(BYTECODE_MAGIC) + BYTECODE_KEY_SIZE;
+
+static bool read_file(const std::string& path, std::string& out)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    out.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !file.bad();
+}
+
+// 字节码格式随 Lua 版本变化，版本号和源码一起参与哈希。
+static std::string bytecode_key(const std::string& source)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    EVP_MD_CTX* md = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(md, EVP_sha256(), nullptr);
+    EVP_DigestUpdate(md, LUA_RELEASE, sizeof(LUA_RELEASE));
+    EVP_DigestUpdate(md, source.data(), source.size());
+    EVP_DigestFinal_ex(md, digest, &digest_len);
+    EVP_MD_CTX_free(md);
+    return std::string(reinterpret_cast<const char*>(digest), digest_len);
+}
+
+static int append_chunk(lua_State*, const void* data, size_t size, void* out)
+{
+    static_cast<std::string*>(out)->append(static_cast<const char*>(data), size);
+    return 0;
+}
+static constexpr std::string_view LUA_COMMAND_PREFIX = "lua_cmd_";
+// Chat.sleep 的上限，挂起的协程会一直占用状态的内存。
+static constexpr lua_Integer LUA_MAX_SLEEP_MS = 60'000;
+// Chat.after / Chat.every 的最长间隔 (一天)。
+static constexpr lua_Integer LUA_MAX_TIMER_MS = 86'400'000;
+static const std::string LUA_TIMER_AFTER = "timer:after";
+static const std::string LUA_TIMER_EVERY = "timer:every";
+static constexpr std::string_view WHITESPACE = " \t\n\r\f\v";
+
+// 从 pos 开始取下一个以空白分隔的词，没有更多词时返回空。
+static std::string_view next_token(std::string_view text, size_t& pos)
 {
-    std::vector<std::string> tokens;
-    std::stringstream ss(str);
-    std::string token;
-    while (ss >> token)
+    size_t begin = text.find_first_not_of(WHITESPACE, pos);
+    if (begin == std::string_view::npos)
     {
-        tokens.push_back(token);
+        pos = text.size();
+        return {};
     }
-    return tokens;
+    size_t end = std::min(text.find_first_of(WHITESPACE, begin), text.size());
+    pos = end;
+    return text.substr(begin, end - begin);
 }
 
 static int kick_user_to_lua(lua_State* L)
@@ -81,141 +145,1773 @@ LuaManager& LuaManager::getInstance()
 }
 
 
-LuaManager::LuaManager(ServerContext& ctx) : ctx_ref(ctx), L(nullptr)
+LuaManager::LuaManager(ServerContext& ctx) : ctx_ref(ctx)
 {
 }
 
 LuaManager::~LuaManager()
 {
-    if (L)
+    if (watch_fd != -1)
     {
-        lua_close(L);
+        close(watch_fd);
+    }
+    if (loop_fd != -1)
+    {
+        close(loop_fd);
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    for (const auto* list : {&states, &spare_states, &retiring_states})
+    {
+        for (const auto& worker : *list)
+        {
+            close_state(*worker);
+        }
+    }
+    if (timer_state)
+    {
+        close_state(*timer_state);
     }
 }
 
-bool LuaManager::initialize()
+void LuaManager::configure_budget(const LuaBudget& new_budget)
 {
-    std::lock_guard<std::mutex> lock(mtx);
+    budget = new_budget;
+    budget.hook_interval = std::max(budget.hook_interval, 1);
+}
 
-    L = luaL_newstate();
-    if (L == nullptr)
+void LuaManager::configure_bytecode_cache(std::string path)
+{
+    bytecode_cache_path = std::move(path);
+}
+
+bool LuaManager::initialize()
+{
+    std::string error;
+    std::shared_ptr<const std::string> chunk = compile_script(error);
+    if (!chunk)
     {
-        LOG_ERROR("Lua 状态机创建失败.");
+        LOG_ERROR("加载 commands.lua 失败: " + error);
         return false;
     }
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        current_chunk = chunk;
+    }
 
-    luaL_openlibs(L);
-
-    register_c_functions();
+    LuaWorker* worker = local_state();
+    if (worker == nullptr)
+    {
+        return false;
+    }
+    hook_mask.store(worker->hook_mask(), std::memory_order_release);
 
-    if (luaL_dofile(L, "src/commands.lua") != LUA_OK)
+    // 加载时注册的定时器放在单独的状态上，不占用事件循环线程的状态。
+    std::shared_ptr<LuaWorker> timers = create_state(worker->generation, *chunk, error, true);
+    if (!timers)
     {
-        const char* error = lua_tostring(L, -1);
-        LOG_ERROR("加载 commands.lua 失败: "+std::string(error));
-        lua_pop(L, 1);
+        LOG_ERROR("创建 Lua 定时器状态失败: " + error);
         return false;
     }
+    install_timer_state(std::move(timers));
 
     LOG_INFO("Lua 虚拟机初始化成功，并成功加载 commands.lua。");
     return true;
 }
 
+LuaManager::LuaWorker* LuaManager::local_state()
+{
+    // 线程退出时不关闭状态，统一由析构函数关闭。
+    thread_local LuaWorker* state = nullptr;
 
-int LuaManager::lua_broadcast_message(lua_State* L)
+    uint64_t generation = script_generation.load(std::memory_order_acquire);
+    if (state != nullptr && state->generation == generation)
+    {
+        return state;
+    }
+
+    std::shared_ptr<LuaWorker> worker = acquire_state(generation);
+    if (!worker)
+    {
+        // 新脚本加载失败时继续使用旧状态。
+        return state;
+    }
+
+    if (state != nullptr)
+    {
+        retire_state(state);
+    }
+    state = worker.get();
+    // 预建的状态此前没有人使用，这里认领后挂起的命令才会交回本线程。
+    state->owner.store(std::this_thread::get_id(), std::memory_order_release);
+    std::lock_guard<std::mutex> lock(mtx);
+    states.push_back(std::move(worker));
+    return state;
+}
+
+std::shared_ptr<LuaManager::LuaWorker> LuaManager::acquire_state(uint64_t generation)
 {
-    if (!global_lua_manager_instance)
     {
-        return 0;
+        std::lock_guard<std::mutex> lock(mtx);
+        while (!spare_states.empty())
+        {
+            std::shared_ptr<LuaWorker> worker = std::move(spare_states.back());
+            spare_states.pop_back();
+            if (worker->generation == generation)
+            {
+                return worker;
+            }
+            close_state(*worker);
+        }
     }
-    ServerContext& ctx = global_lua_manager_instance->ctx_ref;
 
-    int n = lua_gettop(L);
-    if (n < 2)
+    std::shared_ptr<const std::string> chunk;
     {
-        LOG_ERROR("lua broadcast 错误: 参数不足 (需要发送者昵称和消息).");
-        return 0;
+        std::lock_guard<std::mutex> lock(mtx);
+        chunk = current_chunk;
+        // 字节码和代数在同一把锁下更新，这里取到的是配套的一对。
+        generation = script_generation.load(std::memory_order_acquire);
+    }
+    if (!chunk)
+    {
+        return nullptr;
     }
 
-    const char* sender_nickname = lua_tostring(L, 1);
-    const char* message = lua_tostring(L, 2);
+    std::string error;
+    std::shared_ptr<LuaWorker> worker = create_state(generation, *chunk, error);
+    if (!worker)
+    {
+        LOG_ERROR("加载 commands.lua 失败: " + error);
+    }
+    return worker;
+}
 
-    if (sender_nickname && message)
+std::shared_ptr<const std::string> LuaManager::compile_script(std::string& error) const
+{
+    std::string source;
+    if (!read_file(LUA_SCRIPT_PATH, source))
     {
-        std::string full_msg = "[" + std::string(sender_nickname) + "(lua)]: " +
-                               std::string(message);
-        ctx.broadcast(full_msg, -1);
-        LOG_INFO("Lua 广播成功: "+full_msg);
+        error = std::string("无法读取 ") + LUA_SCRIPT_PATH;
+        return nullptr;
     }
-    return 1;
+
+    lua_State* L = luaL_newstate();
+    if (L == nullptr)
+    {
+        error = "Lua 状态机创建失败";
+        return nullptr;
+    }
+
+    std::string key = bytecode_key(source);
+    std::string cached;
+    if (!bytecode_cache_path.empty() && read_file(bytecode_cache_path, cached) &&
+        cached.size() > BYTECODE_HEADER_SIZE &&
+        std::memcmp(cached.data(), BYTECODE_MAGIC, sizeof(BYTECODE_MAGIC)) == 0 &&
+        cached.compare(sizeof(BYTECODE_MAGIC), BYTECODE_KEY_SIZE, key) == 0)
+    {
+        // 只载入不执行，确认缓存没有损坏 (Lua 还会检查字长、字节序等头部信息)。
+        cached.erase(0, BYTECODE_HEADER_SIZE);
+        if (luaL_loadbufferx(L, cached.data(), cached.size(), LUA_CHUNK_NAME, "b") == LUA_OK)
+        {
+            lua_close(L);
+            LOG_DEBUG("使用字节码缓存 " << bytecode_cache_path);
+            return std::make_shared<const std::string>(std::move(cached));
+        }
+        LOG_WARNING("字节码缓存 " << bytecode_cache_path << " 无效，重新编译。");
+        lua_pop(L, 1);
+    }
+
+    if (luaL_loadbufferx(L, source.data(), source.size(), LUA_CHUNK_NAME, "t") != LUA_OK)
+    {
+        const char* message = lua_tostring(L, -1);
+        error = message ? message : "未知错误";
+        lua_close(L);
+        return nullptr;
+    }
+
+    // 保留调试信息，脚本报错时仍有行号。
+    std::string chunk;
+    lua_dump(L, append_chunk, &chunk, 0);
+    lua_close(L);
+
+    if (!bytecode_cache_path.empty())
+    {
+        // 先写临时文件再改名，其他进程或重启不会读到写了一半的缓存。
+        std::string tmp_path = bytecode_cache_path + ".tmp";
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        out.write(BYTECODE_MAGIC, sizeof(BYTECODE_MAGIC));
+        out.write(key.data(), static_cast<std::streamsize>(key.size()));
+        out.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        out.close();
+        if (!out || std::rename(tmp_path.c_str(), bytecode_cache_path.c_str()) != 0)
+        {
+            LOG_WARNING("写入字节码缓存 " << bytecode_cache_path << " 失败。");
+            std::remove(tmp_path.c_str());
+        }
+    }
+
+    return std::make_shared<const std::string>(std::move(chunk));
 }
 
-void LuaManager::register_c_functions()
+void LuaManager::retire_state(LuaWorker* worker)
 {
-    lua_newtable(L);
+    std::shared_ptr<LuaWorker> retired;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = std::find_if(states.begin(), states.end(),
+                               [worker](const std::shared_ptr<LuaWorker>& w)
+                               {
+                                   return w.get() == worker;
+                               });
+        if (it == states.end())
+        {
+            return;
+        }
+        retired = std::move(*it);
+        states.erase(it);
+    }
+    retire(std::move(retired));
+}
 
-    lua_pushcfunction(L, lua_broadcast_message);
-    lua_setfield(L, -2, "broadcast");
+void LuaManager::retire(std::shared_ptr<LuaWorker> worker)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::lock_guard<std::mutex> lua_lock(worker->lua_mtx);
+        // 周期定时器随旧脚本停止，新脚本会注册自己的。一次性定时器 (如延时解禁) 照常到期。
+        std::vector<lua_Integer> periodic;
+        for (const auto& [handle, timer] : worker->timers)
+        {
+            if (timer.periodic)
+            {
+                periodic.push_back(handle);
+            }
+        }
+        for (lua_Integer handle : periodic)
+        {
+            unschedule_timer(handle);
+            release_timer(*worker, handle);
+        }
 
-    lua_pushcfunction(L, kick_user_to_lua);
-    lua_setfield(L, -2, "kick_user");
+        // 还有命令在等待异步操作或定时器未到期时不能关闭，交给最后一个结束的回调关闭。
+        if (!worker->idle())
+        {
+            worker->retired = true;
+            retiring_states.push_back(std::move(worker));
+            return;
+        }
+    }
+    close_state(*worker);
+}
 
-    lua_setglobal(L, "Chat");
+void LuaManager::install_timer_state(std::shared_ptr<LuaWorker> worker)
+{
+    {
+        // 启动后回调可能立即在其他线程上修改 timers，遍历期间持有状态的锁。
+        std::lock_guard<std::mutex> lock(worker->lua_mtx);
+        for (const auto& [handle, timer] : worker->timers)
+        {
+            // 加载时已按上限检查过数量。
+            schedule_timer(worker, handle, timer.interval, false);
+        }
+    }
+
+    std::shared_ptr<LuaWorker> previous;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        previous = std::move(timer_state);
+        timer_state = std::move(worker);
+    }
+    if (previous)
+    {
+        retire(std::move(previous));
+    }
 }
 
-bool LuaManager::execute_command(const std::string& nickname, bool is_admin,
-                                 const std::string& full_msg)
+void LuaManager::close_retired(LuaWorker* worker)
 {
-    std::vector<std::string> parts = split_message(full_msg);
-    if (parts.empty())
+    std::shared_ptr<LuaWorker> retired;
     {
-        return false;
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = std::find_if(retiring_states.begin(), retiring_states.end(),
+                               [worker](const std::shared_ptr<LuaWorker>& w)
+                               {
+                                   return w.get() == worker;
+                               });
+        if (it == retiring_states.end())
+        {
+            return;
+        }
+        retired = std::move(*it);
+        retiring_states.erase(it);
+    }
+    close_state(*retired);
+}
+
+void LuaManager::close_state(LuaWorker& worker)
+{
+    std::lock_guard<std::mutex> lock(worker.lua_mtx);
+    if (worker.L == nullptr)
+    {
+        return;
+    }
+    for (const auto& entry : worker.timers)
+    {
+        unschedule_timer(entry.first);
     }
+    // 注册表随状态一起释放，不必逐个 luaL_unref。
+    worker.timers.clear();
+    worker.suspended.clear();
+    lua_close(worker.L);
+    worker.L = nullptr;
+}
 
-    std::string command = parts[0];
+std::shared_ptr<LuaManager::LuaWorker> LuaManager::create_state(uint64_t generation,
+                                                                 const std::string& chunk,
+                                                                 std::string& error,
+                                                                 bool keep_timers)
+{
+    auto worker = std::make_shared<LuaWorker>();
+    worker->arena = std::make_unique<LuaArena>(budget.max_memory);
 
-    if (command.length() > 0 && command[0] == '/')
+    lua_State* L = lua_newstate(LuaArena::allocate, worker->arena.get());
+    if (L == nullptr)
     {
-        command = command.substr(1);
+        error = "Lua 状态机创建失败";
+        return nullptr;
     }
+    lua_atpanic(L, lua_panic);
 
-    std::string lua_func_name = "lua_cmd_" + command;
-    lua_getglobal(L, lua_func_name.c_str());
+    worker->L = L;
+    worker->generation = generation;
 
-    if (!lua_isfunction(L, -1))
+    // 钩子通过状态的额外空间找到所属的 LuaWorker；协程创建时会复制这块空间和钩子。
+    *static_cast<LuaWorker**>(lua_getextraspace(L)) = worker.get();
+    lua_sethook(L, budget_hook, LUA_MASKCOUNT, budget.hook_interval);
+
+    // 状态受内存上限约束，之后的每一步都在保护模式下执行，内存不足时加载失败而不是 abort。
+    lua_pushcfunction(L, open_state);
+    if (lua_pcall(L, 0, 0, 0) != LUA_OK)
     {
-        lua_pop(L, 1);
+        error = "Lua 标准库加载失败";
+        lua_close(L);
+        return nullptr;
+    }
+
+    worker->loading = true;
+    if (luaL_loadbufferx(L, chunk.data(), chunk.size(), LUA_CHUNK_NAME, "b") != LUA_OK)
+    {
+        const char* message = lua_tostring(L, -1);
+        error = message ? message : "未知错误";
+        lua_close(L);
+        return nullptr;
+    }
+    // 顶层代码也受预算限制，否则死循环的脚本会在持有 reload_mtx 时卡死线程。
+    // 超出时只算加载失败，不计入任何命令的停用次数。
+    begin_budget(*worker);
+    int status = lua_pcall(L, 0, 0, 0);
+    worker->budget_active = false;
+    if (status != LUA_OK)
+    {
+        const char* message = lua_tostring(L, -1);
+        error = worker->budget_exceeded ? "脚本顶层代码超出执行预算"
+                                        : message ? message : "未知错误";
+        lua_close(L);
+        return nullptr;
+    }
+    worker->loading = false;
+
+    lua_pushcfunction(L, cache_commands);
+    if (lua_pcall(L, 0, 0, 0) != LUA_OK)
+    {
+        error = "缓存命令函数失败: 内存不足";
+        lua_close(L);
+        return nullptr;
+    }
+
+    // 顶层代码注册的定时器只在定时器状态上启动 (见 install_timer_state)，其余状态丢弃。
+    if (!keep_timers)
+    {
+        for (const auto& entry : worker->timers)
+        {
+            luaL_unref(L, LUA_REGISTRYINDEX, entry.second.ref);
+        }
+        worker->timers.clear();
+    }
+    return worker;
+}
+
+bool LuaManager::reload(std::string& error)
+{
+    std::lock_guard<std::mutex> reload_lock(reload_mtx);
+
+    uint64_t next = script_generation.load(std::memory_order_relaxed) + 1;
+
+    std::shared_ptr<const std::string> chunk = compile_script(error);
+    if (!chunk)
+    {
+        LOG_ERROR("重新加载 commands.lua 失败，继续使用旧脚本: " + error);
         return false;
     }
 
-    lua_pushstring(L, nickname.c_str());
+    // 第一个状态用于校验脚本，成功后作为新代数的定时器状态。
+    std::shared_ptr<LuaWorker> timers = create_state(next, *chunk, error, true);
+    if (!timers)
+    {
+        LOG_ERROR("重新加载 commands.lua 失败，继续使用旧脚本: " + error);
+        return false;
+    }
 
-    lua_pushboolean(L, is_admin);
+    size_t live;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        live = states.size();
+    }
 
-    lua_newtable(L);
+    // 为每个已有线程预建一个状态，换新时不必在命令路径上加载。
+    std::vector<std::shared_ptr<LuaWorker>> prepared;
+    while (prepared.size() < live)
+    {
+        std::string ignored;
+        std::shared_ptr<LuaWorker> worker = create_state(next, *chunk, ignored);
+        if (!worker)
+        {
+            break;
+        }
+        prepared.push_back(std::move(worker));
+    }
+
+    size_t command_count = timers->commands.size();
+    uint32_t mask = timers->hook_mask();
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (const auto& worker : spare_states)
+        {
+            close_state(*worker);
+        }
+        spare_states = std::move(prepared);
+        current_chunk = std::move(chunk);
+        script_generation.store(next, std::memory_order_release);
+        hook_mask.store(mask, std::memory_order_release);
+    }
+    // 新代数发布后再启动新脚本的定时器，同时停止旧脚本的周期定时器。
+    install_timer_state(std::move(timers));
+
+    // 新脚本可能已经修复了被停用的命令。
+    {
+        std::unique_lock<std::shared_mutex> lock(budget_mtx);
+        budget_strikes.clear();
+        disabled_commands.clear();
+    }
+
+    LOG_INFO("commands.lua 已重新加载 (第 " << next << " 版，" << command_count << " 个命令)。");
+    return true;
+}
+
+int LuaManager::watch_script()
+{
+    std::string_view path = LUA_SCRIPT_PATH;
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string_view::npos ? "." : std::string(path.substr(0, slash));
+
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1)
+    {
+        LOG_WARNING("inotify_init1 失败，commands.lua 不会自动重新加载: " << strerror(errno));
+        return -1;
+    }
 
-    for (size_t i = 1; i < parts.size(); ++i)
+    // 监视目录而不是文件：编辑器和部署脚本通常写临时文件再改名覆盖，原文件的 inode 会变。
+    if (inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) == -1)
     {
-        lua_pushnumber(L, i);
-        lua_pushstring(L, parts[i].c_str());
-        lua_settable(L, -3);
+        LOG_WARNING("无法监视 " << dir << "，commands.lua 不会自动重新加载: " << strerror(errno));
+        close(fd);
+        return -1;
     }
 
-    if (lua_pcall(L, 3, 1, 0) != LUA_OK)
+    watch_fd = fd;
+    return fd;
+}
+
+void LuaManager::handle_watch_events()
+{
+    std::string_view path = LUA_SCRIPT_PATH;
+    size_t slash = path.rfind('/');
+    std::string_view file_name = slash == std::string_view::npos ? path : path.substr(slash + 1);
+
+    bool changed = false;
+    alignas(inotify_event) char buf[4096];
+    while (true)
     {
-        if (lua_isstring(L, -1))
+        ssize_t n = read(watch_fd, buf, sizeof(buf));
+        if (n <= 0)
         {
-            LOG_ERROR("Lua 命令执行失败: " +std::string(lua_tostring(L,-1)));
+            break;
+        }
+        for (char* p = buf; p < buf + n;)
+        {
+            auto* event = reinterpret_cast<inotify_event*>(p);
+            if (event->len > 0 && file_name == event->name)
+            {
+                changed = true;
+            }
+            p += sizeof(inotify_event) + event->len;
         }
-        lua_pop(L, 1);
-        return false;
     }
 
-    bool handled = false;
-    if (lua_isboolean(L, -1))
+    // 一次保存可能产生多个事件，合并为一次重新加载。
+    if (changed)
+    {
+        ctx_ref.pool.enqueue([this]()
+        {
+            std::string error;
+            reload(error);
+        });
+    }
+}
+
+int LuaManager::open_loop_queue()
+{
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd == -1)
+    {
+        LOG_WARNING("创建 Lua 任务 eventfd 失败，挂起的命令改在线程池中恢复: " << strerror(errno));
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(loop_mtx);
+    loop_fd = fd;
+    loop_thread = std::this_thread::get_id();
+    return fd;
+}
+
+void LuaManager::run_loop_tasks()
+{
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(loop_mtx);
+        uint64_t count;
+        ssize_t n = read(loop_fd, &count, sizeof(count));
+        (void)n;
+        tasks.swap(loop_tasks);
+    }
+    for (auto& task : tasks)
+    {
+        task();
+    }
+}
+
+void LuaManager::post_to_owner(const std::shared_ptr<LuaWorker>& worker,
+                               std::function<void()> task)
+{
+    std::thread::id owner = worker->owner.load(std::memory_order_acquire);
+    {
+        std::lock_guard<std::mutex> lock(loop_mtx);
+        if (loop_fd != -1 && owner == loop_thread)
+        {
+            // 队列非空时事件循环已经被唤醒过，不必重复写。
+            bool wake = loop_tasks.empty();
+            loop_tasks.push_back(std::move(task));
+            if (wake)
+            {
+                uint64_t one = 1;
+                ssize_t n = write(loop_fd, &one, sizeof(one));
+                (void)n;
+            }
+            return;
+        }
+    }
+
+    if (owner == std::thread::id())
+    {
+        bool schedule;
+        {
+            std::lock_guard<std::mutex> lock(worker->strand_mtx);
+            worker->strand.push_back(std::move(task));
+            schedule = !worker->strand_scheduled;
+            worker->strand_scheduled = true;
+        }
+        if (schedule)
+        {
+            ctx_ref.pool.enqueue([worker]()
+            {
+                drain_strand(worker);
+            });
+        }
+        return;
+    }
+    ctx_ref.pool.enqueue_to(owner, std::move(task));
+}
+
+void LuaManager::drain_strand(const std::shared_ptr<LuaWorker>& worker)
+{
+    while (true)
     {
-        handled = lua_toboolean(L, -1);
+        std::function<void()> task;
+        {
+            std::lock_guard<std::mutex> lock(worker->strand_mtx);
+            if (worker->strand.empty())
+            {
+                worker->strand_scheduled = false;
+                return;
+            }
+            task = std::move(worker->strand.front());
+            worker->strand.pop_front();
+        }
+        task();
     }
+}
+
+int LuaManager::open_state(lua_State* L)
+{
+    luaL_openlibs(L);
+    register_c_functions(L);
+    return 0;
+}
+
+int LuaManager::cache_commands(lua_State* L)
+{
+    LuaWorker& worker = *worker_of(L);
+
+    // luaL_unref 第一次释放引用时才在注册表里建空闲链表的表头，这一步会分配内存。
+    // 在这里先建好，之后在保护模式之外释放引用不会再分配。
+    lua_pushboolean(L, 1);
+    luaL_unref(L, LUA_REGISTRYINDEX, luaL_ref(L, LUA_REGISTRYINDEX));
 
+    lua_pushglobaltable(L);
+    lua_pushnil(L);
+    while (lua_next(L, -2) != 0)
+    {
+        // lua_next 之后键在 -2，值在 -1。键已确认是字符串，lua_tolstring 不会改写它。
+        if (lua_type(L, -2) == LUA_TSTRING && lua_isfunction(L, -1))
+        {
+            size_t len = 0;
+            const char* name = lua_tolstring(L, -2, &len);
+            std::string_view key(name, len);
+            if (key.size() > LUA_COMMAND_PREFIX.size() &&
+                key.substr(0, LUA_COMMAND_PREFIX.size()) == LUA_COMMAND_PREFIX)
+            {
+                lua_pushvalue(L, -1);
+                int ref = luaL_ref(L, LUA_REGISTRYINDEX);
+                worker.commands.emplace(std::string(key.substr(LUA_COMMAND_PREFIX.size())), ref);
+            }
+        }
+        lua_pop(L, 1);
+    }
     lua_pop(L, 1);
-    return handled;
-}
\ No newline at end of file
+    return 0;
+}
+
+// push_protected 的保护模式入口，第一个参数是要执行的 build。
+static int run_protected_build(lua_State* L)
+{
+    auto* build = static_cast<const std::function<int(lua_State*)>*>(lua_touserdata(L, 1));
+    lua_remove(L, 1);
+    return (*build)(L);
+}
+
+int LuaManager::push_protected(lua_State* L, const std::function<int(lua_State*)>& build,
+                               std::string& error)
+{
+    int top = lua_gettop(L);
+    lua_pushcfunction(L, run_protected_build);
+    lua_pushlightuserdata(L, const_cast<std::function<int(lua_State*)>*>(&build));
+    if (lua_pcall(L, 1, LUA_MULTRET, 0) != LUA_OK)
+    {
+        // 内存错误的错误对象是预先分配好的字符串，这里读取不会再分配。
+        const char* message = lua_type(L, -1) == LUA_TSTRING ? lua_tostring(L, -1) : nullptr;
+        error = message ? message : "未知错误";
+        lua_settop(L, top);
+        return -1;
+    }
+    return lua_gettop(L) - top;
+}
+
+lua_State* LuaManager::new_coroutine(lua_State* L, int function_ref,
+                                     const std::function<int(lua_State*)>& push_args,
+                                     int& ref, int& nargs, std::string& error)
+{
+    nargs = 0;
+    int pushed = push_protected(L, [&](lua_State* S)
+    {
+        lua_rawgeti(S, LUA_REGISTRYINDEX, function_ref);
+        nargs = push_args ? push_args(S) : 0;
+        lua_newthread(S);
+        // 最后一步才存入注册表，前面任何一步失败都不会留下引用。
+        lua_pushvalue(S, -1);
+        ref = luaL_ref(S, LUA_REGISTRYINDEX);
+        return nargs + 2;
+    }, error);
+    if (pushed < 0)
+    {
+        return nullptr;
+    }
+
+    // 新协程的栈至少有 LUA_MINSTACK 个空位，移动函数和参数不需要分配。
+    lua_State* co = lua_tothread(L, -1);
+    lua_pop(L, 1);
+    lua_xmove(L, co, nargs + 1);
+    return co;
+}
+
+
+int LuaManager::lua_broadcast_message(lua_State* L)
+{
+    if (!global_lua_manager_instance)
+    {
+        return 0;
+    }
+    ServerContext& ctx = global_lua_manager_instance->ctx_ref;
+
+    int n = lua_gettop(L);
+    if (n < 2)
+    {
+        LOG_ERROR("lua broadcast 错误: 参数不足 (需要发送者昵称和消息).");
+        return 0;
+    }
+
+    size_t sender_len = 0;
+    size_t message_len = 0;
+    const char* sender_nickname = lua_tolstring(L, 1, &sender_len);
+    const char* message = lua_tolstring(L, 2, &message_len);
+
+    if (sender_nickname && message)
+    {
+        std::string full_msg;
+        full_msg.reserve(sender_len + message_len + 10);
+        full_msg.append("[").append(sender_nickname, sender_len).append("(lua)]: ")
+                .append(message, message_len);
+        // 两种编码各生成一次，所有接收方共享。
+        ctx.broadcast(make_notice_message(full_msg), -1);
+        LOG_INFO("Lua 广播成功: "+full_msg);
+    }
+    return 0;
+}
+
+LuaManager::LuaWorker* LuaManager::worker_of(lua_State* L)
+{
+    return *static_cast<LuaWorker**>(lua_getextraspace(L));
+}
+
+// 只有在保护模式之外出错时才会调用，返回后 Lua 会 abort。
+int LuaManager::lua_panic(lua_State* L)
+{
+    const char* message = lua_tostring(L, -1);
+    LOG_FATAL("Lua 在保护模式之外出错: " << (message ? message : "未知错误"));
+    return 0;
+}
+
+// Chat.send_to(昵称, 消息)：只发给一个用户，用户不在线时返回 false。
+int LuaManager::lua_send_to(lua_State* L)
+{
+    size_t nickname_len = 0;
+    size_t text_len = 0;
+    const char* nickname = luaL_checklstring(L, 1, &nickname_len);
+    const char* text = luaL_checklstring(L, 2, &text_len);
+
+    ServerContext& ctx = global_lua_manager_instance->ctx_ref;
+    int fd = ctx.get_fd_by_nickname(std::string(nickname, nickname_len));
+    if (fd != -1)
+    {
+        send_outbound(fd, make_notice_message(std::string_view(text, text_len)));
+    }
+    lua_pushboolean(L, fd != -1);
+    return 1;
+}
+
+// Chat.send_group(群名, 消息)：以 Server 的名义发给群内在线成员，群不存在时返回 false。
+int LuaManager::lua_send_group(lua_State* L)
+{
+    size_t group_len = 0;
+    size_t text_len = 0;
+    const char* group = luaL_checklstring(L, 1, &group_len);
+    const char* text = luaL_checklstring(L, 2, &text_len);
+
+    ServerContext& ctx = global_lua_manager_instance->ctx_ref;
+    std::string group_name(group, group_len);
+    OutboundMessage msg = make_group_message(group_name, "Server",
+                                             std::string_view(text, text_len));
+    ProtocolError err = ctx.group_manager->deliver_to_group(group_name, msg);
+    lua_pushboolean(L, err == ProtocolError::None);
+    return 1;
+}
+
+// Chat.reply(消息)：回复发起当前命令的连接，带 ID 的请求会带上相同的 ID。
+int LuaManager::lua_reply(lua_State* L)
+{
+    size_t text_len = 0;
+    const char* text = luaL_checklstring(L, 1, &text_len);
+
+    LuaWorker* worker = worker_of(L);
+    if (worker == nullptr || worker->caller_fd == -1 ||
+        SessionTable::getInstance().get(worker->caller_fd).connection_id !=
+        worker->caller_connection_id)
+    {
+        // 协程挂起期间发起命令的连接可能已经关闭，fd 被新连接复用。
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+    send_message_with_length(worker->caller_fd, std::string_view(text, text_len));
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+// Chat.on_message(fn) / on_join(fn) / on_group_send(fn)，事件类型保存在上值中。
+// 钩子只在加载脚本时注册，每个状态各自保存一份。
+int LuaManager::lua_register_hook(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    auto type = static_cast<size_t>(lua_tointeger(L, lua_upvalueindex(1)));
+
+    LuaWorker* worker = worker_of(L);
+    if (worker == nullptr || type >= PIPELINE_EVENT_TYPES)
+    {
+        return 0;
+    }
+    if (!worker->loading)
+    {
+        // 运行时注册只会落到当前线程的状态上，hook_mask 也不会更新，每次调用还会多占一个引用。
+        return luaL_error(L, "钩子只能在脚本加载时注册");
+    }
+    lua_pushvalue(L, 1);
+    worker->hooks[type].push_back(luaL_ref(L, LUA_REGISTRYINDEX));
+    return 0;
+}
+
+// Chat.is_online(昵称)
+int LuaManager::lua_is_online(lua_State* L)
+{
+    size_t nickname_len = 0;
+    const char* nickname = luaL_checklstring(L, 1, &nickname_len);
+
+    ServerContext& ctx = global_lua_manager_instance->ctx_ref;
+    lua_pushboolean(L, ctx.get_fd_by_nickname(std::string(nickname, nickname_len)) != -1);
+    return 1;
+}
+
+int LuaManager::lua_shared_get(lua_State* L)
+{
+    const char* key = luaL_checkstring(L, 1);
+    LuaManager* manager = global_lua_manager_instance;
+
+    std::shared_lock<std::shared_mutex> lock(manager->shared_mtx);
+    auto it = manager->shared_values.find(key);
+    if (it == manager->shared_values.end())
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    const LuaSharedValue& value = it->second;
+    switch (value.type)
+    {
+    case LUA_TBOOLEAN:
+        lua_pushboolean(L, value.boolean);
+        break;
+    case LUA_TNUMBER:
+        if (value.is_integer)
+        {
+            lua_pushinteger(L, value.integer);
+        }
+        else
+        {
+            lua_pushnumber(L, value.number);
+        }
+        break;
+    default:
+        lua_pushlstring(L, value.text.data(), value.text.size());
+        break;
+    }
+    return 1;
+}
+
+int LuaManager::lua_shared_set(lua_State* L)
+{
+    const char* key = luaL_checkstring(L, 1);
+    int type = lua_type(L, 2);
+    if (type != LUA_TNIL && type != LUA_TNONE && type != LUA_TBOOLEAN &&
+        type != LUA_TNUMBER && type != LUA_TSTRING)
+    {
+        // 表、函数等 Lua 对象属于某个状态，不能跨状态共享。
+        return luaL_argerror(L, 2, "只能共享布尔、数字或字符串");
+    }
+
+    LuaSharedValue value;
+    value.type = type == LUA_TNONE ? LUA_TNIL : type;
+    switch (value.type)
+    {
+    case LUA_TBOOLEAN:
+        value.boolean = lua_toboolean(L, 2);
+        break;
+    case LUA_TNUMBER:
+        value.is_integer = lua_isinteger(L, 2);
+        if (value.is_integer)
+        {
+            value.integer = lua_tointeger(L, 2);
+        }
+        else
+        {
+            value.number = lua_tonumber(L, 2);
+        }
+        break;
+    case LUA_TSTRING:
+    {
+        size_t len = 0;
+        const char* text = lua_tolstring(L, 2, &len);
+        value.text.assign(text, len);
+        break;
+    }
+    default:
+        break;
+    }
+
+    LuaManager* manager = global_lua_manager_instance;
+    std::unique_lock<std::shared_mutex> lock(manager->shared_mtx);
+    if (value.type == LUA_TNIL)
+    {
+        manager->shared_values.erase(key);
+    }
+    else
+    {
+        manager->shared_values[key] = std::move(value);
+    }
+    return 0;
+}
+
+// Chat.shared_incr(key [, delta]) 原子地累加整数并返回新值，
+// 多个状态同时 shared_get + shared_set 会丢失更新。
+int LuaManager::lua_shared_incr(lua_State* L)
+{
+    const char* key = luaL_checkstring(L, 1);
+    lua_Integer delta = luaL_optinteger(L, 2, 1);
+
+    LuaManager* manager = global_lua_manager_instance;
+    lua_Integer result;
+    {
+        std::unique_lock<std::shared_mutex> lock(manager->shared_mtx);
+        LuaSharedValue& value = manager->shared_values[key];
+        if (value.type != LUA_TNUMBER || !value.is_integer)
+        {
+            value = LuaSharedValue{};
+            value.type = LUA_TNUMBER;
+            value.is_integer = true;
+        }
+        value.integer += delta;
+        result = value.integer;
+    }
+
+    lua_pushinteger(L, result);
+    return 1;
+}
+
+LuaManager::LuaWorker* LuaManager::yieldable_worker(lua_State* L, const char* function,
+                                                    uint64_t& wait_id)
+{
+    LuaWorker* worker = worker_of(L);
+    if (worker == nullptr || worker->running != L)
+    {
+        // 钩子不在协程中执行；脚本自己创建的协程让出后不会被服务器恢复。
+        luaL_error(L, "%s 只能在命令中直接调用", function);
+    }
+    if (!lua_isyieldable(L))
+    {
+        // 隔着 C 调用边界 (table.sort 的比较函数、gsub 的替换函数等) 无法让出，
+        // 必须在发起异步操作之前报错，否则完成回调会恢复一个并不在等待的协程。
+        luaL_error(L, "%s 不能在此处调用 (无法让出)", function);
+    }
+    wait_id = ++worker->next_wait_id;
+    worker->pending_wait = wait_id;
+    return worker;
+}
+
+// Chat.sleep(毫秒)：挂起当前命令，到时由定时器恢复，等待期间不占用线程。
+int LuaManager::lua_sleep(lua_State* L)
+{
+    lua_Integer ms = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, ms >= 0 && ms <= LUA_MAX_SLEEP_MS, 1, "超出范围 (0 ~ 60000 毫秒)");
+    uint64_t wait_id = 0;
+    LuaWorker* worker = yieldable_worker(L, "Chat.sleep", wait_id);
+
+    LuaManager* manager = global_lua_manager_instance;
+    std::shared_ptr<LuaWorker> owner = worker->shared_from_this();
+    TimerWheel::getInstance().schedule(std::chrono::milliseconds(ms),
+                                       [manager, owner, L, wait_id]()
+    {
+        // 不在这里直接恢复：状态可能属于其他线程，交回所属线程执行。
+        manager->post_to_owner(owner, [manager, owner, L, wait_id]()
+        {
+            manager->resume_suspended(owner, L, wait_id, [](lua_State*) { return 0; });
+        });
+    });
+
+    return lua_yield(L, 0);
+}
+
+// Chat.db_get_user(用户名)：在线程池中查询数据库，返回 {username = ..., is_admin = ...}，
+// 用户不存在时返回 nil。查询期间命令挂起。
+int LuaManager::lua_db_get_user(lua_State* L)
+{
+    size_t name_len = 0;
+    const char* name = luaL_checklstring(L, 1, &name_len);
+    uint64_t wait_id = 0;
+    LuaWorker* worker = yieldable_worker(L, "Chat.db_get_user", wait_id);
+
+    LuaManager* manager = global_lua_manager_instance;
+    std::string username_lower = UserManager::to_lower_nickname(std::string(name, name_len));
+    std::shared_ptr<LuaWorker> owner = worker->shared_from_this();
+    manager->ctx_ref.pool.enqueue([manager, owner, L, wait_id, username_lower]()
+    {
+        std::string username_raw;
+        std::string password_hash;
+        bool is_admin = false;
+        bool found = manager->ctx_ref.db_manager.get_user_data(username_lower, username_raw,
+                                                               password_hash, is_admin);
+        // 查询在任意工作线程上进行，结果交回状态的所属线程恢复命令。密码哈希不交给脚本。
+        manager->post_to_owner(owner, [manager, owner, L, wait_id, found, username_raw, is_admin]()
+        {
+            manager->resume_suspended(owner, L, wait_id, [&](lua_State* S)
+            {
+                if (!found)
+                {
+                    lua_pushnil(S);
+                    return 1;
+                }
+                lua_createtable(S, 0, 2);
+                lua_pushlstring(S, username_raw.data(), username_raw.size());
+                lua_setfield(S, -2, "username");
+                lua_pushboolean(S, is_admin);
+                lua_setfield(S, -2, "is_admin");
+                return 1;
+            });
+        });
+    });
+
+    return lua_yield(L, 0);
+}
+
+// Chat.after(毫秒, fn) / Chat.every(毫秒, fn)，是否周期执行保存在上值中。返回句柄，
+// 定时器数量已达上限时返回 nil 和原因。回调以协程执行，也可以调用 Chat.sleep 等。
+int LuaManager::lua_add_timer(lua_State* L)
+{
+    bool periodic = lua_toboolean(L, lua_upvalueindex(1));
+    lua_Integer ms = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, ms >= 0 && ms <= LUA_MAX_TIMER_MS, 1, "超出范围 (0 ~ 86400000 毫秒)");
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    LuaWorker* worker = worker_of(L);
+    LuaManager* manager = global_lua_manager_instance;
+    if (worker == nullptr)
+    {
+        return 0;
+    }
+
+    // 间隔过短的周期定时器按时间轮的一拍执行。
+    std::chrono::milliseconds interval(ms);
+    if (periodic)
+    {
+        interval = std::max(interval, TimerWheel::TICK);
+    }
+
+    lua_Integer handle;
+    if (worker->loading)
+    {
+        // 各状态执行相同的顶层代码，算出的句柄和是否超限都一致。
+        if (worker->load_timers >= manager->budget.max_timers)
+        {
+            lua_pushnil(L);
+            lua_pushstring(L, "定时器数量已达上限");
+            return 2;
+        }
+        handle = static_cast<lua_Integer>((worker->generation << 32) | ++worker->load_timers);
+    }
+    else
+    {
+        handle = manager->next_timer_handle.fetch_add(1, std::memory_order_relaxed);
+        if (!manager->schedule_timer(worker->shared_from_this(), handle, interval, true))
+        {
+            lua_pushnil(L);
+            lua_pushstring(L, "定时器数量已达上限");
+            return 2;
+        }
+    }
+
+    // 回调最早在下一拍、且要等本状态的锁，此时登记不会错过。
+    lua_pushvalue(L, 2);
+    worker->timers[handle] = LuaTimer{luaL_ref(L, LUA_REGISTRYINDEX), interval, periodic};
+    lua_pushinteger(L, handle);
+    return 1;
+}
+
+// Chat.cancel(句柄)：定时器已执行 (一次性) 或已取消时返回 false。
+int LuaManager::lua_cancel_timer(lua_State* L)
+{
+    lua_Integer handle = luaL_checkinteger(L, 1);
+    LuaWorker* worker = worker_of(L);
+    LuaManager* manager = global_lua_manager_instance;
+    if (worker == nullptr)
+    {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+
+    if (worker->loading)
+    {
+        // 顶层代码注册的定时器还未启动。
+        auto it = worker->timers.find(handle);
+        bool found = it != worker->timers.end();
+        if (found)
+        {
+            release_timer(*worker, handle);
+        }
+        lua_pushboolean(L, found);
+        return 1;
+    }
+
+    lua_pushboolean(L, manager->cancel_timer(worker, handle));
+    return 1;
+}
+
+void LuaManager::register_c_functions(lua_State* L)
+{
+    lua_newtable(L);
+
+    lua_pushcfunction(L, lua_broadcast_message);
+    lua_setfield(L, -2, "broadcast");
+
+    lua_pushcfunction(L, kick_user_to_lua);
+    lua_setfield(L, -2, "kick_user");
+
+    lua_pushcfunction(L, lua_send_to);
+    lua_setfield(L, -2, "send_to");
+
+    lua_pushcfunction(L, lua_send_group);
+    lua_setfield(L, -2, "send_group");
+
+    lua_pushcfunction(L, lua_reply);
+    lua_setfield(L, -2, "reply");
+
+    lua_pushcfunction(L, lua_is_online);
+    lua_setfield(L, -2, "is_online");
+
+    static constexpr std::pair<const char*, PipelineEventType> hook_names[] = {
+        {"on_message", PipelineEventType::Message},
+        {"on_join", PipelineEventType::Join},
+        {"on_group_send", PipelineEventType::GroupSend},
+    };
+    for (const auto& [name, type] : hook_names)
+    {
+        lua_pushinteger(L, static_cast<lua_Integer>(type));
+        lua_pushcclosure(L, lua_register_hook, 1);
+        lua_setfield(L, -2, name);
+    }
+
+    lua_pushcfunction(L, lua_shared_get);
+    lua_setfield(L, -2, "shared_get");
+
+    lua_pushcfunction(L, lua_shared_set);
+    lua_setfield(L, -2, "shared_set");
+
+    lua_pushcfunction(L, lua_shared_incr);
+    lua_setfield(L, -2, "shared_incr");
+
+    lua_pushcfunction(L, lua_sleep);
+    lua_setfield(L, -2, "sleep");
+
+    lua_pushcfunction(L, lua_db_get_user);
+    lua_setfield(L, -2, "db_get_user");
+
+    lua_pushboolean(L, 0);
+    lua_pushcclosure(L, lua_add_timer, 1);
+    lua_setfield(L, -2, "after");
+
+    lua_pushboolean(L, 1);
+    lua_pushcclosure(L, lua_add_timer, 1);
+    lua_setfield(L, -2, "every");
+
+    lua_pushcfunction(L, lua_cancel_timer);
+    lua_setfield(L, -2, "cancel");
+
+    lua_setglobal(L, "Chat");
+}
+
+void LuaManager::budget_hook(lua_State* L, lua_Debug* ar)
+{
+    LuaWorker* worker = worker_of(L);
+    if (worker == nullptr || !worker->budget_active)
+    {
+        return;
+    }
+
+    const LuaBudget& limits = global_lua_manager_instance->budget;
+    if (!worker->budget_exceeded)
+    {
+        worker->instructions += static_cast<uint64_t>(limits.hook_interval);
+        if (worker->instructions <= limits.max_instructions &&
+            std::chrono::steady_clock::now() <= worker->deadline)
+        {
+            return;
+        }
+        worker->budget_exceeded = true;
+        // 之后每条指令都报错，脚本用 pcall 捕获后也无法继续执行。
+        lua_sethook(L, budget_hook, LUA_MASKCOUNT, 1);
+    }
+    luaL_error(L, "命令超出执行预算，已中止");
+}
+
+void LuaManager::begin_budget(LuaWorker& worker)
+{
+    worker.instructions = 0;
+    worker.budget_exceeded = false;
+    worker.deadline = std::chrono::steady_clock::now() + budget.max_time;
+    worker.budget_active = true;
+}
+
+void LuaManager::end_budget(LuaWorker& worker, lua_State* L, const std::string& name)
+{
+    worker.budget_active = false;
+    if (worker.budget_exceeded)
+    {
+        lua_sethook(L, budget_hook, LUA_MASKCOUNT, budget.hook_interval);
+        record_budget_abort(name);
+    }
+}
+
+int LuaManager::call_with_budget(LuaWorker& worker, int nargs, int nresults,
+                                 const std::string& name)
+{
+    begin_budget(worker);
+    int status = lua_pcall(worker.L, nargs, nresults, 0);
+    end_budget(worker, worker.L, name);
+    return status;
+}
+
+int LuaManager::resume_with_budget(LuaWorker& worker, lua_State* co, int nargs,
+                                   const std::string& name)
+{
+    begin_budget(worker);
+    int status = lua_resume(co, worker.L, nargs);
+    end_budget(worker, co, name);
+    return status;
+}
+
+LuaMemoryStats LuaManager::memory_stats()
+{
+    LuaMemoryStats stats;
+    stats.limit = budget.max_memory;
+
+    std::lock_guard<std::mutex> lock(mtx);
+    for (const auto* list : {&states, &spare_states, &retiring_states})
+    {
+        for (const auto& worker : *list)
+        {
+            const LuaArena& arena = *worker->arena;
+            ++stats.states;
+            stats.used += arena.used();
+            stats.reserved += arena.reserved();
+            stats.peak = std::max(stats.peak, arena.peak());
+            stats.failures += arena.failures();
+        }
+    }
+    if (timer_state)
+    {
+        const LuaArena& arena = *timer_state->arena;
+        ++stats.states;
+        stats.used += arena.used();
+        stats.reserved += arena.reserved();
+        stats.peak = std::max(stats.peak, arena.peak());
+        stats.failures += arena.failures();
+    }
+    return stats;
+}
+
+bool LuaManager::is_disabled(const std::string& command)
+{
+    std::shared_lock<std::shared_mutex> lock(budget_mtx);
+    return !disabled_commands.empty() && disabled_commands.count(command) != 0;
+}
+
+void LuaManager::record_budget_abort(const std::string& command)
+{
+    budget_abort_count.fetch_add(1, std::memory_order_relaxed);
+
+    std::unique_lock<std::shared_mutex> lock(budget_mtx);
+    int strikes = ++budget_strikes[command];
+    // 钩子和定时器的名字带 ':'，命令名是 Lua 标识符，不会包含。
+    std::string label = command.find(':') == std::string::npos ? "命令 /" + command : command;
+    if (budget.max_strikes > 0 && strikes >= budget.max_strikes &&
+        disabled_commands.insert(command).second)
+    {
+        LOG_ERROR("Lua " << label << " 已 " << strikes
+                  << " 次超出执行预算，自动停用，修复后使用 /reloadlua 恢复。");
+        return;
+    }
+    LOG_WARNING("Lua " << label << " 超出执行预算被中止 (第 " << strikes << " 次)。");
+}
+
+bool LuaManager::execute_command(int fd, const std::string& nickname, bool is_admin,
+                                 std::string_view full_msg)
+{
+    size_t pos = 0;
+    std::string_view command = next_token(full_msg, pos);
+    if (!command.empty() && command[0] == '/')
+    {
+        command.remove_prefix(1);
+    }
+
+    // 每个线程使用自己的 lua_State，带 ID 的请求可以在多个工作线程上并行执行。
+    LuaWorker* worker = local_state();
+    if (worker == nullptr)
+    {
+        return false;
+    }
+
+    std::string name(command);
+    std::lock_guard<std::mutex> lock(worker->lua_mtx);
+    auto it = worker->commands.find(name);
+    if (it == worker->commands.end() || is_disabled(name))
+    {
+        return false;
+    }
+
+    // 先数出参数个数，参数表一次分配到位。
+    const size_t args_begin = pos;
+    int arg_count = 0;
+    while (!next_token(full_msg, pos).empty())
+    {
+        ++arg_count;
+    }
+
+    // 命令在新协程中执行，协程对象在结束前一直保存在注册表中。
+    LuaCommandCall call;
+    int nargs = 0;
+    std::string error;
+    lua_State* co = new_coroutine(worker->L, it->second, [&](lua_State* L)
+    {
+        lua_pushlstring(L, nickname.data(), nickname.size());
+
+        lua_pushboolean(L, is_admin);
+
+        lua_createtable(L, arg_count, 0);
+        pos = args_begin;
+        for (int i = 1; i <= arg_count; ++i)
+        {
+            std::string_view arg = next_token(full_msg, pos);
+            lua_pushlstring(L, arg.data(), arg.size());
+            lua_rawseti(L, -2, i);
+        }
+        return 3;
+    }, call.ref, nargs, error);
+    if (co == nullptr)
+    {
+        // 状态内存已达上限，按命令执行失败处理。
+        LOG_ERROR("Lua 命令 /" << name << " 无法启动: " << error);
+        return false;
+    }
+    call.fd = fd;
+    call.connection_id = SessionTable::getInstance().get(fd).connection_id;
+    call.tag = current_request();
+    call.command = std::move(name);
+
+    return resume_command(*worker, co, nargs, std::move(call));
+}
+
+bool LuaManager::resume_command(LuaWorker& worker, lua_State* co, int nargs,
+                                LuaCommandCall call)
+{
+    worker.caller_fd = call.fd;
+    worker.caller_connection_id = call.connection_id;
+    worker.running = co;
+    worker.pending_wait = 0;
+    int status;
+    {
+        // 在其他线程上恢复时，回复仍带上原请求的 ID。
+        RequestScope scope(call.tag);
+        status = resume_with_budget(worker, co, nargs, call.command);
+    }
+    worker.running = nullptr;
+    worker.caller_fd = -1;
+
+    if (status == LUA_YIELD)
+    {
+        if (worker.pending_wait != 0)
+        {
+            call.wait_id = worker.pending_wait;
+            worker.pending_wait = 0;
+            worker.suspended.emplace(co, std::move(call));
+            return true;
+        }
+        // 脚本直接调用 coroutine.yield 让出，没有任何操作会恢复它。
+        LOG_ERROR("Lua 命令 /" << call.command << " 调用了 coroutine.yield，已中止。");
+        luaL_unref(worker.L, LUA_REGISTRYINDEX, call.ref);
+        return false;
+    }
+
+    bool handled = false;
+    if (status == LUA_OK)
+    {
+        handled = lua_gettop(co) > 0 && lua_isboolean(co, 1) && lua_toboolean(co, 1);
+    }
+    else if (lua_type(co, -1) == LUA_TSTRING && !worker.budget_exceeded)
+    {
+        LOG_ERROR("Lua 命令执行失败: " +std::string(lua_tostring(co,-1)));
+    }
+
+    // 协程已经结束，释放引用后随下次 GC 回收。
+    lua_settop(co, 0);
+    luaL_unref(worker.L, LUA_REGISTRYINDEX, call.ref);
+    return handled;
+}
+
+void LuaManager::resume_suspended(const std::shared_ptr<LuaWorker>& worker, lua_State* co,
+                                  uint64_t wait_id,
+                                  const std::function<int(lua_State*)>& push_results)
+{
+    bool finished;
+    {
+        std::lock_guard<std::mutex> lock(worker->lua_mtx);
+        // 状态已关闭时 suspended 也已清空。
+        auto it = worker->suspended.find(co);
+        if (it == worker->suspended.end() || it->second.wait_id != wait_id)
+        {
+            return;
+        }
+        LuaCommandCall call = std::move(it->second);
+        worker->suspended.erase(it);
+
+        // 结果先在主线程上保护模式构造，再移到协程栈上。
+        std::string error;
+        int nargs = push_protected(worker->L, push_results, error);
+        if (nargs >= 0 && !lua_checkstack(co, nargs))
+        {
+            lua_pop(worker->L, nargs);
+            nargs = -1;
+            error = "协程栈空间不足";
+        }
+        if (nargs < 0)
+        {
+            LOG_ERROR("Lua 命令 /" << call.command << " 无法恢复，已中止: " << error);
+            luaL_unref(worker->L, LUA_REGISTRYINDEX, call.ref);
+        }
+        else
+        {
+            lua_xmove(worker->L, co, nargs);
+            resume_command(*worker, co, nargs, std::move(call));
+        }
+        finished = worker->retired && worker->idle();
+    }
+
+    if (finished)
+    {
+        close_retired(worker.get());
+    }
+}
+
+void LuaManager::run_hooks(std::vector<PipelineEvent>& events)
+{
+    static const std::string hook_budget_names[PIPELINE_EVENT_TYPES] = {
+        "hook:on_message", "hook:on_join", "hook:on_group_send",
+    };
+
+    if (events.empty() || hook_mask.load(std::memory_order_acquire) == 0)
+    {
+        return;
+    }
+    LuaWorker* worker = local_state();
+    if (worker == nullptr)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(worker->lua_mtx);
+    lua_State* L = worker->L;
+
+    std::vector<size_t> selected;
+    selected.reserve(events.size());
+    for (size_t type = 0; type < PIPELINE_EVENT_TYPES; ++type)
+    {
+        const std::vector<int>& hooks = worker->hooks[type];
+        for (size_t index = 0; index < hooks.size(); ++index)
+        {
+            // 前一个钩子丢弃的消息不再交给后面的钩子。
+            selected.clear();
+            for (size_t i = 0; i < events.size(); ++i)
+            {
+                if (!events[i].dropped && static_cast<size_t>(events[i].type) == type)
+                {
+                    selected.push_back(i);
+                }
+            }
+            if (selected.empty())
+            {
+                break;
+            }
+            // 按注册顺序区分同类的各个钩子，各状态执行相同的顶层代码，序号一致。
+            // 一个钩子超出预算被停用时，其余钩子照常执行。
+            std::string name = hook_budget_names[type] + "#" + std::to_string(index + 1);
+            if (is_disabled(name))
+            {
+                continue;
+            }
+
+            std::string error;
+            int pushed = push_protected(L, [&](lua_State* S)
+            {
+                lua_createtable(S, static_cast<int>(selected.size()), 0);
+                for (size_t j = 0; j < selected.size(); ++j)
+                {
+                    const PipelineEvent& event = events[selected[j]];
+                    lua_createtable(S, 0, 3);
+                    if (event.type == PipelineEventType::Join)
+                    {
+                        lua_pushlstring(S, event.from.data(), event.from.size());
+                        lua_setfield(S, -2, "user");
+                    }
+                    else
+                    {
+                        lua_pushlstring(S, event.from.data(), event.from.size());
+                        lua_setfield(S, -2, "from");
+                        lua_pushlstring(S, event.text.data(), event.text.size());
+                        lua_setfield(S, -2, "text");
+                        if (event.type == PipelineEventType::GroupSend)
+                        {
+                            lua_pushlstring(S, event.group.data(), event.group.size());
+                            lua_setfield(S, -2, "group");
+                        }
+                    }
+                    lua_rawseti(S, -2, static_cast<lua_Integer>(j + 1));
+                }
+                return 1;
+            }, error);
+            if (pushed < 0)
+            {
+                // 构造批次时内存不足，该批消息照常投递。
+                LOG_ERROR("Lua 钩子 " << name << " 无法执行: " << error);
+                continue;
+            }
+            lua_rawgeti(L, LUA_REGISTRYINDEX, hooks[index]);
+            lua_insert(L, -2);
+
+            if (call_with_budget(*worker, 1, 1, name) != LUA_OK)
+            {
+                if (lua_type(L, -1) == LUA_TSTRING && !worker->budget_exceeded)
+                {
+                    LOG_ERROR("Lua 钩子 " << name << " 执行失败: " << lua_tostring(L, -1));
+                }
+                lua_pop(L, 1);
+                continue;
+            }
+
+            // 加入事件只通知，不接受判定。
+            if (lua_istable(L, -1) && type != static_cast<size_t>(PipelineEventType::Join))
+            {
+                for (size_t j = 0; j < selected.size(); ++j)
+                {
+                    PipelineEvent& event = events[selected[j]];
+                    int verdict = lua_rawgeti(L, -1, static_cast<lua_Integer>(j + 1));
+                    if (verdict == LUA_TBOOLEAN && !lua_toboolean(L, -1))
+                    {
+                        event.dropped = true;
+                    }
+                    else if (verdict == LUA_TSTRING)
+                    {
+                        size_t len = 0;
+                        const char* text = lua_tolstring(L, -1, &len);
+                        event.text.assign(text, len);
+                    }
+                    lua_pop(L, 1);
+                }
+            }
+            lua_pop(L, 1);
+        }
+    }
+}
+
+bool LuaManager::schedule_timer(const std::shared_ptr<LuaWorker>& worker, lua_Integer handle,
+                                std::chrono::milliseconds delay, bool limited)
+{
+    std::lock_guard<std::mutex> lock(timers_mtx);
+    if (limited && timer_index.size() >= budget.max_timers)
+    {
+        return false;
+    }
+    TimerEntry& entry = timer_index[handle];
+    entry.worker = worker;
+    entry.wheel_id = start_wheel_timer(handle, delay);
+    return true;
+}
+
+TimerWheel::TimerId LuaManager::start_wheel_timer(lua_Integer handle,
+                                                  std::chrono::milliseconds delay)
+{
+    // 时间轮回调在事件循环上执行，只查出所属状态，把句柄交给它的所属线程。
+    return TimerWheel::getInstance().schedule(delay, [this, handle]()
+    {
+        std::shared_ptr<LuaWorker> worker;
+        {
+            std::lock_guard<std::mutex> lock(timers_mtx);
+            auto it = timer_index.find(handle);
+            if (it == timer_index.end())
+            {
+                return;
+            }
+            worker = it->second.worker.lock();
+            if (!worker)
+            {
+                timer_index.erase(it);
+                return;
+            }
+        }
+        post_to_owner(worker, [this, handle]()
+        {
+            run_timer(handle);
+        });
+    });
+}
+
+void LuaManager::unschedule_timer(lua_Integer handle)
+{
+    std::lock_guard<std::mutex> lock(timers_mtx);
+    auto it = timer_index.find(handle);
+    if (it == timer_index.end())
+    {
+        return;
+    }
+    TimerWheel::getInstance().cancel(it->second.wheel_id);
+    timer_index.erase(it);
+}
+
+void LuaManager::release_timer(LuaWorker& worker, lua_Integer handle)
+{
+    auto it = worker.timers.find(handle);
+    if (it == worker.timers.end())
+    {
+        return;
+    }
+    luaL_unref(worker.L, LUA_REGISTRYINDEX, it->second.ref);
+    worker.timers.erase(it);
+}
+
+bool LuaManager::cancel_timer(LuaWorker* caller, lua_Integer handle)
+{
+    std::shared_ptr<LuaWorker> owner;
+    {
+        std::lock_guard<std::mutex> lock(timers_mtx);
+        auto it = timer_index.find(handle);
+        if (it == timer_index.end())
+        {
+            return false;
+        }
+        owner = it->second.worker.lock();
+        TimerWheel::getInstance().cancel(it->second.wheel_id);
+        timer_index.erase(it);
+    }
+
+    if (!owner)
+    {
+        return true;
+    }
+    if (owner.get() == caller)
+    {
+        release_timer(*caller, handle);
+        return true;
+    }
+
+    // 定时器属于其他状态 (通常是加载时注册的)，回调引用只能在持有该状态的锁时释放，
+    // 交给它的所属线程，调用者不等待别的状态的锁。
+    post_to_owner(owner, [this, owner, handle]()
+    {
+        bool finished;
+        {
+            std::lock_guard<std::mutex> lock(owner->lua_mtx);
+            if (owner->L == nullptr)
+            {
+                return;
+            }
+            release_timer(*owner, handle);
+            finished = owner->retired && owner->idle();
+        }
+        if (finished)
+        {
+            close_retired(owner.get());
+        }
+    });
+    return true;
+}
+
+void LuaManager::run_timer(lua_Integer handle)
+{
+    std::shared_ptr<LuaWorker> worker;
+    {
+        std::lock_guard<std::mutex> lock(timers_mtx);
+        auto it = timer_index.find(handle);
+        if (it == timer_index.end())
+        {
+            return;
+        }
+        worker = it->second.worker.lock();
+        if (!worker)
+        {
+            timer_index.erase(it);
+            return;
+        }
+    }
+
+    bool finished;
+    {
+        std::lock_guard<std::mutex> lock(worker->lua_mtx);
+        auto it = worker->timers.find(handle);
+        if (worker->L == nullptr || it == worker->timers.end())
+        {
+            return;
+        }
+        LuaTimer timer = it->second;
+        // 按句柄计数，一个定时器超出预算被停用不影响其他定时器。
+        std::string name = (timer.periodic ? LUA_TIMER_EVERY : LUA_TIMER_AFTER) + "#" +
+                           std::to_string(handle);
+
+        // 脚本已重新加载时，旧脚本的周期定时器不再执行。
+        bool stale = timer.periodic &&
+                     worker->generation < script_generation.load(std::memory_order_acquire);
+        bool disabled = is_disabled(name);
+        if (!stale && !disabled)
+        {
+            LuaCommandCall call;
+            int nargs = 0;
+            std::string error;
+            lua_State* co = new_coroutine(worker->L, timer.ref, nullptr, call.ref, nargs, error);
+            if (co == nullptr)
+            {
+                // 本次执行视为中止，周期定时器下次照常到期。
+                LOG_ERROR("Lua 定时器 " << name << " 无法执行: " << error);
+            }
+            else
+            {
+                call.command = name;
+                resume_command(*worker, co, nargs, std::move(call));
+            }
+        }
+
+        bool again = false;
+        if (timer.periodic && !stale && !is_disabled(name))
+        {
+            // 执行期间可能已被 Chat.cancel 取消。间隔从本次执行结束算起。
+            std::lock_guard<std::mutex> timers_lock(timers_mtx);
+            auto entry = timer_index.find(handle);
+            if (entry != timer_index.end())
+            {
+                entry->second.wheel_id = start_wheel_timer(handle, timer.interval);
+                again = true;
+            }
+        }
+        if (!again)
+        {
+            unschedule_timer(handle);
+            release_timer(*worker, handle);
+        }
+        finished = worker->retired && worker->idle();
+    }
+
+    if (finished)
+    {
+        close_retired(worker.get());
+    }
+}
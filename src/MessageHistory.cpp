@@ -0,0 +1,306 @@
+//
+// Created by X on 2025/11/24.
+//
+#include "../include/MessageHistory.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include "../include/Logger.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    // 段文件记录: u64 seq, i64 timestamp_ms, u32 len, bytes
+    constexpr size_t RECORD_HEADER = sizeof(uint64_t) + sizeof(int64_t) +
+                                     sizeof(uint32_t);
+
+    std::string hex_name(const std::string& name)
+    {
+        static const char* digits = "0123456789abcdef";
+        std::string out;
+        out.reserve(name.size() * 2);
+        for (unsigned char c : name)
+        {
+            out += digits[c >> 4];
+            out += digits[c & 0x0F];
+        }
+        return out;
+    }
+
+    std::string segment_name(uint64_t index)
+    {
+        std::string digits = std::to_string(index);
+        return std::string(digits.size() < 6 ? 6 - digits.size() : 0, '0') +
+               digits + ".seg";
+    }
+
+    // 目录中按序号升序排列的段文件。
+    std::vector<std::pair<uint64_t, fs::path>> list_segments(const std::string& dir)
+    {
+        std::vector<std::pair<uint64_t, fs::path>> segments;
+        std::error_code ec;
+        for (const auto& item : fs::directory_iterator(dir, ec))
+        {
+            const fs::path& path = item.path();
+            if (path.extension() != ".seg")
+            {
+                continue;
+            }
+            try
+            {
+                segments.emplace_back(std::stoull(path.stem().string()), path);
+            }
+            catch (const std::exception&)
+            {
+            }
+        }
+        std::sort(segments.begin(), segments.end());
+        return segments;
+    }
+
+    template <typename F>
+    void parse_segment(const fs::path& path, F&& on_record)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in.is_open())
+        {
+            return;
+        }
+        std::string data((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+
+        size_t pos = 0;
+        while (data.size() - pos >= RECORD_HEADER)
+        {
+            HistoryEntry entry;
+            uint32_t len = 0;
+            std::memcpy(&entry.seq, data.data() + pos, sizeof(entry.seq));
+            std::memcpy(&entry.timestamp_ms, data.data() + pos + 8,
+                        sizeof(entry.timestamp_ms));
+            std::memcpy(&len, data.data() + pos + 16, sizeof(len));
+            pos += RECORD_HEADER;
+
+            // 尾部的不完整记录 (写入中途崩溃) 直接忽略。
+            if (data.size() - pos < len)
+            {
+                break;
+            }
+            entry.frame = std::make_shared<const std::string>(data, pos, len);
+            pos += len;
+            on_record(std::move(entry));
+        }
+    }
+}
+
+MessageHistory::MessageHistory(const HistoryConfig& config,
+                               const std::string& group_name)
+    : config_(config),
+      slots_(std::max<size_t>(1, config.max_messages))
+{
+    if (!config_.spill_dir.empty())
+    {
+        dir_ = config_.spill_dir + "/" + hex_name(group_name);
+        recover_from_disk();
+    }
+}
+
+void MessageHistory::recover_from_disk()
+{
+    auto segments = list_segments(dir_);
+    if (segments.empty())
+    {
+        return;
+    }
+
+    // 序号接着上次运行时溢写的最大 seq 继续，避免重启后 seq 重复。
+    segment_index_ = segments.back().first;
+    std::error_code ec;
+    segment_size_ = static_cast<size_t>(fs::file_size(segments.back().second, ec));
+
+    uint64_t max_seq = 0;
+    parse_segment(segments.back().second, [&](HistoryEntry&& e)
+    {
+        max_seq = std::max(max_seq, e.seq);
+    });
+    next_seq_ = max_seq + 1;
+}
+
+uint64_t MessageHistory::append(SharedFrame frame, int64_t timestamp_ms)
+{
+    const size_t len = frame ? frame->size() : 0;
+
+    while (count_ > 0 &&
+           (count_ == slots_.size() || bytes_ + len > config_.max_bytes))
+    {
+        evict_oldest();
+    }
+
+    HistoryEntry& slot = slots_[(head_ + count_) % slots_.size()];
+    slot.seq = next_seq_++;
+    slot.timestamp_ms = timestamp_ms;
+    slot.frame = std::move(frame);
+
+    ++count_;
+    bytes_ += len;
+    return slot.seq;
+}
+
+void MessageHistory::evict_oldest()
+{
+    HistoryEntry& slot = slots_[head_];
+    const size_t len = slot.frame ? slot.frame->size() : 0;
+
+    if (!dir_.empty() && slot.frame)
+    {
+        uint32_t len32 = static_cast<uint32_t>(len);
+        spill_buffer_.append(reinterpret_cast<const char*>(&slot.seq),
+                             sizeof(slot.seq));
+        spill_buffer_.append(reinterpret_cast<const char*>(&slot.timestamp_ms),
+                             sizeof(slot.timestamp_ms));
+        spill_buffer_.append(reinterpret_cast<const char*>(&len32),
+                             sizeof(len32));
+        spill_buffer_.append(*slot.frame);
+    }
+
+    slot.frame.reset();
+    bytes_ -= len;
+    head_ = (head_ + 1) % slots_.size();
+    --count_;
+
+    if (spill_buffer_.size() >= config_.spill_flush_bytes)
+    {
+        flush_spill();
+    }
+}
+
+void MessageHistory::flush_spill()
+{
+    if (spill_buffer_.empty())
+    {
+        return;
+    }
+    write_spill(spill_buffer_.data(), spill_buffer_.size());
+    spill_buffer_.clear();
+}
+
+void MessageHistory::spill_all()
+{
+    while (count_ > 0)
+    {
+        evict_oldest();
+    }
+    flush_spill();
+}
+
+void MessageHistory::write_spill(const char* data, size_t len)
+{
+    std::error_code ec;
+    fs::create_directories(dir_, ec);
+
+    if (segment_size_ >= config_.segment_bytes)
+    {
+        ++segment_index_;
+        segment_size_ = 0;
+
+        for (const auto& seg : list_segments(dir_))
+        {
+            if (seg.first + config_.max_segments <= segment_index_)
+            {
+                fs::remove(seg.second, ec);
+            }
+        }
+    }
+
+    std::ofstream out(dir_ + "/" + segment_name(segment_index_),
+                      std::ios::binary | std::ios::app);
+    if (!out.is_open())
+    {
+        LOG_ERROR("无法写入历史消息段文件: " << dir_);
+        return;
+    }
+    out.write(data, static_cast<std::streamsize>(len));
+    segment_size_ += len;
+}
+
+void MessageHistory::discard()
+{
+    spill_buffer_.clear();
+    if (!dir_.empty())
+    {
+        std::error_code ec;
+        fs::remove_all(dir_, ec);
+    }
+}
+
+uint64_t MessageHistory::oldest_seq() const
+{
+    return count_ > 0 ? slots_[head_].seq : next_seq_;
+}
+
+std::vector<HistoryEntry> MessageHistory::page(uint64_t before_seq, size_t n,
+                                               bool& need_disk) const
+{
+    std::vector<HistoryEntry> out;
+    out.reserve(std::min(n, count_));
+
+    for (size_t i = count_; i > 0 && out.size() < n; --i)
+    {
+        const HistoryEntry& e = slots_[(head_ + i - 1) % slots_.size()];
+        if (before_seq == 0 || e.seq < before_seq)
+        {
+            out.push_back(e);
+        }
+    }
+    std::reverse(out.begin(), out.end());
+
+    uint64_t lowest = out.empty() ? oldest_seq() : out.front().seq;
+    if (before_seq != 0)
+    {
+        lowest = std::min(lowest, before_seq);
+    }
+    need_disk = out.size() < n && !dir_.empty() && lowest > 1;
+    return out;
+}
+
+std::vector<HistoryEntry> MessageHistory::read_spilled(const std::string& dir,
+                                                       uint64_t before_seq,
+                                                       size_t n)
+{
+    std::vector<HistoryEntry> found;
+    if (dir.empty() || n == 0)
+    {
+        return found;
+    }
+
+    auto segments = list_segments(dir);
+    for (auto it = segments.rbegin(); it != segments.rend(); ++it)
+    {
+        parse_segment(it->second, [&](HistoryEntry&& e)
+        {
+            if (before_seq == 0 || e.seq < before_seq)
+            {
+                found.push_back(std::move(e));
+            }
+        });
+
+        if (found.size() >= n)
+        {
+            break;
+        }
+    }
+
+    std::sort(found.begin(), found.end(),
+              [](const HistoryEntry& a, const HistoryEntry& b)
+              {
+                  return a.seq < b.seq;
+              });
+    if (found.size() > n)
+    {
+        found.erase(found.begin(), found.end() - static_cast<long>(n));
+    }
+    return found;
+}
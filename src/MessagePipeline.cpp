@@ -0,0 +1,67 @@
+//
+// Created by X on 2025/12/05.
+//
+#include "../include/MessagePipeline.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "../include/Logger.h"
+
+MessagePipeline& MessagePipeline::getInstance()
+{
+    static MessagePipeline instance;
+    return instance;
+}
+
+MessagePipeline::~MessagePipeline()
+{
+    if (event_fd_ != -1)
+    {
+        close(event_fd_);
+    }
+}
+
+bool MessagePipeline::open()
+{
+    event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd_ == -1)
+    {
+        LOG_ERROR("创建消息流水线 eventfd 失败: " << strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void MessagePipeline::submit(PipelineEvent event)
+{
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        wake = pending_.empty();
+        pending_.push_back(std::move(event));
+    }
+
+    // 队列非空时事件循环已经被唤醒过，不必重复写。
+    if (wake)
+    {
+        uint64_t one = 1;
+        ssize_t n = write(event_fd_, &one, sizeof(one));
+        (void)n;
+    }
+}
+
+std::vector<PipelineEvent> MessagePipeline::take()
+{
+    uint64_t count;
+    ssize_t n = read(event_fd_, &count, sizeof(count));
+    (void)n;
+
+    std::vector<PipelineEvent> events;
+    std::lock_guard<std::mutex> lock(mtx_);
+    events.swap(pending_);
+    return events;
+}
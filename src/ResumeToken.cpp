@@ -0,0 +1,242 @@
+//
+// Created by X on 2025/12/02.
+//
+#include "../include/ResumeToken.h"
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#include <algorithm>
+#include <charconv>
+#include "../include/Logger.h"
+#include "../include/UserManager.h"
+
+namespace
+{
+    constexpr char BASE64URL[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+    std::string base64url_encode(std::string_view data)
+    {
+        std::string out;
+        out.reserve((data.size() + 2) / 3 * 4);
+        size_t i = 0;
+        for (; i + 3 <= data.size(); i += 3)
+        {
+            uint32_t v = (static_cast<uint8_t>(data[i]) << 16) |
+                         (static_cast<uint8_t>(data[i + 1]) << 8) |
+                         static_cast<uint8_t>(data[i + 2]);
+            out.push_back(BASE64URL[(v >> 18) & 0x3F]);
+            out.push_back(BASE64URL[(v >> 12) & 0x3F]);
+            out.push_back(BASE64URL[(v >> 6) & 0x3F]);
+            out.push_back(BASE64URL[v & 0x3F]);
+        }
+        size_t rest = data.size() - i;
+        if (rest > 0)
+        {
+            uint32_t v = static_cast<uint8_t>(data[i]) << 16;
+            if (rest == 2)
+            {
+                v |= static_cast<uint8_t>(data[i + 1]) << 8;
+            }
+            out.push_back(BASE64URL[(v >> 18) & 0x3F]);
+            out.push_back(BASE64URL[(v >> 12) & 0x3F]);
+            if (rest == 2)
+            {
+                out.push_back(BASE64URL[(v >> 6) & 0x3F]);
+            }
+        }
+        return out;
+    }
+
+    int base64url_value(char c)
+    {
+        if (c >= 'A' && c <= 'Z') return c - 'A';
+        if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+        if (c >= '0' && c <= '9') return c - '0' + 52;
+        if (c == '-') return 62;
+        if (c == '_') return 63;
+        return -1;
+    }
+
+    bool base64url_decode(std::string_view text, std::string& out)
+    {
+        if (text.size() % 4 == 1)
+        {
+            return false;
+        }
+        out.clear();
+        out.reserve(text.size() * 3 / 4);
+
+        uint32_t acc = 0;
+        int bits = 0;
+        for (char c : text)
+        {
+            int v = base64url_value(c);
+            if (v < 0)
+            {
+                return false;
+            }
+            acc = (acc << 6) | static_cast<uint32_t>(v);
+            bits += 6;
+            if (bits >= 8)
+            {
+                bits -= 8;
+                out.push_back(static_cast<char>((acc >> bits) & 0xFF));
+            }
+        }
+        return true;
+    }
+
+    // 从 "a\nb\n..." 中取出下一个字段。
+    std::string_view next_field(std::string_view& rest)
+    {
+        size_t pos = rest.find('\n');
+        std::string_view field = rest.substr(0, pos);
+        rest = pos == std::string_view::npos ? std::string_view() : rest.substr(pos + 1);
+        return field;
+    }
+
+    bool parse_u64(std::string_view text, uint64_t& value)
+    {
+        auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+        return ec == std::errc() && ptr == text.data() + text.size();
+    }
+
+    uint64_t unix_now()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+    }
+
+    uint64_t unix_now_ms()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+    }
+}
+
+ResumeTokenManager& ResumeTokenManager::getInstance()
+{
+    static ResumeTokenManager instance;
+    return instance;
+}
+
+void ResumeTokenManager::configure(std::string_view secret, std::chrono::seconds ttl)
+{
+    ttl_ = ttl;
+    if (!secret.empty())
+    {
+        key_.assign(secret.begin(), secret.end());
+        return;
+    }
+
+    key_.resize(32);
+    if (RAND_bytes(key_.data(), static_cast<int>(key_.size())) != 1)
+    {
+        LOG_ERROR("生成会话令牌密钥失败，/resume 将不可用。");
+        key_.clear();
+        return;
+    }
+    LOG_INFO("未配置 RESUME_TOKEN_SECRET，使用随机密钥，重启后会话令牌失效。");
+}
+
+std::string ResumeTokenManager::sign(std::string_view payload) const
+{
+    unsigned char mac[EVP_MAX_MD_SIZE];
+    unsigned int mac_len = 0;
+    HMAC(EVP_sha256(), key_.data(), static_cast<int>(key_.size()),
+         reinterpret_cast<const unsigned char*>(payload.data()), payload.size(),
+         mac, &mac_len);
+    return std::string(reinterpret_cast<const char*>(mac), mac_len);
+}
+
+std::string ResumeTokenManager::issue(const std::string& username_raw)
+{
+    if (key_.empty())
+    {
+        return {};
+    }
+
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        // 新令牌的代数就是新的下限，之前签发的令牌随之作废。代数取当前毫秒时间，
+        // 重启后内存中的下限清零，新签发的令牌仍大于重启前签发的，旧令牌随之作废。
+        uint64_t& min_generation = min_generation_[UserManager::to_lower_nickname(username_raw)];
+        generation = std::max(min_generation + 1, unix_now_ms());
+        min_generation = generation;
+    }
+
+    std::string payload = username_raw;
+    payload += '\n';
+    payload += std::to_string(unix_now() + static_cast<uint64_t>(ttl_.count()));
+    payload += '\n';
+    payload += std::to_string(generation);
+
+    return base64url_encode(payload) + "." + base64url_encode(sign(payload));
+}
+
+bool ResumeTokenManager::redeem(std::string_view token, ResumeClaims& claims)
+{
+    if (key_.empty())
+    {
+        return false;
+    }
+
+    size_t dot = token.find('.');
+    if (dot == std::string_view::npos)
+    {
+        return false;
+    }
+
+    std::string payload;
+    std::string mac;
+    if (!base64url_decode(token.substr(0, dot), payload) ||
+        !base64url_decode(token.substr(dot + 1), mac))
+    {
+        return false;
+    }
+
+    std::string expected = sign(payload);
+    if (mac.size() != expected.size() ||
+        CRYPTO_memcmp(mac.data(), expected.data(), mac.size()) != 0)
+    {
+        return false;
+    }
+
+    std::string_view rest = payload;
+    std::string_view username = next_field(rest);
+    std::string_view expires_text = next_field(rest);
+    std::string_view generation_text = next_field(rest);
+
+    uint64_t expires = 0;
+    uint64_t generation = 0;
+    if (username.empty() || !parse_u64(expires_text, expires) ||
+        !parse_u64(generation_text, generation) || expires < unix_now())
+    {
+        return false;
+    }
+
+    claims.username.assign(username.data(), username.size());
+    claims.generation = generation;
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    uint64_t& min_generation = min_generation_[UserManager::to_lower_nickname(claims.username)];
+    if (generation < min_generation)
+    {
+        return false;
+    }
+    min_generation = generation + 1;
+    return true;
+}
+
+void ResumeTokenManager::revoke(const std::string& username_raw)
+{
+    // 以当前时间为下限，重启后撤销同样能作废重启前签发的令牌。
+    std::lock_guard<std::mutex> lock(mtx_);
+    uint64_t& min_generation = min_generation_[UserManager::to_lower_nickname(username_raw)];
+    min_generation = std::max(min_generation + 1, unix_now_ms());
+}
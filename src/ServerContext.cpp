@@ -10,6 +10,7 @@
 #include <sys/socket.h>
 
 #include "Logger.h"
+#include "../include/Session.h"
 #include "../include/UserManager.h"
 
 
@@ -20,14 +21,7 @@ ServerContext::ServerContext(ThreadPool& p, const MessageSender& sender,
       group_manager(std::make_unique<GroupManager>(sender, *this)),
       db_manager(db_m)
 {
-    try
-    {
-        group_manager->load_groups_from_file(JSON_FILE);
-    }
-    catch (const std::exception& e)
-    {
-        LOG_ERROR("FATAL: 无法加载群组数据，但服务器将尝试空数据启动。"<<e.what());
-    }
+    group_manager->set_password_executor(&password_pool);
 }
 
 std::string ServerContext::get_username(int fd)
@@ -84,6 +78,18 @@ void ServerContext::broadcast(const std::string& msg, int sender_fd) const
     }
 }
 
+void ServerContext::broadcast(const OutboundMessage& msg, int sender_fd) const
+{
+    std::lock_guard<std::mutex> lock(clients_mtx);
+    for (const auto& pair : clients)
+    {
+        int client_fd = pair.first;
+        if (client_fd != -1 && client_fd != sender_fd)
+        {
+            send_outbound(client_fd, msg);
+        }
+    }
+}
 
 bool ServerContext::kick_user_by_nickname(const std::string& target_nickname,
                                           const std::string& kicker_nickname)
@@ -122,6 +128,8 @@ bool ServerContext::kick_user_by_nickname(const std::string& target_nickname,
             ;
         }
 
+        SessionTable::getInstance().close(target_fd);
+
         if (close(target_fd) == -1)
         {
             LOG_ERROR("踢人时，关闭文件描述符失败: " + std::to_string(target_fd));
@@ -0,0 +1,131 @@
+//
+// Created by X on 2025/11/26.
+//
+#include "../include/Session.h"
+
+#include <mutex>
+#include "../include/BinaryProtocol.h"
+#include "../include/TlsContext.h"
+
+SessionTable& SessionTable::getInstance()
+{
+    static SessionTable instance;
+    return instance;
+}
+
+bool SessionTable::open(int fd, Transport transport, bool tls)
+{
+    Session session;
+    session.connection_id = next_connection_id.fetch_add(1);
+    session.io = std::make_shared<ConnectionIO>(transport);
+    if (tls)
+    {
+        ssl_st* ssl = TlsContext::getInstance().new_session(fd);
+        if (!ssl)
+        {
+            return false;
+        }
+        session.io->attach_tls(ssl);
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    sessions[fd] = session;
+    return true;
+}
+
+void SessionTable::close(int fd)
+{
+    std::shared_ptr<ConnectionIO> io;
+    {
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        auto it = sessions.find(fd);
+        if (it == sessions.end())
+        {
+            return;
+        }
+        io = std::move(it->second.io);
+        sessions.erase(it);
+    }
+    if (io)
+    {
+        io->close();
+    }
+}
+
+ProtocolMode SessionTable::protocol(int fd) const
+{
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    auto it = sessions.find(fd);
+    return it == sessions.end() ? ProtocolMode::Text : it->second.protocol;
+}
+
+Session SessionTable::get(int fd) const
+{
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    auto it = sessions.find(fd);
+    if (it == sessions.end())
+    {
+        Session unknown;
+        unknown.negotiated = true;
+        return unknown;
+    }
+    return it->second;
+}
+
+std::shared_ptr<ConnectionIO> SessionTable::io(int fd) const
+{
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    auto it = sessions.find(fd);
+    return it == sessions.end() ? nullptr : it->second.io;
+}
+
+void SessionTable::mark_negotiated(int fd)
+{
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    auto it = sessions.find(fd);
+    if (it != sessions.end())
+    {
+        it->second.negotiated = true;
+    }
+}
+
+void SessionTable::set_protocol(int fd, ProtocolMode mode, uint8_t version,
+                                uint32_t capabilities)
+{
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    auto it = sessions.find(fd);
+    if (it != sessions.end())
+    {
+        it->second.protocol = mode;
+        it->second.version = version;
+        it->second.capabilities = capabilities;
+        it->second.compression = (capabilities & CAP_ZSTD) != 0;
+        if (it->second.io)
+        {
+            it->second.io->ws_binary = mode == ProtocolMode::Binary;
+        }
+    }
+}
+
+bool SessionTable::begin_request(int fd, uint32_t limit)
+{
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    auto it = sessions.find(fd);
+    if (it == sessions.end() || it->second.in_flight >= limit)
+    {
+        return false;
+    }
+    ++it->second.in_flight;
+    return true;
+}
+
+void SessionTable::end_request(int fd, uint64_t connection_id)
+{
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    auto it = sessions.find(fd);
+    if (it != sessions.end() && it->second.connection_id == connection_id &&
+        it->second.in_flight > 0)
+    {
+        --it->second.in_flight;
+    }
+}
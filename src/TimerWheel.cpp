@@ -0,0 +1,167 @@
+//
+// Created by X on 2025/12/06.
+//
+#include "../include/TimerWheel.h"
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "../include/Logger.h"
+
+TimerWheel& TimerWheel::getInstance()
+{
+    static TimerWheel instance;
+    return instance;
+}
+
+TimerWheel::~TimerWheel()
+{
+    if (timer_fd_ != -1)
+    {
+        close(timer_fd_);
+    }
+}
+
+bool TimerWheel::open()
+{
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ == -1)
+    {
+        LOG_ERROR("创建定时器 timerfd 失败: " << strerror(errno));
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (!index_.empty())
+    {
+        arm(true);
+    }
+    return true;
+}
+
+uint64_t TimerWheel::now_tick() const
+{
+    return static_cast<uint64_t>((std::chrono::steady_clock::now() - start_) / TICK);
+}
+
+void TimerWheel::arm(bool enable)
+{
+    if (armed_ == enable || timer_fd_ == -1)
+    {
+        return;
+    }
+
+    itimerspec spec{};
+    if (enable)
+    {
+        auto tick_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(TICK).count();
+        spec.it_value.tv_nsec = tick_ns;
+        spec.it_interval.tv_nsec = tick_ns;
+    }
+    if (timerfd_settime(timer_fd_, 0, &spec, nullptr) == -1)
+    {
+        LOG_ERROR("设置 timerfd 失败: " << strerror(errno));
+        return;
+    }
+    armed_ = enable;
+}
+
+TimerWheel::TimerId TimerWheel::schedule(std::chrono::milliseconds delay, Callback callback)
+{
+    // 至少等一格，回调不会在 schedule 返回前执行。
+    auto ticks = static_cast<uint64_t>(std::max<int64_t>(
+        (delay.count() + TICK.count() - 1) / TICK.count(), 1));
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    uint64_t expires = std::max(now_tick(), current_tick_) + ticks;
+    size_t slot = expires % SLOTS;
+
+    TimerId id = next_id_++;
+    slots_[slot].push_back(Timer{id, expires, std::move(callback)});
+    index_.emplace(id, slot);
+    arm(true);
+    return id;
+}
+
+bool TimerWheel::cancel(TimerId id)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = index_.find(id);
+    if (it == index_.end())
+    {
+        return false;
+    }
+
+    std::vector<Timer>& slot = slots_[it->second];
+    auto timer = std::find_if(slot.begin(), slot.end(),
+                              [id](const Timer& t) { return t.id == id; });
+    if (timer != slot.end())
+    {
+        *timer = std::move(slot.back());
+        slot.pop_back();
+    }
+    index_.erase(it);
+    return true;
+}
+
+void TimerWheel::expire()
+{
+    uint64_t expirations;
+    ssize_t n = read(timer_fd_, &expirations, sizeof(expirations));
+    (void)n;
+
+    std::vector<Timer> due;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        uint64_t target = now_tick();
+        if (target <= current_tick_)
+        {
+            return;
+        }
+
+        // 事件循环被阻塞超过一整圈时，每个格子都检查一遍即可。
+        uint64_t steps = std::min<uint64_t>(target - current_tick_, SLOTS);
+        for (uint64_t i = 1; i <= steps; ++i)
+        {
+            std::vector<Timer>& slot = slots_[(current_tick_ + i) % SLOTS];
+            for (size_t j = 0; j < slot.size();)
+            {
+                if (slot[j].expires > target)
+                {
+                    ++j;
+                    continue;
+                }
+                index_.erase(slot[j].id);
+                due.push_back(std::move(slot[j]));
+                slot[j] = std::move(slot.back());
+                slot.pop_back();
+            }
+        }
+        current_tick_ = target;
+
+        if (index_.empty())
+        {
+            arm(false);
+        }
+    }
+
+    // 在锁外执行，回调里可以继续添加或取消定时器。
+    std::sort(due.begin(), due.end(), [](const Timer& a, const Timer& b)
+    {
+        return a.expires != b.expires ? a.expires < b.expires : a.id < b.id;
+    });
+    for (Timer& timer : due)
+    {
+        timer.callback();
+    }
+}
+
+size_t TimerWheel::pending()
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    return index_.size();
+}
@@ -0,0 +1,111 @@
+//
+// Created by X on 2025/12/03.
+//
+#include "../include/TlsContext.h"
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "../include/Logger.h"
+
+namespace
+{
+    std::string last_ssl_error()
+    {
+        char buf[256];
+        unsigned long code = ERR_get_error();
+        if (code == 0)
+        {
+            return "未知错误";
+        }
+        ERR_error_string_n(code, buf, sizeof(buf));
+        ERR_clear_error();
+        return buf;
+    }
+}
+
+TlsContext& TlsContext::getInstance()
+{
+    static TlsContext instance;
+    return instance;
+}
+
+TlsContext::~TlsContext()
+{
+    SSL_CTX_free(ctx_);
+}
+
+bool TlsContext::configure(const TlsConfig& config)
+{
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx)
+    {
+        LOG_ERROR("创建 SSL_CTX 失败: " << last_ssl_error());
+        return false;
+    }
+
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, config.cert_file.c_str()) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, config.key_file.c_str(), SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1)
+    {
+        LOG_ERROR("加载 TLS 证书或私钥失败: " << last_ssl_error());
+        SSL_CTX_free(ctx);
+        return false;
+    }
+
+    // 无状态会话票据：服务器端不缓存会话，恢复时只需验证票据。
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    SSL_CTX_set_timeout(ctx, static_cast<long>(config.session_timeout.count()));
+    SSL_CTX_set_num_tickets(ctx, 1);
+    static const unsigned char session_id_context[] = "litechat";
+    SSL_CTX_set_session_id_context(ctx, session_id_context, sizeof(session_id_context) - 1);
+
+    // SSL_write 可以只写出一部分，未写完的数据会移到连接的输出缓冲区后重试。
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                          SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                          SSL_MODE_RELEASE_BUFFERS);
+
+    uint64_t options = SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE;
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    if (config.ktls)
+    {
+        options |= SSL_OP_ENABLE_KTLS;
+    }
+#else
+    if (config.ktls)
+    {
+        LOG_WARNING("当前 OpenSSL 不支持 kTLS，记录层将在用户态处理。");
+    }
+#endif
+    SSL_CTX_set_options(ctx, options);
+
+    SSL_CTX_free(ctx_);
+    ctx_ = ctx;
+    LOG_INFO("TLS 已启用，证书: " << config.cert_file);
+    return true;
+}
+
+ssl_st* TlsContext::new_session(int fd) const
+{
+    if (!ctx_)
+    {
+        return nullptr;
+    }
+
+    SSL* ssl = SSL_new(ctx_);
+    if (!ssl)
+    {
+        LOG_ERROR("创建 SSL 失败: " << last_ssl_error());
+        return nullptr;
+    }
+    if (SSL_set_fd(ssl, fd) != 1)
+    {
+        LOG_ERROR("绑定 TLS 连接失败: " << last_ssl_error());
+        SSL_free(ssl);
+        return nullptr;
+    }
+    SSL_set_accept_state(ssl);
+    return ssl;
+}
@@ -0,0 +1,303 @@
+//
+// Created by X on 2025/12/01.
+//
+#include "../include/WebSocket.h"
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    constexpr std::string_view WS_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+    bool iequals(std::string_view a, std::string_view b)
+    {
+        if (a.size() != b.size())
+        {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            char x = a[i];
+            char y = b[i];
+            if (x >= 'A' && x <= 'Z') x = static_cast<char>(x - 'A' + 'a');
+            if (y >= 'A' && y <= 'Z') y = static_cast<char>(y - 'A' + 'a');
+            if (x != y)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // "Connection: keep-alive, Upgrade" 这类逗号分隔的头部值中是否包含 token。
+    bool contains_token(std::string_view value, std::string_view token)
+    {
+        while (!value.empty())
+        {
+            size_t comma = value.find(',');
+            std::string_view item = value.substr(0, comma);
+            size_t begin = item.find_first_not_of(" \t");
+            size_t end = item.find_last_not_of(" \t");
+            if (begin != std::string_view::npos &&
+                iequals(item.substr(begin, end - begin + 1), token))
+            {
+                return true;
+            }
+            if (comma == std::string_view::npos)
+            {
+                break;
+            }
+            value.remove_prefix(comma + 1);
+        }
+        return false;
+    }
+
+    std::string accept_key(std::string_view client_key)
+    {
+        std::string input(client_key);
+        input.append(WS_GUID.data(), WS_GUID.size());
+
+        unsigned char digest[SHA_DIGEST_LENGTH];
+        SHA1(reinterpret_cast<const unsigned char*>(input.data()), input.size(), digest);
+
+        // 20 字节的 base64 为 28 个字符，EVP_EncodeBlock 额外写一个结尾 NUL。
+        char encoded[32];
+        int n = EVP_EncodeBlock(reinterpret_cast<unsigned char*>(encoded), digest,
+                                SHA_DIGEST_LENGTH);
+        return std::string(encoded, static_cast<size_t>(n));
+    }
+}
+
+WsHandshakeResult parse_ws_handshake(std::string_view request, std::string& response,
+                                     size_t& consumed)
+{
+    size_t end = request.find("\r\n\r\n");
+    if (end == std::string_view::npos)
+    {
+        return request.size() > WS_MAX_HANDSHAKE_SIZE
+                   ? WsHandshakeResult::Rejected
+                   : WsHandshakeResult::Incomplete;
+    }
+    consumed = end + 4;
+
+    static const std::string bad_request =
+        "HTTP/1.1 400 Bad Request\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+
+    std::string_view head = request.substr(0, end);
+    size_t line_end = head.find("\r\n");
+    std::string_view request_line = head.substr(0, line_end);
+    if (request_line.substr(0, 4) != "GET ")
+    {
+        response = bad_request;
+        return WsHandshakeResult::Rejected;
+    }
+
+    bool upgrade = false;
+    bool connection_upgrade = false;
+    bool version_ok = false;
+    std::string_view key;
+
+    while (line_end != std::string_view::npos)
+    {
+        head.remove_prefix(line_end + 2);
+        line_end = head.find("\r\n");
+        std::string_view line = head.substr(0, line_end);
+
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos)
+        {
+            continue;
+        }
+        std::string_view name = line.substr(0, colon);
+        std::string_view value = line.substr(colon + 1);
+        size_t begin = value.find_first_not_of(" \t");
+        value = begin == std::string_view::npos ? std::string_view() : value.substr(begin);
+        size_t last = value.find_last_not_of(" \t");
+        value = value.substr(0, last == std::string_view::npos ? 0 : last + 1);
+
+        if (iequals(name, "Upgrade"))
+        {
+            upgrade = contains_token(value, "websocket");
+        }
+        else if (iequals(name, "Connection"))
+        {
+            connection_upgrade = contains_token(value, "upgrade");
+        }
+        else if (iequals(name, "Sec-WebSocket-Version"))
+        {
+            version_ok = value == "13";
+        }
+        else if (iequals(name, "Sec-WebSocket-Key"))
+        {
+            key = value;
+        }
+    }
+
+    if (!upgrade || !connection_upgrade || key.empty())
+    {
+        response = bad_request;
+        return WsHandshakeResult::Rejected;
+    }
+    if (!version_ok)
+    {
+        response = "HTTP/1.1 426 Upgrade Required\r\nSec-WebSocket-Version: 13\r\n"
+                   "Connection: close\r\nContent-Length: 0\r\n\r\n";
+        return WsHandshakeResult::Rejected;
+    }
+
+    response = "HTTP/1.1 101 Switching Protocols\r\n"
+               "Upgrade: websocket\r\n"
+               "Connection: Upgrade\r\n"
+               "Sec-WebSocket-Accept: " + accept_key(key) + "\r\n\r\n";
+    return WsHandshakeResult::Accepted;
+}
+
+size_t encode_ws_header(WsOpcode opcode, size_t payload_size, char* out)
+{
+    out[0] = static_cast<char>(0x80 | static_cast<uint8_t>(opcode));
+    if (payload_size < 126)
+    {
+        out[1] = static_cast<char>(payload_size);
+        return 2;
+    }
+    if (payload_size <= 0xFFFF)
+    {
+        out[1] = 126;
+        out[2] = static_cast<char>(payload_size >> 8);
+        out[3] = static_cast<char>(payload_size);
+        return 4;
+    }
+    out[1] = 127;
+    for (int i = 0; i < 8; ++i)
+    {
+        out[2 + i] = static_cast<char>(static_cast<uint64_t>(payload_size) >> (56 - 8 * i));
+    }
+    return 10;
+}
+
+WsParseResult parse_ws_frame(char* data, size_t size, size_t max_payload, WsFrame& frame)
+{
+    if (size < 2)
+    {
+        return WsParseResult::Incomplete;
+    }
+
+    auto b0 = static_cast<uint8_t>(data[0]);
+    auto b1 = static_cast<uint8_t>(data[1]);
+
+    // 未协商任何扩展，保留位必须为 0；客户端帧必须带掩码。
+    if ((b0 & 0x70) != 0 || (b1 & 0x80) == 0)
+    {
+        return WsParseResult::Error;
+    }
+
+    frame.fin = (b0 & 0x80) != 0;
+    uint8_t opcode = b0 & 0x0F;
+    switch (opcode)
+    {
+    case 0x0:
+    case 0x1:
+    case 0x2:
+    case 0x8:
+    case 0x9:
+    case 0xA:
+        break;
+    default:
+        return WsParseResult::Error;
+    }
+    frame.opcode = static_cast<WsOpcode>(opcode);
+    bool control = (opcode & 0x8) != 0;
+
+    uint64_t length = b1 & 0x7F;
+    size_t pos = 2;
+    if (length == 126)
+    {
+        if (size < pos + 2)
+        {
+            return WsParseResult::Incomplete;
+        }
+        length = (static_cast<uint64_t>(static_cast<uint8_t>(data[2])) << 8) |
+                 static_cast<uint8_t>(data[3]);
+        pos += 2;
+    }
+    else if (length == 127)
+    {
+        if (size < pos + 8)
+        {
+            return WsParseResult::Incomplete;
+        }
+        length = 0;
+        for (int i = 0; i < 8; ++i)
+        {
+            length = (length << 8) | static_cast<uint8_t>(data[2 + i]);
+        }
+        pos += 8;
+    }
+
+    // 控制帧不能分片，负载不超过 125 字节。
+    if (control && (!frame.fin || length > 125))
+    {
+        return WsParseResult::Error;
+    }
+    if (length > max_payload)
+    {
+        return WsParseResult::Error;
+    }
+
+    if (size < pos + 4)
+    {
+        return WsParseResult::Incomplete;
+    }
+    uint8_t mask[4];
+    std::memcpy(mask, data + pos, sizeof(mask));
+    pos += 4;
+
+    if (size - pos < length)
+    {
+        return WsParseResult::Incomplete;
+    }
+
+    frame.payload = data + pos;
+    frame.payload_size = static_cast<size_t>(length);
+    frame.frame_size = pos + frame.payload_size;
+    ws_unmask(frame.payload, frame.payload_size, mask);
+    return WsParseResult::Frame;
+}
+
+void ws_unmask(char* data, size_t size, const uint8_t mask[4])
+{
+    uint32_t key32;
+    std::memcpy(&key32, mask, sizeof(key32));
+
+    // 每次前进 4 的整数倍，掩码的相位保持不变。
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i key128 = _mm_set1_epi32(static_cast<int>(key32));
+    for (; i + 16 <= size; i += 16)
+    {
+        auto* p = reinterpret_cast<__m128i*>(data + i);
+        _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), key128));
+    }
+#endif
+
+    const uint64_t key64 = (static_cast<uint64_t>(key32) << 32) | key32;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        word ^= key64;
+        std::memcpy(data + i, &word, sizeof(word));
+    }
+
+    for (; i < size; ++i)
+    {
+        data[i] = static_cast<char>(data[i] ^ mask[i & 3]);
+    }
+}
@@ -4,24 +4,23 @@ print("[Lua] commands.lua 已加载")
 
 local function require_admin(nickname,is_admin)
     if not is_admin then
-         Chat.broadcast("Server", "错误：" .. nickname .. "，该命令需要管理员权限。")
+         Chat.reply("错误：" .. nickname .. "，该命令需要管理员权限。")
         error("权限不足，终止命令执行", 0)
         return false
     end
     return true
 end
 
-_G.lua_cmd_hello=function (nickname,args)
+-- 所有命令都以 (nickname, is_admin, args) 调用
+_G.lua_cmd_hello=function (nickname,is_admin,args)
     local msg= "你好，" .. nickname .. "！你正在使用 Lua 自定义命令。"
 
-    if Chat and Chat.broadcast then
-        Chat.broadcast("Server",msg)
-        Chat.broadcast("Server","你发送的参数数量"..#args)
-    end
+    Chat.reply(msg)
+    Chat.reply("你发送的参数数量"..#args)
     return true
 end
 
-_G.lua_cmd_roll=function (nickname,args)
+_G.lua_cmd_roll=function (nickname,is_admin,args)
     local max=tonumber(args[1]) or 100
     local result=math.random(1,max)
     local msg=nickname.. " 掷出了 " .. result .." 点 (最大值: " .. max .. ")"
@@ -33,20 +32,39 @@ _G.lua_cmd_roll=function (nickname,args)
     return true
 end
 
+-- Chat.db_get_user 会挂起命令直到数据库查询完成，不占用线程
+_G.lua_cmd_whois=function (nickname,is_admin,args)
+    if #args<1 then
+        Chat.reply("用法: /whois <用户名>")
+        return true
+    end
+
+    local user=Chat.db_get_user(args[1])
+    if not user then
+        Chat.reply("用户 [" .. args[1] .. "] 不存在。")
+        return true
+    end
+
+    local role=user.is_admin and "管理员" or "普通用户"
+    local state=Chat.is_online(user.username) and "在线" or "离线"
+    Chat.reply(user.username .. "：" .. role .. "，" .. state)
+    return true
+end
+
 _G.lua_cmd_kick=function (admin_nickname,is_admin,args)
     if not require_admin(admin_nickname,is_admin) then
         return false
     end
 
     if #args<1 then
-        Chat.broadcast("Server","用法: /kick <目标昵称>")
+        Chat.reply("用法: /kick <目标昵称>")
         return false
     end
 
     local target_nickname=args[1]
 
     if target_nickname==admin_nickname then
-        Chat.broadcast("Server", "管理员不能使用该命令踢出自己。")
+        Chat.reply("管理员不能使用该命令踢出自己。")
         return false
     end
 
@@ -55,7 +73,27 @@ _G.lua_cmd_kick=function (admin_nickname,is_admin,args)
     if success then
         return true
     else
-        Chat.broadcast("Server", "踢出失败: 未找到用户 [" .. target_nickname .. "]。")
+        Chat.reply("踢出失败: 未找到用户 [" .. target_nickname .. "]。")
         return false
     end
-end
\ No newline at end of file
+end
+
+-- 消息过滤示例 (注册任一钩子后，对应消息都会先经过 Lua，未使用时不要注册)：
+-- 钩子整批接收消息，返回与批次等长的判定数组，false 丢弃，字符串替换正文，nil/true 照常投递。
+--
+-- Chat.on_message(function (batch)
+--     local verdicts={}
+--     for i,msg in ipairs(batch) do
+--         if string.find(msg.text,"广告",1,true) then
+--             verdicts[i]=false
+--         end
+--     end
+--     return verdicts
+-- end)
+
+-- 定时器示例：Chat.every 返回的句柄可以交给 Chat.cancel 停止。
+-- 顶层注册的定时器每次加载只生效一份，不会因为多个线程各执行一遍。
+--
+-- Chat.every(10*60*1000,function ()
+--     Chat.broadcast("Server","欢迎使用 LiteChat，输入 /hello 试试 Lua 命令。")
+-- end)
@@ -5,12 +5,19 @@
 
 #include <unistd.h>
 
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <ctime>
 #include <functional>
+#include <iterator>
 #include <sstream>
 #include <fstream>
 #include "Logger.h"
 #include "../include/json.hpp"
 #include "../include/UserManager.h"
+#include "../include/threadpool.h"
+#include "../include/RequestContext.h"
 using json = nlohmann::json;
 
 
@@ -20,6 +27,29 @@ GroupManager::GroupManager(MessageSender sender,
 {
 }
 
+GroupManager::~GroupManager()
+{
+    stop_background_snapshots();
+}
+
+Group& GroupManager::edit(GroupEntry& entry)
+{
+    // 新的引用只能在 entry.mtx 下产生，use_count 为 1 时没有其他读者。
+    // state 总是由 make_shared<Group> 创建，去掉 const 修改是合法的。
+    if (entry.state.use_count() != 1)
+    {
+        entry.state = std::make_shared<Group>(*entry.state);
+    }
+    else
+    {
+        // use_count 是 relaxed 读。快照线程在锁外释放副本，这里与它的递减同步，
+        // 保证它对 Group 的读取都发生在原地修改之前。
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    mutation_epoch.fetch_add(1, std::memory_order_relaxed);
+    return const_cast<Group&>(*entry.state);
+}
+
 std::vector<std::string> GroupManager::split(const std::string& s,
                                              char delimiter)
 {
@@ -34,9 +64,9 @@ std::vector<std::string> GroupManager::split(const std::string& s,
     return tokens;
 }
 
-std::string GroupManager::to_lower_nickname(const std::string& nickname)
+std::string GroupManager::to_lower_nickname(std::string_view nickname)
 {
-    std::string lower_nickname = nickname;
+    std::string lower_nickname(nickname);
 
     std::transform(lower_nickname.begin(), lower_nickname.end(),
                    lower_nickname.begin(), [](unsigned char c)
@@ -48,16 +78,181 @@ std::string GroupManager::to_lower_nickname(const std::string& nickname)
 }
 
 
+GroupEntryPtr GroupManager::find_group(const std::string& group_name)
+{
+    GroupEntryPtr entry = groups.find(group_name);
+    if (entry)
+    {
+        return entry;
+    }
+
+    // 解码与插入都在 snapshot_mtx 下完成，解散操作也先在此锁下写墓碑，
+    // 因此不会把刚解散的群组重新加载回来。
+    std::lock_guard<std::mutex> lock(snapshot_mtx);
+    if (!snapshot || snapshot_tombstones.count(group_name))
+    {
+        return nullptr;
+    }
+
+    Group group;
+    if (!snapshot->find(group_name, group))
+    {
+        return nullptr;
+    }
+
+    auto loaded = std::make_shared<GroupEntry>();
+    loaded->state = std::make_shared<Group>(std::move(group));
+
+    bool inserted = false;
+    return groups.insert(group_name, std::move(loaded), inserted);
+}
+
+void GroupManager::remove_group(const std::string& group_name,
+                                const GroupEntryPtr& entry)
+{
+    entry->removed = true;
+    mutation_epoch.fetch_add(1, std::memory_order_relaxed);
+    history_of(*entry).discard();
+    entry->history.reset();
+
+    std::lock_guard<std::mutex> lock(snapshot_mtx);
+    if (snapshot)
+    {
+        snapshot_tombstones.insert(group_name);
+    }
+    groups.erase(group_name, entry);
+}
+
+std::vector<Group> GroupManager::materialize_all() const
+{
+    std::vector<Group> all;
+    auto entries = groups.entries();
+
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mtx);
+        if (snapshot)
+        {
+            snapshot->load_all(all);
+            all.erase(std::remove_if(all.begin(), all.end(),
+                                     [this](const Group& g)
+                                     {
+                                         return groups.contains(g.name) ||
+                                                snapshot_tombstones.count(g.name);
+                                     }),
+                      all.end());
+        }
+    }
+
+    for (const auto& pair : entries)
+    {
+        std::lock_guard<std::mutex> lock(pair.second->mtx);
+        if (!pair.second->removed)
+        {
+            all.push_back(*pair.second->state);
+        }
+    }
+    return all;
+}
+
+MessageHistory& GroupManager::history_of(GroupEntry& entry) const
+{
+    if (!entry.history)
+    {
+        entry.history = std::make_unique<MessageHistory>(history_config,
+                                                         entry.state->name);
+    }
+    return *entry.history;
+}
+
+void GroupManager::configure_history(const HistoryConfig& config)
+{
+    history_config = config;
+    LOG_INFO("群消息历史: 每群最多 " << config.max_messages << " 条 / "
+             << config.max_bytes << " 字节，溢写目录: " << config.spill_dir);
+}
+
+void GroupManager::flush_history()
+{
+    for (const auto& pair : groups.entries())
+    {
+        std::lock_guard<std::mutex> lock(pair.second->mtx);
+        if (pair.second->history && !pair.second->removed)
+        {
+            pair.second->history->spill_all();
+        }
+    }
+}
+
+template <typename Names>
+void GroupManager::notify_members(const Names& members,
+                                  const std::string& msg) const
+{
+    for (const std::string& member_name : members)
+    {
+        int member_fd = ctx_ref.get_fd_by_nickname(member_name);
+        if (member_fd != -1)
+        {
+            message_sender(member_fd, msg);
+        }
+    }
+}
+
+template <typename Names>
+void GroupManager::notify_members(const Names& members,
+                                  const OutboundMessage& msg) const
+{
+    for (const std::string& member_name : members)
+    {
+        int member_fd = ctx_ref.get_fd_by_nickname(member_name);
+        if (member_fd != -1)
+        {
+            send_outbound(member_fd, msg);
+        }
+    }
+}
+
+void GroupManager::set_password_executor(ThreadPool* executor)
+{
+    password_executor = executor;
+}
+
+void GroupManager::run_password_task(std::function<void()> task)
+{
+    if (password_executor)
+    {
+        // 异步完成的回复仍要带上发起请求的 ID。
+        password_executor->enqueue([tag = current_request(), task = std::move(task)]()
+        {
+            RequestScope scope(tag);
+            task();
+        });
+    }
+    else
+    {
+        task();
+    }
+}
+
+void GroupManager::reply_async(const std::string& username_raw,
+                               const std::string& msg) const
+{
+    int fd = ctx_ref.get_fd_by_nickname(username_raw);
+    if (fd != -1)
+    {
+        message_sender(fd, msg);
+    }
+}
+
 std::string GroupManager::handle_create_group(
     const std::string& creator_nickname_raw,
-    const std::vector<std::string>& parts)
+    const CommandArgs& parts)
 {
     if (parts.size() < 2 || parts.size() > 3)
     {
         return "用法: /creategroup <群名> [密码]";
     }
 
-    const std::string& group_name_raw = parts[1];
+    std::string group_name_raw(parts[1]);
     std::string group_name = to_lower_nickname(group_name_raw);
     std::string creator_nickname = to_lower_nickname(creator_nickname_raw);
 
@@ -66,97 +261,182 @@ std::string GroupManager::handle_create_group(
         return "群名不能为空。\n";
     }
 
-    std::lock_guard<std::mutex> lock(mtx);
-    if (groups.count(group_name))
+    if (find_group(group_name))
     {
         return "错误：群组 '" + group_name_raw + "' 已经存在。\n";
     }
 
-    Group new_group;
-    new_group.name = group_name;
-    new_group.owner_nickname = creator_nickname;
-    new_group.members.insert(creator_nickname);
-
-    if (parts.size() == 3)
+    if (parts.size() < 3)
     {
-        const std::string& password = parts[2];
-
-        std::string encoded_hash;
+        return commit_create(group_name, group_name_raw, creator_nickname, "");
+    }
 
-        if (UserManager::hash_password(password, encoded_hash))
+    // 密码保护群组：哈希在密码线程池中完成，完成后再提交并异步回复。
+    std::string password(parts[2]);
+    run_password_task([this, group_name, group_name_raw, creator_nickname,
+            creator_nickname_raw, password]()
         {
-            new_group.password_hash = encoded_hash;
+            std::string encoded_hash;
+            std::string reply;
 
-            LOG_INFO("用户 [" + creator_nickname + "] 创建了密码保护群组: " + group_name);
-            groups.emplace(group_name, std::move(new_group));
-            return "恭喜！群组 '" + group_name + "' 创建成功，已设置密码，您是群主。\n";
-        }
-        else
-        {
-            return "错误: 密码处理失败，群组创建中止。\n";
-        }
+            if (!UserManager::hash_password(password, encoded_hash))
+            {
+                reply = "错误: 密码处理失败，群组创建中止。\n";
+            }
+            else
+            {
+                reply = commit_create(group_name, group_name_raw,
+                                      creator_nickname, encoded_hash);
+            }
+            reply_async(creator_nickname_raw, reply);
+        });
+    return "";
+}
+
+std::string GroupManager::commit_create(const std::string& group_name,
+                                        const std::string& group_name_raw,
+                                        const std::string& creator_nickname,
+                                        const std::string& password_hash)
+{
+    // 哈希期间可能已有同名群组被创建或从快照加载。
+    if (find_group(group_name))
+    {
+        return "错误：群组 '" + group_name_raw + "' 已经存在。\n";
     }
-    else
+
+    auto new_group = std::make_shared<Group>();
+    new_group->name = group_name;
+    new_group->owner_nickname = creator_nickname;
+    new_group->members.insert(creator_nickname);
+    new_group->password_hash = password_hash;
+
+    auto entry = std::make_shared<GroupEntry>();
+    entry->state = std::move(new_group);
+
+    bool inserted = false;
+    groups.insert(group_name, std::move(entry), inserted);
+    if (!inserted)
     {
-        new_group.password_hash = "";
+        return "错误：群组 '" + group_name_raw + "' 已经存在。\n";
+    }
+    mutation_epoch.fetch_add(1, std::memory_order_relaxed);
 
-        LOG_INFO("用户 [" + creator_nickname + "] 创建了公开群组: " + group_name);
-        groups.emplace(group_name, std::move(new_group));
-        return "恭喜！群组 '" + group_name + "' 创建成功，您已自动成为群主。\n";
+    if (!password_hash.empty())
+    {
+        LOG_INFO("用户 [" + creator_nickname + "] 创建了密码保护群组: " + group_name);
+        return "恭喜！群组 '" + group_name + "' 创建成功，已设置密码，您是群主。\n";
     }
+
+    LOG_INFO("用户 [" + creator_nickname + "] 创建了公开群组: " + group_name);
+    return "恭喜！群组 '" + group_name + "' 创建成功，您已自动成为群主。\n";
 }
 
 
 std::string GroupManager::handle_join_group(
-    const std::string& username_raw, const std::vector<std::string>& parts)
+    const std::string& username_raw, const CommandArgs& parts)
 {
     if (parts.size() < 2 || parts.size() > 3)
     {
         return "用法: /join <群名> [密码]";
     }
 
-    const std::string& group_name_raw = parts[1];
+    std::string group_name_raw(parts[1]);
     std::string group_name = to_lower_nickname(group_name_raw);
     std::string username = to_lower_nickname(username_raw);
 
-    std::lock_guard<std::mutex> lock(mtx);
-
-    auto it = groups.find(group_name);
-    if (it == groups.end())
+    GroupEntryPtr entry = find_group(group_name);
+    if (!entry)
     {
         return "错误：群组 '" + group_name + "' 不存在。\n";
     }
 
-    Group& group = it->second;
+    // 第一阶段：在群组锁内取得状态快照并做廉价检查。
+    std::shared_ptr<const Group> observed;
+    {
+        std::lock_guard<std::mutex> lock(entry->mtx);
+        observed = entry->state;
 
-    if (group.banned_members.count(username))
+        if (entry->removed)
+        {
+            return "错误：群组 '" + group_name + "' 不存在。\n";
+        }
+    }
+
+    if (observed->banned_members.count(username))
     {
         return "错误：您已被群组 '" + group_name + "' 禁止重新加入。\n";
     }
 
-    if (group.members.count(username))
+    if (observed->members.count(username))
     {
         return "您已在该群组中。\n";
     }
 
-    if (!group.password_hash.empty())
+    if (observed->password_hash.empty())
+    {
+        return commit_join(entry, username, group_name, group_name_raw, "");
+    }
+
+    if (parts.size() < 3)
+    {
+        return "错误: 群组 '" + group_name +
+               "' 是私有群组，需要密码才能加入。用法: /join <群名> <密码>\n";
+    }
+
+    // 第二阶段：Argon2 校验在密码线程池中完成，不占用任何锁，也不阻塞事件循环。
+    std::string password_hash = observed->password_hash;
+    std::string provided_password(parts[2]);
+    run_password_task([this, entry, username, username_raw, group_name,
+            group_name_raw, password_hash, provided_password]()
+        {
+            std::string reply;
+            if (!UserManager::verify_password(provided_password, password_hash))
+            {
+                reply = "错误: 您提供的群组密码不正确。\n";
+            }
+            else
+            {
+                reply = commit_join(entry, username, group_name, group_name_raw,
+                                    password_hash);
+            }
+            reply_async(username_raw, reply);
+        });
+    return "";
+}
+
+std::string GroupManager::commit_join(const GroupEntryPtr& entry,
+                                      const std::string& username,
+                                      const std::string& group_name,
+                                      const std::string& group_name_raw,
+                                      const std::string& verified_hash)
+{
+    // 第三阶段：重新加锁并复核，期间群组可能已解散、用户被封禁或密码被修改。
     {
-        if (parts.size() < 3)
+        std::lock_guard<std::mutex> lock(entry->mtx);
+        const Group& group = *entry->state;
+
+        if (entry->removed)
+        {
+            return "错误：群组 '" + group_name + "' 不存在。\n";
+        }
+
+        if (group.banned_members.count(username))
         {
-            return "错误: 群组 '" + group_name +
-                   "' 是私有群组，需要密码才能加入。用法: /join <群名> <密码>\n";
+            return "错误：您已被群组 '" + group_name + "' 禁止重新加入。\n";
         }
 
-        const std::string& provided_password = parts[2];
+        if (group.password_hash != verified_hash)
+        {
+            return "错误: 群组密码已变更，请重试。\n";
+        }
 
-        if (!UserManager::verify_password(group.password_hash,
-                                          provided_password))
+        if (group.members.count(username))
         {
-            return "错误: 您提供的群组密码不正确。\n";
+            return "您已在该群组中。\n";
         }
-    }
 
-    group.members.insert(username);
+        edit(*entry).members.insert(username);
+    }
 
     LOG_INFO("用户 [" + username + "] 加入了群组: " + group_name);
 
@@ -165,71 +445,229 @@ std::string GroupManager::handle_join_group(
 
 std::string GroupManager::handle_list_groups() const
 {
+    std::string group_list = "所有群: ";
+    bool first = true;
+
+    auto append = [&](const std::string& name)
     {
-        std::lock_guard<std::mutex> lock(mtx);
-        std::string group_list = "所有群: ";
-        bool first = true;
-        for (const auto& pair : groups)
+        if (!first)
         {
-            if (!first)
+            group_list += ", ";
+        }
+        group_list += name;
+        first = false;
+    };
+
+    for (const auto& pair : groups.entries())
+    {
+        append(pair.first);
+    }
+
+    // 尚未被访问过的快照群组只读取群名，不做完整解码。
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mtx);
+        if (snapshot)
+        {
+            for (size_t i = 0; i < snapshot->size(); ++i)
             {
-                group_list += ", ";
+                std::string name(snapshot->name_at(i));
+                if (name.empty() || groups.contains(name) ||
+                    snapshot_tombstones.count(name))
+                {
+                    continue;
+                }
+                append(name);
             }
-            group_list += pair.first;
-            first = false;
         }
-        return groups.empty() ? "目前没有群。" : group_list;
     }
+    return first ? "目前没有群。" : group_list;
 }
 
-std::string GroupManager::handle_send_message(
-    const std::string& username_raw, const std::vector<std::string>& parts)
+ProtocolError GroupManager::check_member(const std::string& username_raw,
+                                         const std::string& group_name_raw)
 {
-    if (parts.size() < 3)
+    GroupEntryPtr entry = find_group(to_lower_nickname(group_name_raw));
+    if (!entry)
     {
-        return "用法: /send <群名> <消息>\n";
+        return ProtocolError::GroupNotFound;
     }
 
-    const std::string& group_name_raw = parts[1];
+    std::lock_guard<std::mutex> lock(entry->mtx);
+    if (entry->removed)
+    {
+        return ProtocolError::GroupNotFound;
+    }
+    if (entry->state->members.count(to_lower_nickname(username_raw)) == 0)
+    {
+        return ProtocolError::NotGroupMember;
+    }
+    return ProtocolError::None;
+}
+
+ProtocolError GroupManager::deliver_to_group(const std::string& group_name_raw,
+                                             const OutboundMessage& msg)
+{
+    GroupEntryPtr entry = find_group(to_lower_nickname(group_name_raw));
+    if (!entry)
+    {
+        return ProtocolError::GroupNotFound;
+    }
+
+    std::shared_ptr<const Group> state;
+    {
+        std::lock_guard<std::mutex> lock(entry->mtx);
+        if (entry->removed)
+        {
+            return ProtocolError::GroupNotFound;
+        }
+        state = entry->state;
+    }
+
+    notify_members(state->members, msg);
+    return ProtocolError::None;
+}
+
+ProtocolError GroupManager::send_group_message(const std::string& username_raw,
+                                               const std::string& group_name_raw,
+                                               const std::string& content)
+{
     std::string group_name = to_lower_nickname(group_name_raw);
     std::string username = to_lower_nickname(username_raw);
 
-    std::string message_content;
-    for (size_t i = 2; i < parts.size(); ++i)
+    OutboundMessage message = make_group_message(group_name_raw, username, content);
+    int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    GroupEntryPtr entry = find_group(group_name);
+    if (!entry)
     {
-        message_content += parts[i] + (i == parts.size() - 1 ? "" : " ");
+        return ProtocolError::GroupNotFound;
     }
 
-    std::string full_message = "[" + group_name_raw + "]" + username + ": " +
-                               message_content;
+    // 锁内只取成员列表的只读视图并记录历史，投递在锁外进行。
+    std::shared_ptr<const Group> state;
+    {
+        std::lock_guard<std::mutex> lock(entry->mtx);
+        state = entry->state;
 
+        if (entry->removed)
+        {
+            return ProtocolError::GroupNotFound;
+        }
+
+        if (state->members.find(username) == state->members.end())
+        {
+            return ProtocolError::NotGroupMember;
+        }
+
+        history_of(*entry).append(message.text, now_ms);
+    }
+
+    notify_members(state->members, message);
+    return ProtocolError::None;
+}
+
+std::string GroupManager::handle_history(const std::string& username_raw,
+                                         const CommandArgs& parts)
+{
+    constexpr size_t DEFAULT_PAGE = 20;
+    constexpr size_t MAX_PAGE = 100;
+
+    if (parts.size() < 2 || parts.size() > 4)
+    {
+        return "用法: /history <群名> [before_seq] [条数]\n";
+    }
+
+    std::string group_name_raw(parts[1]);
+    std::string group_name = to_lower_nickname(group_name_raw);
+    std::string username = to_lower_nickname(username_raw);
+
+    auto parse_number = [](std::string_view text, auto& out)
+    {
+        const char* end = text.data() + text.size();
+        auto result = std::from_chars(text.data(), end, out);
+        return result.ec == std::errc() && result.ptr == end;
+    };
+
+    uint64_t before_seq = 0;
+    size_t n = DEFAULT_PAGE;
+    if ((parts.size() >= 3 && !parse_number(parts[2], before_seq)) ||
+        (parts.size() == 4 && !parse_number(parts[3], n)))
+    {
+        return "错误：before_seq 与条数必须是数字。\n";
+    }
+    n = std::min<size_t>(MAX_PAGE, std::max<size_t>(1, n));
+
+    GroupEntryPtr entry = find_group(group_name);
+    if (!entry)
+    {
+        return "错误：该群不存在。\n";
+    }
+
+    std::vector<HistoryEntry> page;
+    bool need_disk = false;
+    std::string spill_dir;
     {
-        std::lock_guard<std::mutex> lock(mtx);
+        std::lock_guard<std::mutex> lock(entry->mtx);
 
-        auto group_it = groups.find(group_name);
-        if (group_it == groups.end())
+        if (entry->removed)
         {
             return "错误：该群不存在。\n";
         }
 
-        const Group& group = group_it->second;
-
-        if (group.members.find(username) == group.members.end())
+        if (!entry->state->members.count(username))
         {
             return "错误：您不是该群的成员。\n";
         }
 
-        for (const std::string& member_name : group.members)
+        MessageHistory& history = history_of(*entry);
+        page = history.page(before_seq, n, need_disk);
+        if (need_disk)
         {
-            int member_fd = ctx_ref.get_fd_by_nickname(member_name);
+            history.flush_spill();
+            spill_dir = history.spill_path();
+        }
+    }
 
-            if (member_fd != -1)
-            {
-                message_sender(member_fd, full_message + "\n");
-            }
+    // 溢写段文件只追加不修改，读取时无需持有群组锁。
+    if (need_disk)
+    {
+        uint64_t disk_before = page.empty() ? before_seq : page.front().seq;
+        auto older = MessageHistory::read_spilled(spill_dir, disk_before,
+                                                  n - page.size());
+        page.insert(page.begin(), std::make_move_iterator(older.begin()),
+                    std::make_move_iterator(older.end()));
+    }
+
+    if (page.empty())
+    {
+        return "群组 [" + group_name_raw + "] 没有更早的历史消息。\n";
+    }
+
+    std::string out = "群组 [" + group_name_raw + "] 历史消息 #" +
+                      std::to_string(page.front().seq) + " - #" +
+                      std::to_string(page.back().seq) + ":\n";
+    for (const HistoryEntry& e : page)
+    {
+        std::time_t tt = static_cast<std::time_t>(e.timestamp_ms / 1000);
+        char time_buf[16];
+        std::strftime(time_buf, sizeof(time_buf), "%H:%M:%S",
+                      std::localtime(&tt));
+
+        out += "#" + std::to_string(e.seq) + " [" + time_buf + "] ";
+        out += *e.frame;
+        if (out.back() != '\n')
+        {
+            out += '\n';
         }
-        return "";
     }
+
+    if (page.front().seq > 1)
+    {
+        out += "更早的消息: /history " + group_name_raw + " " +
+               std::to_string(page.front().seq) + "\n";
+    }
+    return out;
 }
 
 void GroupManager::remove_client_from_groups(const std::string& username_raw)
@@ -239,103 +677,103 @@ void GroupManager::remove_client_from_groups(const std::string& username_raw)
 }
 
 std::string GroupManager::handle_group_leave(const std::string& username_raw,
-                                             const std::vector<std::string>&
-                                             parts)
+                                             const CommandArgs& parts)
 {
     if (parts.size() < 2)
     {
         return "用法: /leave <群名>\n";
     }
 
-    const std::string& group_name_raw = parts[1];
+    std::string group_name_raw(parts[1]);
     std::string group_name = to_lower_nickname(group_name_raw);
     std::string username = to_lower_nickname(username_raw);
 
-    std::lock_guard<std::mutex> lock(mtx);
-    auto group_it = groups.find(group_name);
-
-    if (group_it == groups.end())
+    GroupEntryPtr entry = find_group(group_name);
+    if (!entry)
     {
         return "错误：群组 '" + group_name + "' 不存在。\n";
     }
 
-    Group& group = group_it->second;
-    auto member_it = group.members.find(username);
-
-    if (member_it == group.members.end())
-    {
-        return "错误：您不是群组 '" + group_name + "' 的成员。\n";
-    }
-
     bool group_will_be_deleted = false;
     std::string broadcast_msg;
     std::string return_msg;
-    std::unordered_set<std::string> members_to_notify = group.members;
+    std::vector<std::string> recipients;
 
-    if (group.owner_nickname == username)
     {
-        bool successfully_transferred = false;
-        if (group.members.size() > 1)
+        std::lock_guard<std::mutex> lock(entry->mtx);
+
+        if (entry->removed)
         {
-            std::string new_owner;
-            for (const auto& member : group.members)
+            return "错误：群组 '" + group_name + "' 不存在。\n";
+        }
+
+        if (!entry->state->members.count(username))
+        {
+            return "错误：您不是群组 '" + group_name + "' 的成员。\n";
+        }
+
+        std::unordered_set<std::string> members_to_notify = entry->state->members;
+        Group& group = edit(*entry);
+
+        if (group.owner_nickname == username)
+        {
+            bool successfully_transferred = false;
+            if (group.members.size() > 1)
             {
-                if (member != username)
+                std::string new_owner;
+                for (const auto& member : group.members)
                 {
-                    new_owner = member;
-                    break;
+                    if (member != username)
+                    {
+                        new_owner = member;
+                        break;
+                    }
                 }
-            }
-            if (!new_owner.empty())
-            {
-                group.owner_nickname = new_owner;
-                group.members.erase(member_it);
+                if (!new_owner.empty())
+                {
+                    group.owner_nickname = new_owner;
+                    group.members.erase(username);
 
-                broadcast_msg = "【系统】原群主 [" + username + "] 主动离开了群组 [" +
-                                group_name + "]";
-                broadcast_msg += "。群主已转让给 [" + new_owner + "]。\n";
-                // 添加句号、空格和换行符
+                    broadcast_msg = "【系统】原群主 [" + username + "] 主动离开了群组 [" +
+                                    group_name + "]";
+                    broadcast_msg += "。群主已转让给 [" + new_owner + "]。\n";
+                    // 添加句号、空格和换行符
 
-                return_msg = "您已成功退出群组 '" + group_name + "'，群主已转让给 [" +
-                             new_owner + "]。\n";
+                    return_msg = "您已成功退出群组 '" + group_name + "'，群主已转让给 [" +
+                                 new_owner + "]。\n";
 
-                successfully_transferred = true;
+                    successfully_transferred = true;
+                }
             }
-        }
 
-        if (!successfully_transferred)
-        {
-            broadcast_msg = "【系统】群主 [" + username + "] 离开了群组 [" + group_name_raw
-                            +
-                            "]。群组已解散。\n";
+            if (!successfully_transferred)
+            {
+                broadcast_msg = "【系统】群主 [" + username + "] 离开了群组 [" +
+                                group_name_raw + "]。群组已解散。\n";
 
-            groups.erase(group_it);
-            group_will_be_deleted = true;
+                remove_group(group_name, entry);
+                group_will_be_deleted = true;
 
-            return_msg = "您已成功退出群组 '" + group_name_raw + "'，群组已解散。\n";
+                return_msg = "您已成功退出群组 '" + group_name_raw + "'，群组已解散。\n";
+            }
         }
-    }
-    else
-    {
-        members_to_notify = group.members;
-
-        group.members.erase(member_it);
-        broadcast_msg = "【系统】成员 [" + username + "] 主动离开了群组 [" + group_name_raw +
-                        "]\n";
-        return_msg = "您已成功退出群组 [" + group_name_raw + "]\n";
-
-        if (group.members.empty())
+        else
         {
-            LOG_INFO("群组 [" + group_name + "] 所有成员已主动退出，群组解散。");
-            groups.erase(group_it);
-            return_msg += "由于您是最后一位成员，群组已解散。\n";
+            group.members.erase(username);
+            broadcast_msg = "【系统】成员 [" + username + "] 主动离开了群组 [" +
+                            group_name_raw + "]\n";
+            return_msg = "您已成功退出群组 [" + group_name_raw + "]\n";
+
+            if (group.members.empty())
+            {
+                LOG_INFO("群组 [" + group_name + "] 所有成员已主动退出，群组解散。");
+                remove_group(group_name, entry);
+                return_msg += "由于您是最后一位成员，群组已解散。\n";
 
-            group_will_be_deleted = true;
+                group_will_be_deleted = true;
+            }
         }
-    }
 
-    if (!broadcast_msg.empty())
-    {
         const std::unordered_set<std::string>& target_members =
             group_will_be_deleted ? members_to_notify : group.members;
 
@@ -345,15 +783,15 @@ std::string GroupManager::handle_group_leave(const std::string& username_raw,
             {
                 continue;
             }
-
-            int member_fd = ctx_ref.get_fd_by_nickname(member_name);
-            if (member_fd != -1)
-            {
-                message_sender(member_fd, broadcast_msg);
-            }
+            recipients.push_back(member_name);
         }
     }
 
+    if (!broadcast_msg.empty())
+    {
+        notify_members(recipients, broadcast_msg);
+    }
+
     if (group_will_be_deleted)
     {
         LOG_ERROR("Group [" +group_name+ "] 标记解散，解散操作已执行。");
@@ -363,102 +801,96 @@ std::string GroupManager::handle_group_leave(const std::string& username_raw,
 
 std::string GroupManager::handle_group_kick(
     const std::string& kicker_nickname_raw,
-    const std::vector<std::string>&
-    parts)
+    const CommandArgs& parts)
 {
     if (parts.size() < 3)
     {
         return "用法: /groupkick <群名> <昵称>。\n";
     }
 
-    const std::string& group_name_raw = parts[1];
+    std::string group_name_raw(parts[1]);
     std::string group_name = to_lower_nickname(group_name_raw);
     std::string kicker_nickname = to_lower_nickname(kicker_nickname_raw);
     std::string victim_nickname = to_lower_nickname(parts[2]);
 
-    std::lock_guard<std::mutex> lock(mtx);
-
-    auto group_it = groups.find(group_name);
-
-    if (group_it == groups.end())
+    GroupEntryPtr entry = find_group(group_name);
+    if (!entry)
     {
         return "错误：群组 '" + group_name + "' 不存在。\n";
     }
 
-    Group& group = group_it->second;
+    std::string broadcast_msg;
+    std::string return_msg;
+    std::vector<std::string> recipients;
 
-    if (group.owner_nickname != kicker_nickname)
     {
-        return "错误：您不是群组 '" + group_name_raw + "' 的群主，无权执行此操作。\n";
-    }
+        std::lock_guard<std::mutex> lock(entry->mtx);
+        const Group& current = *entry->state;
 
-    if (kicker_nickname == victim_nickname)
-    {
-        return "错误：群主不能踢自己。\n";
-    }
+        if (entry->removed)
+        {
+            return "错误：群组 '" + group_name + "' 不存在。\n";
+        }
 
-    auto member_it = group.members.find(victim_nickname);
-    if (member_it == group.members.end())
-    {
-        return "错误：用户 '" + victim_nickname + "' 不是群组 '" + group_name_raw +
-               "' 的成员。\n";
-    }
+        if (current.owner_nickname != kicker_nickname)
+        {
+            return "错误：您不是群组 '" + group_name_raw + "' 的群主，无权执行此操作。\n";
+        }
 
-    std::unordered_set<std::string> members_to_notify = group.members;
+        if (kicker_nickname == victim_nickname)
+        {
+            return "错误：群主不能踢自己。\n";
+        }
 
-    group.members.erase(member_it);
+        if (!current.members.count(victim_nickname))
+        {
+            return "错误：用户 '" + victim_nickname + "' 不是群组 '" + group_name_raw +
+                   "' 的成员。\n";
+        }
 
-    group.banned_members.insert(victim_nickname);
+        std::unordered_set<std::string> members_to_notify = current.members;
 
-    std::string broadcast_msg = "【系统】用户 [" + victim_nickname + "] 已被群主 [" +
-                                kicker_nickname + "] 踢出群组 [" + group_name_raw +
-                                "]\n";
-    std::string return_msg = "成功将用户 [" + victim_nickname + "] 踢出群组 [" +
-                             group_name_raw + "]\n";
+        Group& group = edit(*entry);
+        group.members.erase(victim_nickname);
 
-    bool group_was_deleted = false;
+        group.banned_members.insert(victim_nickname);
 
-    if (group.members.empty())
-    {
-        LOG_INFO("群组 [" + group_name + "] 被踢后已清空，群组解散。");
-        groups.erase(group_it);
-        return_msg += "由于该操作导致群组成员清空，群组已解散。\n";
-        group_was_deleted = true;
-    }
+        broadcast_msg = "【系统】用户 [" + victim_nickname + "] 已被群主 [" +
+                        kicker_nickname + "] 踢出群组 [" + group_name_raw +
+                        "]\n";
+        return_msg = "成功将用户 [" + victim_nickname + "] 踢出群组 [" +
+                     group_name_raw + "]\n";
 
-    if (!broadcast_msg.empty())
-    {
-        const std::unordered_set<std::string>& target_nickname =
-            group_was_deleted ? members_to_notify : group.members;
+        bool group_was_deleted = false;
 
-        if (!group_was_deleted)
+        if (group.members.empty())
         {
-            members_to_notify.insert(victim_nickname);
+            LOG_INFO("群组 [" + group_name + "] 被踢后已清空，群组解散。");
+            remove_group(group_name, entry);
+            return_msg += "由于该操作导致群组成员清空，群组已解散。\n";
+            group_was_deleted = true;
         }
 
+        const std::unordered_set<std::string>& target_nickname =
+            group_was_deleted ? members_to_notify : group.members;
+
         for (const auto& member_name : target_nickname)
         {
-            int member_fd = ctx_ref.get_fd_by_nickname(member_name);
-            if (member_fd != -1)
+            if (member_name != victim_nickname)
             {
-                message_sender(member_fd, broadcast_msg);
+                recipients.push_back(member_name);
             }
         }
-
-        int victim_fd = ctx_ref.get_fd_by_nickname(victim_nickname);
-        if (victim_fd != -1)
-        {
-            message_sender(victim_fd, broadcast_msg);
-        }
+        recipients.push_back(victim_nickname);
     }
 
+    notify_members(recipients, broadcast_msg);
+
     return return_msg;
 }
 
 void GroupManager::load_groups_from_file(const std::string& filename)
 {
-    std::lock_guard<std::mutex> lock(mtx);
-
     std::ifstream i(filename.c_str());
 
     if (!i.is_open())
@@ -473,11 +905,20 @@ void GroupManager::load_groups_from_file(const std::string& filename)
         i >> root_json;
         i.close();
 
-        groups = root_json.at("groups").get<std::unordered_map<
+        auto loaded = root_json.at("groups").get<std::unordered_map<
             std::string, Group>>();
 
+        groups.clear();
+        for (auto& pair : loaded)
+        {
+            auto entry = std::make_shared<GroupEntry>();
+            entry->state = std::make_shared<Group>(std::move(pair.second));
+            bool inserted = false;
+            groups.insert(pair.first, std::move(entry), inserted);
+        }
+
         std::stringstream log_ss;
-        log_ss << "成功从文件加载 " << groups.size() << " 个群组数据。";
+        log_ss << "成功从文件加载 " << loaded.size() << " 个群组数据。";
         LOG_INFO(log_ss.str());
     }
     catch (const json::exception& e)
@@ -497,11 +938,13 @@ void GroupManager::load_groups_from_file(const std::string& filename)
 
 void GroupManager::save_groups_to_file(const std::string& filename) const
 {
-    std::lock_guard<std::mutex> lock(mtx);
-
     json root_json;
 
-    root_json["groups"] = groups;
+    root_json["groups"] = json::object();
+    for (const Group& group : materialize_all())
+    {
+        root_json["groups"][group.name] = group;
+    }
 
     std::ofstream o(filename.c_str());
 
@@ -526,41 +969,245 @@ void GroupManager::save_groups_to_file(const std::string& filename) const
     }
 }
 
+void GroupManager::load_groups(const std::string& snapshot_filename,
+                               const std::string& json_filename)
+{
+    std::unique_ptr<GroupSnapshot> loaded = GroupSnapshot::open(snapshot_filename);
+
+    if (!loaded)
+    {
+        std::ifstream probe(json_filename);
+        if (!probe.is_open())
+        {
+            LOG_WARNING("未找到群组快照或 JSON 数据文件，以空群组列表启动。");
+            return;
+        }
+        probe.close();
+
+        LOG_INFO("快照不可用，从 JSON 文件转换: " + json_filename);
+        if (convert_groups_json_to_snapshot(json_filename, snapshot_filename) < 0)
+        {
+            LOG_ERROR("快照转换失败，回退到 JSON 全量加载。");
+            load_groups_from_file(json_filename);
+            return;
+        }
+        loaded = GroupSnapshot::open(snapshot_filename);
+    }
+
+    std::lock_guard<std::mutex> lock(snapshot_mtx);
+    groups.clear();
+    snapshot_tombstones.clear();
+    snapshot = std::move(loaded);
+}
+
+GroupManager::GroupStateView GroupManager::capture_view() const
+{
+    GroupStateView view;
+    std::vector<std::pair<std::string, GroupEntryPtr>> entries;
+
+    // 持有 snapshot_mtx 时快照群组不会被懒加载或解散，
+    // 因此 entries 与 raw_indices 不会重复也不会遗漏。
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mtx);
+        entries = groups.entries();
+        view.base = snapshot;
+
+        if (snapshot)
+        {
+            for (size_t i = 0; i < snapshot->size(); ++i)
+            {
+                std::string name(snapshot->name_at(i));
+                if (name.empty() || groups.contains(name) ||
+                    snapshot_tombstones.count(name))
+                {
+                    continue;
+                }
+                view.raw_indices.push_back(i);
+            }
+        }
+    }
+
+    // 每个群组只在拷贝 shared_ptr 的瞬间持锁。
+    view.groups.reserve(entries.size());
+    for (const auto& pair : entries)
+    {
+        std::lock_guard<std::mutex> lock(pair.second->mtx);
+        if (!pair.second->removed)
+        {
+            view.groups.push_back(pair.second->state);
+        }
+    }
+    return view;
+}
+
+bool GroupManager::write_view(const GroupStateView& view,
+                              const std::string& filename)
+{
+    GroupSnapshotWriter writer;
+
+    for (const auto& group : view.groups)
+    {
+        writer.add(*group);
+    }
+
+    // 未被访问过的群组直接拷贝原始记录，无需解码再编码。
+    for (size_t i : view.raw_indices)
+    {
+        if (!view.base->verify(i))
+        {
+            LOG_ERROR("群组快照记录 #" << i << " 已损坏，保存时丢弃。");
+            continue;
+        }
+        writer.add_raw(view.base->name_at(i), view.base->raw_record(i));
+    }
+
+    return writer.commit(filename);
+}
+
+bool GroupManager::save_snapshot(const std::string& filename) const
+{
+    // 没有后台线程时 /snapshot 在线程池中调用，多次请求不能同时写同一个文件。
+    std::lock_guard<std::mutex> lock(snapshot_write_mtx);
+    return write_view(capture_view(), filename);
+}
+
+void GroupManager::start_background_snapshots(const std::string& filename,
+                                              std::chrono::seconds interval)
+{
+    std::lock_guard<std::mutex> lock(snapshot_thread_mtx);
+    if (snapshot_thread.joinable())
+    {
+        return;
+    }
+
+    snapshot_filename = filename;
+    snapshot_interval = interval;
+    snapshot_stop = false;
+    snapshot_thread = std::thread(&GroupManager::snapshot_loop, this);
+
+    LOG_INFO("后台群组快照已启动，间隔 " << interval.count() << " 秒。");
+}
+
+bool GroupManager::request_snapshot()
+{
+    {
+        std::lock_guard<std::mutex> lock(snapshot_thread_mtx);
+        if (!snapshot_thread.joinable())
+        {
+            return false;
+        }
+        snapshot_requested = true;
+    }
+    snapshot_cv.notify_one();
+    return true;
+}
+
+void GroupManager::stop_background_snapshots()
+{
+    {
+        std::lock_guard<std::mutex> lock(snapshot_thread_mtx);
+        snapshot_stop = true;
+    }
+    snapshot_cv.notify_one();
+
+    if (snapshot_thread.joinable())
+    {
+        snapshot_thread.join();
+    }
+}
+
+void GroupManager::snapshot_loop()
+{
+    uint64_t saved_epoch = mutation_epoch.load();
+
+    while (true)
+    {
+        bool forced = false;
+        {
+            std::unique_lock<std::mutex> lock(snapshot_thread_mtx);
+            snapshot_cv.wait_for(lock, snapshot_interval, [this]()
+            {
+                return snapshot_stop || snapshot_requested;
+            });
+
+            if (snapshot_stop)
+            {
+                return;
+            }
+            forced = snapshot_requested;
+            snapshot_requested = false;
+        }
+
+        uint64_t epoch = mutation_epoch.load();
+        if (!forced && epoch == saved_epoch)
+        {
+            continue;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        GroupStateView view = capture_view();
+        auto captured = std::chrono::steady_clock::now();
+
+        if (write_view(view, snapshot_filename))
+        {
+            saved_epoch = epoch;
+            LOG_INFO("后台快照完成: " << view.groups.size() + view.raw_indices.size()
+                     << " 个群组，采集 "
+                     << std::chrono::duration_cast<std::chrono::microseconds>(
+                         captured - start).count()
+                     << "us，写入 "
+                     << std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now() - captured).count()
+                     << "ms");
+        }
+    }
+}
+
 std::string GroupManager::handle_group_unban(
     const std::string& kicker_nickname_raw,
-    const std::vector<std::string>& parts)
+    const CommandArgs& parts)
 {
     if (parts.size() < 3)
     {
         return "用法: /groupunban <群名> <昵称>。\n";
     }
 
-    const std::string& group_name_raw = parts[1];
+    std::string group_name_raw(parts[1]);
     std::string group_name = to_lower_nickname(group_name_raw);
     std::string kicker_nickname = to_lower_nickname(kicker_nickname_raw);
     std::string target_nickname = to_lower_nickname(parts[2]);
 
-    std::lock_guard<std::mutex> lock(mtx);
-
-    auto group_it = groups.find(group_name);
-    if (group_it == groups.end())
+    GroupEntryPtr entry = find_group(group_name);
+    if (!entry)
     {
         return "错误：群组 '" + group_name_raw + "' 不存在。\n";
     }
 
-    Group& group = group_it->second;
-
-    if (group.owner_nickname != kicker_nickname)
+    std::vector<std::string> recipients;
     {
-        return "错误：您不是群组 '" + group_name_raw + "' 的群主，无权执行此操作。\n";
-    }
+        std::lock_guard<std::mutex> lock(entry->mtx);
+        const Group& current = *entry->state;
 
-    size_t removed_count = group.banned_members.erase(target_nickname);
+        if (entry->removed)
+        {
+            return "错误：群组 '" + group_name_raw + "' 不存在。\n";
+        }
 
-    if (removed_count == 0)
-    {
-        return "错误：用户 '" + target_nickname + "' 不在群组 '" + group_name_raw +
-               "' 的禁止（黑）名单中。\n";
+        if (current.owner_nickname != kicker_nickname)
+        {
+            return "错误：您不是群组 '" + group_name_raw + "' 的群主，无权执行此操作。\n";
+        }
+
+        if (!current.banned_members.count(target_nickname))
+        {
+            return "错误：用户 '" + target_nickname + "' 不在群组 '" + group_name_raw +
+                   "' 的禁止（黑）名单中。\n";
+        }
+
+        Group& group = edit(*entry);
+        group.banned_members.erase(target_nickname);
+
+        recipients.assign(group.members.begin(), group.members.end());
     }
 
     std::string broadcast_msg = "【系统】用户 [" + target_nickname + "] 已被群主 [" +
@@ -568,14 +1215,7 @@ std::string GroupManager::handle_group_unban(
                                 group_name_raw +
                                 "] 的加入限制。\n";
 
-    for (const auto& member_name : group.members)
-    {
-        int member_fd = ctx_ref.get_fd_by_nickname(member_name);
-        if (member_fd != -1)
-        {
-            message_sender(member_fd, broadcast_msg);
-        }
-    }
+    notify_members(recipients, broadcast_msg);
 
     return "成功将用户 [" + target_nickname + "] 从群组 [" + group_name_raw +
            "] 的限制中解除。他们现在可以重新加入。\n";
@@ -583,47 +1223,56 @@ std::string GroupManager::handle_group_unban(
 
 std::string GroupManager::handle_group_transfer(
     const std::string& kicker_nickname_raw,
-    const std::vector<std::string>& parts)
+    const CommandArgs& parts)
 {
     if (parts.size() < 3)
     {
         return "用法: /transfer <群名> <昵称>\n";
     }
 
-    const std::string& group_name_raw = parts[1];
-    std::string target_nickname_raw = parts[2];
+    std::string group_name_raw(parts[1]);
+    std::string target_nickname_raw(parts[2]);
 
     std::string group_name = to_lower_nickname(group_name_raw);
     std::string kicker_nickname = to_lower_nickname(kicker_nickname_raw);
     std::string target_nickname = to_lower_nickname(target_nickname_raw);
 
-    std::lock_guard<std::mutex> lock(mtx);
-
-    auto group_it = groups.find(group_name);
-    if (group_it == groups.end())
+    GroupEntryPtr entry = find_group(group_name);
+    if (!entry)
     {
         return "错误：群组 '" + group_name_raw + "' 不存在。\n";
     }
 
-    Group& group = group_it->second;
-
-    if (group.owner_nickname != kicker_nickname)
+    std::vector<std::string> recipients;
     {
-        return "错误：您不是群组 '" + group_name_raw + "' 的群主，无权转让所有权。\n";
-    }
+        std::lock_guard<std::mutex> lock(entry->mtx);
+        const Group& current = *entry->state;
 
-    if (kicker_nickname == target_nickname)
-    {
-        return "错误：您已经是群主了，无需转让给自己。\n";
-    }
+        if (entry->removed)
+        {
+            return "错误：群组 '" + group_name_raw + "' 不存在。\n";
+        }
 
-    if (group.members.find(target_nickname) == group.members.end())
-    {
-        return "错误：用户 '" + target_nickname_raw + "' 不是群组 '" + group_name_raw +
-               "' 的成员。\n";
-    }
+        if (current.owner_nickname != kicker_nickname)
+        {
+            return "错误：您不是群组 '" + group_name_raw + "' 的群主，无权转让所有权。\n";
+        }
 
-    group.owner_nickname = target_nickname;
+        if (kicker_nickname == target_nickname)
+        {
+            return "错误：您已经是群主了，无需转让给自己。\n";
+        }
+
+        if (current.members.find(target_nickname) == current.members.end())
+        {
+            return "错误：用户 '" + target_nickname_raw + "' 不是群组 '" + group_name_raw +
+                   "' 的成员。\n";
+        }
+
+        Group& group = edit(*entry);
+        group.owner_nickname = target_nickname;
+        recipients.assign(group.members.begin(), group.members.end());
+    }
 
     std::string broadcast_msg = "【系统】群主 [" + kicker_nickname_raw + "] 已将群组 [" +
                                 group_name_raw + "] 的所有权转让给了 [" +
@@ -632,15 +1281,7 @@ std::string GroupManager::handle_group_transfer(
         "群主 [" + kicker_nickname + "] 成功将群组 [" + group_name + "] 的所有权转让给 [" +
         target_nickname + "]");
 
-    for (const auto& member_name_lower:group.members)
-    {
-        int member_fd=ctx_ref.get_fd_by_nickname(member_name_lower);
-
-        if (member_fd!=-1)
-        {
-            message_sender(member_fd,broadcast_msg);
-        }
-    }
+    notify_members(recipients, broadcast_msg);
 
     return "成功将群组 '" + group_name_raw + "' 的所有权转让给了 [" + target_nickname_raw +
            "]。\n";
@@ -0,0 +1,25 @@
+//
+// Created by X on 2025/11/20.
+//
+// 将旧版 groups_data.json 转换为二进制快照 groups_data.snap。
+// 用法: ./groups_convert [json文件] [快照文件]
+//
+#include <iostream>
+#include <string>
+#include "../include/GroupSnapshot.h"
+
+int main(int argc, char* argv[])
+{
+    std::string json_file = argc > 1 ? argv[1] : "groups_data.json";
+    std::string snapshot_file = argc > 2 ? argv[2] : "groups_data.snap";
+
+    long count = convert_groups_json_to_snapshot(json_file, snapshot_file);
+    if (count < 0)
+    {
+        std::cerr << "转换失败: " << json_file << " -> " << snapshot_file << std::endl;
+        return 1;
+    }
+
+    std::cout << "转换完成: " << count << " 个群组已写入 " << snapshot_file << std::endl;
+    return 0;
+}
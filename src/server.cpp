@@ -4,6 +4,8 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <array>
+#include <cstring>
 #include <atomic>
 #include <cerrno>
 #include <chrono>
@@ -11,30 +13,50 @@
 #include <functional>
 #include <iostream>
 #include <sstream>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 #include <stdexcept>
 #include "../include/Logger.h"
+#include "../include/BinaryProtocol.h"
+#include "../include/CommandParser.h"
+#include "../include/ConnectionIO.h"
+#include "../include/WebSocket.h"
+#include "../include/ResumeToken.h"
+#include "../include/TlsContext.h"
+#include "../include/FrameCompressor.h"
+#include "../include/RequestContext.h"
 #include "../include/ServerContext.h"
+#include "../include/Session.h"
 #include "../include/client.h"
 #include "../include/group_manager.h"
 #include "../include/threadpool.h"
 #include "../include/LuaManager.h"
+#include "../include/MessagePipeline.h"
+#include "../include/TimerWheel.h"
 #include "../include/UserManager.h"
 #include "../include/config.h"
 #include "../include/DatabaseManager.h"
 
 constexpr int MAX_EVENTS = 1024;
 constexpr int PORT = 5008;
+constexpr int DEFAULT_WS_PORT = 5009;
+constexpr int DEFAULT_TLS_PORT = 5443;
+constexpr int DEFAULT_WSS_PORT = 5444;
 constexpr int BUF_SIZE = 1024;
 constexpr int HEARTBEAT_TIMEOUT = 300; // 心跳超时
 constexpr int EPOLL_TIMEOUT_MS = 1000;
+constexpr uint32_t MAX_PIPELINED_REQUESTS = 256; // 每个连接同时在执行的带 ID 请求上限
+constexpr size_t MAX_BATCH_MESSAGES = 1024;       // 单个批量帧最多包含的消息数
 
 std::atomic<bool> running = true;
 
+// 内置命令处理函数，参数是指向接收缓冲区的视图，按 CommandId 下标存放。
 using ServerCommandHandler =
-std::function<std::string(const std::vector<std::string>&, int)>;
+std::string (*)(ServerContext&, const CommandArgs&, int);
+using CommandHandlers =
+std::array<ServerCommandHandler, static_cast<size_t>(CommandId::Count)>;
 
 void safe_print(const std::string& msg)
 {
@@ -49,44 +71,260 @@ void set_nonblocking(int fd)
     fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
-void send_message_with_length(int fd, const std::string& message)
+// 写出帧头：长度前缀，或 WebSocket 连接的 WebSocket 帧头。
+// WebSocket 握手尚未完成时返回 0，该帧应丢弃。
+size_t encode_frame_header(const ConnectionIO& io, size_t payload_size, char* out)
 {
-    uint32_t net_len = htonl(message.size());
+    if (io.transport() == Transport::WebSocket)
+    {
+        if (!io.ws_open)
+        {
+            return 0;
+        }
+        return encode_ws_header(io.ws_binary ? WsOpcode::Binary : WsOpcode::Text,
+                                payload_size, out);
+    }
+
+    uint32_t net_len = htonl(payload_size);
+    std::memcpy(out, &net_len, sizeof(net_len));
+    return sizeof(net_len);
+}
+
+// 批量帧执行期间，本线程产生的所有发送按接收方暂存，批次结束时每个连接只写一次。
+// 广播的帧以共享指针暂存，不为每个接收方拷贝。
+class DeliveryBatch
+{
+public:
+    DeliveryBatch() : previous_(current_)
+    {
+        current_ = this;
+    }
+
+    ~DeliveryBatch()
+    {
+        current_ = previous_;
+        flush();
+    }
+
+    DeliveryBatch(const DeliveryBatch&) = delete;
+    DeliveryBatch& operator=(const DeliveryBatch&) = delete;
+
+    static DeliveryBatch* current() { return current_; }
+
+    void add(int fd, SharedFrame frame)
+    {
+        auto it = index_.find(fd);
+        if (it == index_.end())
+        {
+            // 连接在首次投递时确定，批次结束前 fd 被复用也不会写到新连接上。
+            it = index_.emplace(fd, pending_.size()).first;
+            pending_.push_back({fd, SessionTable::getInstance().io(fd), {}});
+        }
+        pending_[it->second].frames.push_back(std::move(frame));
+    }
+
+    // 控制台输出也合并成一次。
+    void print(const std::string& line) { console_ += line; }
+
+private:
+    void flush()
+    {
+        std::string headers;
+        std::vector<std::string_view> parts;
+        for (const Recipient& recipient : pending_)
+        {
+            const std::shared_ptr<ConnectionIO>& io = recipient.io;
+            if (!io)
+            {
+                continue;
+            }
+
+            // 先预留好空间，之后取出的帧头视图不会因扩容失效。
+            headers.clear();
+            headers.reserve(recipient.frames.size() * WS_MAX_HEADER_SIZE);
+            parts.clear();
+            for (const SharedFrame& frame : recipient.frames)
+            {
+                char header[WS_MAX_HEADER_SIZE];
+                size_t header_size = encode_frame_header(*io, frame->size(), header);
+                if (header_size == 0)
+                {
+                    continue;
+                }
+                parts.emplace_back(headers.data() + headers.size(), header_size);
+                headers.append(header, header_size);
+                parts.emplace_back(*frame);
+            }
+            if (!parts.empty())
+            {
+                io->write(recipient.fd, parts.data(), parts.size());
+            }
+        }
+
+        if (!console_.empty())
+        {
+            safe_print(console_);
+        }
+    }
+
+    struct Recipient
+    {
+        int fd;
+        std::shared_ptr<ConnectionIO> io;
+        std::vector<SharedFrame> frames;
+    };
+
+    static thread_local DeliveryBatch* current_;
+
+    DeliveryBatch* previous_;
+    std::vector<Recipient> pending_;
+    std::unordered_map<int, size_t> index_;
+    std::string console_;
+};
+
+thread_local DeliveryBatch* DeliveryBatch::current_ = nullptr;
+
+// 加上帧头原样写出，不关心协议。socket 写满时由连接的输出缓冲区排队。
+void write_frame(int fd, const SharedFrame& frame)
+{
+    if (DeliveryBatch* batch = DeliveryBatch::current())
+    {
+        batch->add(fd, frame);
+        return;
+    }
+
+    std::shared_ptr<ConnectionIO> io = SessionTable::getInstance().io(fd);
+    if (!io)
+    {
+        return;
+    }
+
+    char header[WS_MAX_HEADER_SIZE];
+    size_t header_size = encode_frame_header(*io, frame->size(), header);
+    if (header_size != 0)
+    {
+        io->write(fd, std::string_view(header, header_size), *frame);
+    }
+}
+
+void write_frame(int fd, std::string_view message)
+{
+    if (DeliveryBatch* batch = DeliveryBatch::current())
+    {
+        batch->add(fd, std::make_shared<const std::string>(message));
+        return;
+    }
 
-    std::string full_msg(reinterpret_cast<const char*>(&net_len),
-                         sizeof(net_len));
-    full_msg += message;
+    std::shared_ptr<ConnectionIO> io = SessionTable::getInstance().io(fd);
+    if (!io)
+    {
+        return;
+    }
+
+    char header[WS_MAX_HEADER_SIZE];
+    size_t header_size = encode_frame_header(*io, message.size(), header);
+    if (header_size != 0)
+    {
+        io->write(fd, std::string_view(header, header_size), message);
+    }
+}
+
+// 聊天内容回显到服务器控制台，批量帧中的多行合并输出。
+void print_chat_line(const std::string& line)
+{
+    if (DeliveryBatch* batch = DeliveryBatch::current())
+    {
+        batch->print(line);
+        return;
+    }
+    safe_print(line);
+}
+
+// 当前线程正在为 fd 处理带 ID 的请求时返回该请求，其回复需要带上 ID。
+const RequestTag* reply_tag_for(int fd)
+{
+    const RequestTag& tag = current_request();
+    return tag.tagged && tag.fd == fd ? &tag : nullptr;
+}
 
-    const char* data = full_msg.data();
-    size_t total_len = full_msg.size();
-    size_t bytes_sent = 0;
+// 文本回复发给二进制会话时包装成 TEXT 帧，协商了压缩时大帧再压缩。
+void send_message_with_length(int fd, std::string_view message)
+{
+    Session session = SessionTable::getInstance().get(fd);
+    const RequestTag* tag = reply_tag_for(fd);
+    if (tag && tag->connection_id != session.connection_id)
+    {
+        // 发起请求的连接已经关闭，fd 已被新连接复用。
+        return;
+    }
 
-    while (bytes_sent < total_len)
+    if (session.protocol != ProtocolMode::Binary)
     {
-        ssize_t s = send(fd, data + bytes_sent, total_len - bytes_sent, 0);
-        if (s == -1)
+        if (!tag)
         {
-            perror("send failed");
+            write_frame(fd, message);
             return;
         }
-        if (s == 0)
+        std::string tagged = "@" + std::to_string(tag->id) + " ";
+        tagged.append(message);
+        write_frame(fd, tagged);
+        return;
+    }
+
+    std::string frame = encode_text_frame(message);
+    if (tag)
+    {
+        frame = encode_tagged(tag->id, frame);
+    }
+    if (session.compression)
+    {
+        if (SharedFrame compressed = FrameCompressor::getInstance().compress(frame))
         {
-            safe_print("WARNING: 客户端 fd=" + std::to_string(fd) +
-                       " 断开连接。\n");
+            write_frame(fd, compressed);
             return;
         }
-        bytes_sent += s;
+    }
+    write_frame(fd, frame);
+}
+
+// ACK/ERROR 等针对请求的二进制回复。
+void send_binary_reply(int fd, const std::string& frame)
+{
+    const RequestTag* tag = reply_tag_for(fd);
+    if (!tag)
+    {
+        write_frame(fd, frame);
+        return;
+    }
+    if (SessionTable::getInstance().get(fd).connection_id == tag->connection_id)
+    {
+        write_frame(fd, encode_tagged(tag->id, frame));
+    }
+}
+
+void send_outbound(int fd, const OutboundMessage& msg)
+{
+    Session session = SessionTable::getInstance().get(fd);
+    const SharedFrame* frame = &msg.text;
+    if (session.protocol == ProtocolMode::Binary)
+    {
+        // 广播时同一条消息只压缩一次，结果缓存在 msg 中。
+        frame = session.compression ? &msg.compressed_binary() : &msg.binary;
+    }
+    if (*frame)
+    {
+        write_frame(fd, *frame);
     }
 }
 
 void disconnect_client(int fd, ServerContext& ctx)
 {
     std::string name = ctx.get_username(fd);
-    std::string quit_msg = name + " 退出聊天室";
 
     if (!name.empty())
     {
-        safe_print(quit_msg + "\n");
+        OutboundMessage quit_msg = make_presence_message(name, false);
+        safe_print(*quit_msg.text + "\n");
         ctx.broadcast(quit_msg, fd);
     }
 
@@ -98,46 +336,259 @@ void disconnect_client(int fd, ServerContext& ctx)
     }
 }
 
-std::vector<std::string> split(const std::string& s)
+void sigint_hadler(int) { running = false; }
+
+ProtocolError send_whisper(ServerContext& ctx, const std::string& sender_nickname,
+                           const std::string& target_nickname,
+                           const std::string& text)
 {
-    std::vector<std::string> tokens;
-    std::istringstream iss(s);
-    std::string token;
-    while (iss >> token)
+    if (target_nickname == sender_nickname)
+    {
+        return ProtocolError::InvalidArgument;
+    }
+
+    int target_fd = ctx.get_fd_by_nickname(target_nickname);
+    if (target_fd == -1)
     {
-        tokens.push_back(token);
+        return ProtocolError::UserOffline;
     }
-    return tokens;
+
+    send_outbound(target_fd, make_whisper_message(sender_nickname, text));
+    return ProtocolError::None;
 }
 
-void sigint_hadler(int) { running = false; }
+// 登录或恢复成功后签发新的会话令牌，之前的令牌随之作废。
+void send_resume_token(int fd, const std::string& username)
+{
+    // 只发给协商了 CAP_RESUME 的连接，旧客户端不会收到无法识别的消息。
+    Session session = SessionTable::getInstance().get(fd);
+    if (!(session.capabilities & CAP_RESUME))
+    {
+        return;
+    }
+
+    ResumeTokenManager& tokens = ResumeTokenManager::getInstance();
+    std::string token = tokens.issue(username);
+    if (token.empty())
+    {
+        return;
+    }
 
-void handle_message(
-    int fd, const std::string& msg, ServerContext& ctx,
-    const std::unordered_map<std::string, ServerCommandHandler>& admin_commands,
-    const std::unordered_map<std::string, ServerCommandHandler>& user_commands)
+    uint64_t ttl = static_cast<uint64_t>(tokens.ttl().count());
+    if (session.protocol == ProtocolMode::Binary)
+    {
+        send_binary_reply(fd, encode_resume_token(token, ttl));
+    }
+    else
+    {
+        send_message_with_length(fd, "RESUME_TOKEN " + token + " " + std::to_string(ttl));
+    }
+}
+
+// 公共聊天消息。脚本注册了 on_message 钩子时先进入流水线，由事件循环批量过滤后再投递。
+void publish_chat_message(int fd, const std::string& nickname, std::string_view text,
+                          bool echo, ServerContext& ctx)
 {
-    std::string nickname = ctx.get_username(fd);
+    if (LuaManager::getInstance().has_hook(PipelineEventType::Message))
+    {
+        PipelineEvent event;
+        event.type = PipelineEventType::Message;
+        event.fd = fd;
+        event.from = nickname;
+        event.text = std::string(text);
+        event.echo = echo;
+        MessagePipeline::getInstance().submit(std::move(event));
+        return;
+    }
+
+    OutboundMessage out = make_chat_message(nickname, std::string(text));
+    if (echo)
+    {
+        print_chat_line(*out.text + "\n");
+    }
+    ctx.broadcast(out, fd);
+}
+
+// 群消息。经过 on_group_send 钩子时成员资格在提交前检查，错误仍然立即回复。
+ProtocolError publish_group_message(int fd, const std::string& nickname,
+                                    const std::string& group, std::string_view text,
+                                    ServerContext& ctx)
+{
+    if (!LuaManager::getInstance().has_hook(PipelineEventType::GroupSend))
+    {
+        return ctx.group_manager->send_group_message(nickname, group, std::string(text));
+    }
+
+    ProtocolError err = ctx.group_manager->check_member(nickname, group);
+    if (err != ProtocolError::None)
+    {
+        return err;
+    }
+
+    PipelineEvent event;
+    event.type = PipelineEventType::GroupSend;
+    event.fd = fd;
+    event.from = nickname;
+    event.group = group;
+    event.text = std::string(text);
+    MessagePipeline::getInstance().submit(std::move(event));
+    return ProtocolError::None;
+}
+
+// 登录与恢复会话后通知 on_join 钩子。
+void publish_join(int fd, const std::string& username)
+{
+    if (LuaManager::getInstance().has_hook(PipelineEventType::Join))
+    {
+        PipelineEvent event;
+        event.type = PipelineEventType::Join;
+        event.fd = fd;
+        event.from = username;
+        MessagePipeline::getInstance().submit(std::move(event));
+    }
+}
+
+// 事件循环在流水线的 eventfd 可读时调用：本拍积压的事件一次交给钩子，再按判定投递。
+void run_message_pipeline(ServerContext& ctx)
+{
+    std::vector<PipelineEvent> events = MessagePipeline::getInstance().take();
+    if (events.empty())
+    {
+        return;
+    }
+
+    LuaManager::getInstance().run_hooks(events);
+
+    DeliveryBatch batch;
+    for (const PipelineEvent& event : events)
+    {
+        if (event.dropped)
+        {
+            continue;
+        }
+        switch (event.type)
+        {
+        case PipelineEventType::Message:
+        {
+            OutboundMessage out = make_chat_message(event.from, event.text);
+            if (event.echo)
+            {
+                print_chat_line(*out.text + "\n");
+            }
+            ctx.broadcast(out, event.fd);
+            break;
+        }
+        case PipelineEventType::GroupSend:
+            ctx.group_manager->send_group_message(event.from, event.group, event.text);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// /resume <令牌>：用登录时下发的令牌恢复会话，不做 Argon2 校验。
+// 管理员身份以数据库为准，令牌中不携带权限。
+// 群组成员关系是持久数据，不随断线清除，恢复昵称后自然生效。
+void resume_session(int fd, const CommandArgs& args, ServerContext& ctx)
+{
+    ResumeClaims claims;
+    if (args.size() < 2 || !ResumeTokenManager::getInstance().redeem(args[1], claims))
+    {
+        send_message_with_length(fd, "恢复会话失败: 令牌无效或已过期，请使用 /login 登录。");
+        return;
+    }
+
+    std::string db_username_raw;
+    std::string db_argon2_hash;
+    bool is_admin = false;
+    if (!ctx.db_manager.get_user_data(UserManager::to_lower_nickname(claims.username),
+                                      db_username_raw, db_argon2_hash, is_admin))
+    {
+        // 账号已被删除 (或数据库不可用)，不能凭令牌登录。
+        send_message_with_length(fd, "恢复会话失败: 账号不存在，请使用 /login 登录。");
+        return;
+    }
+
+    // 断线重连时旧连接往往还没被心跳回收，令牌已证明身份，直接接管旧连接。
+    // 先清掉旧连接的昵称，断开时不再广播下线，新连接也不再广播上线。
+    int old_fd = ctx.get_fd_by_nickname(claims.username);
+    bool takeover = old_fd != -1 && old_fd != fd;
+    if (takeover)
+    {
+        {
+            std::lock_guard<std::mutex> lock(ctx.clients_mtx);
+            auto it = ctx.clients.find(old_fd);
+            if (it != ctx.clients.end())
+            {
+                it->second.nickname.clear();
+                it->second.is_admin = false;
+            }
+        }
+        send_message_with_length(old_fd, "您的会话已在新的连接上恢复。");
+        disconnect_client(old_fd, ctx);
+    }
+
+    ctx.set_username(fd, claims.username);
+    {
+        std::lock_guard<std::mutex> lock(ctx.clients_mtx);
+        auto it = ctx.clients.find(fd);
+        if (it != ctx.clients.end())
+        {
+            it->second.is_admin = is_admin;
+        }
+    }
+
+    std::string welcome_msg = "会话已恢复, 欢迎回来, " + claims.username;
+    if (is_admin)
+    {
+        welcome_msg += " (管理员)";
+    }
+    send_message_with_length(fd, welcome_msg);
+    send_resume_token(fd, claims.username);
+
+    if (!takeover)
+    {
+        ctx.broadcast(make_presence_message(claims.username, true), fd);
+    }
+    publish_join(fd, claims.username);
+}
+
+void handle_text_message(int fd, std::string_view msg, ServerContext& ctx,
+                         const CommandHandlers& handlers)
+{
+    std::string nickname;
     bool is_admin = false;
     {
         std::lock_guard<std::mutex> lock(ctx.clients_mtx);
-        if (ctx.clients.count(fd))
+        auto it = ctx.clients.find(fd);
+        if (it != ctx.clients.end())
         {
-            is_admin = ctx.clients.at(fd).is_admin;
+            nickname = it->second.nickname;
+            is_admin = it->second.is_admin;
         }
     }
 
-    std::string trimmed_msg = msg;
-    trimmed_msg.erase(0, trimmed_msg.find_first_not_of(" \t\n\r\f\v"));
-    trimmed_msg.erase(trimmed_msg.find_last_not_of(" \t\n\r\f\v") + 1);
+    CommandArgs args;
+    args.tokenize(msg);
+    if (args.empty() && !nickname.empty())
+    {
+        return;
+    }
 
-    safe_print("handle_message: fd=" + std::to_string(fd) + ", nickname=" +
-               nickname + ", is_admin=" + std::to_string(is_admin) +
-               ", msg=" + trimmed_msg + "\n");
+    LOG_DEBUG("handle_message: fd=" << fd << ", nickname=" << nickname
+              << ", is_admin=" << is_admin << ", msg=" << args.line());
 
     if (nickname.empty())
     {
-        std::vector<std::string> args = split(trimmed_msg);
+        const CommandSpec* spec = args.empty() ? nullptr : find_command_icase(args[0]);
+        CommandId command = spec ? spec->id : CommandId::Count;
+
+        if (command == CommandId::Resume)
+        {
+            resume_session(fd, args, ctx);
+            return;
+        }
 
         if (args.size() < 3)
         {
@@ -146,23 +597,16 @@ void handle_message(
             return;
         }
 
-        std::string command = args[0];
-
-        std::transform(command.begin(), command.end(), command.begin(),
-                       ::tolower);
-
-        const std::string& user_raw = args[1];
-        const std::string& pass = args[2];
+        std::string user_raw(args[1]);
+        std::string pass(args[2]);
 
         std::string user_lower = ctx.user_manager->to_lower_nickname(user_raw);
 
         std::string db_username_raw;
         std::string db_argon2_hash;
         bool db_is_admin = false;
-        if (command == "/register")
+        if (command == CommandId::Register)
         {
-            User existing_user;
-
             if (ctx.db_manager.get_user_data(user_lower, db_username_raw,
                                              db_argon2_hash, db_is_admin))
             {
@@ -187,7 +631,7 @@ void handle_message(
                 send_message_with_length(fd, "注册失败: 数据库写入错误。");
             }
         }
-        else if (command == "/login")
+        else if (command == CommandId::Login)
         {
             if (!ctx.db_manager.get_user_data(user_lower, db_username_raw,
                                               db_argon2_hash, db_is_admin))
@@ -227,7 +671,9 @@ void handle_message(
                 }
 
                 send_message_with_length(fd, welcome_msg);
-                ctx.broadcast(db_username_raw + " 加入聊天室", fd);
+                send_resume_token(fd, db_username_raw);
+                ctx.broadcast(make_presence_message(db_username_raw, true), fd);
+                publish_join(fd, db_username_raw);
             }
             else
             {
@@ -241,144 +687,1019 @@ void handle_message(
         }
         return;
     }
-    if (trimmed_msg[0] == '/')
+    if (args.line()[0] == '/')
     {
-        std::vector<std::string> args = split(trimmed_msg);
-        std::string command = args[0];
+        std::string_view command = args[0];
 
         while (command.length() > 1 && command[0] == '/' && command[1] == '/')
         {
-            command.erase(0, 1);
+            command.remove_prefix(1);
         }
-        args[0] = command;
-
-        std::string reply_to_client;
-        bool command_executed = false;
+        args.set(0, command);
 
-        auto user_cmd_iter = user_commands.find(command);
-        if (user_cmd_iter != user_commands.end())
-        {
-            reply_to_client = user_cmd_iter->second(args, fd);
-            command_executed = true;
-        }
+        const CommandSpec* spec = find_command(command);
+        ServerCommandHandler handler =
+            spec ? handlers[static_cast<size_t>(spec->id)] : nullptr;
 
-        else
+        if (handler)
         {
-            auto admin_cmd_iter = admin_commands.find(command);
-            if (admin_cmd_iter != admin_commands.end())
+            std::string reply_to_client;
+            if (!spec->admin_only || is_admin)
             {
-                if (is_admin)
-                {
-                    reply_to_client = admin_cmd_iter->second(args, fd);
-                    command_executed = true;
-                }
-                else
-                {
-                    reply_to_client = "错误：'" + command + "' 命令需要管理员权限。";
-                    command_executed = true;
-                }
+                reply_to_client = handler(ctx, args, fd);
             }
-        }
-        safe_print("DEBUG: Client FD " + std::to_string(fd) +
-                   " (Nickname: " + nickname +
-                   ") C++ state is_admin=" + (is_admin ? "TRUE" : "FALSE") +
-                   "\n");
-
-        if (!command_executed)
-        {
-            safe_print(
-                "DEBUG: Command '" + command +
-                "' NOT found in C++ maps. Attempting Lua.\n");
-
-            if (LuaManager::getInstance().execute_command(
-                nickname, is_admin, trimmed_msg))
+            else
             {
-                safe_print(
-                    "客户端[" + nickname + "] 执行 Lua 命令: " + command + "\n");
-                command_executed = true;
+                reply_to_client = "错误：'" + std::string(command) + "' 命令需要管理员权限。";
             }
-        }
 
-        if (command_executed)
-        {
             if (!reply_to_client.empty())
             {
                 send_message_with_length(fd, reply_to_client);
             }
+            return;
+        }
+
+        LOG_DEBUG("Command '" << command << "' NOT found in C++ table. Attempting Lua.");
+
+        // 脚本在一条命令里发出的所有消息按接收方合并写出。
+        DeliveryBatch batch;
+        if (LuaManager::getInstance().execute_command(
+            fd, nickname, is_admin, args.line()))
+        {
+            safe_print(
+                "客户端[" + nickname + "] 执行 Lua 命令: " + std::string(command) + "\n");
         }
         else
         {
-            reply_to_client = "未知命令。";
-            send_message_with_length(fd, reply_to_client);
+            send_message_with_length(fd, "未知命令。");
         }
     }
     else
     {
-        std::stringstream ss;
-        ss << nickname << ": " << trimmed_msg;
-        std::string out = ss.str();
-        safe_print(out + "\n");
-        ctx.broadcast(out, fd);
+        publish_chat_message(fd, nickname, args.line(), true, ctx);
     }
 }
 
-int main()
-{
-    signal(SIGPIPE, SIG_IGN);
-    signal(SIGINT, sigint_hadler);
-
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd == -1)
-    {
-        perror("socket");
-        return -1;
-    }
+// 二进制帧只做一次顺序解码，字段以 string_view 引用帧缓冲区，不经过分词。
+void handle_binary_message(int fd, std::string_view msg, ServerContext& ctx,
+                           const CommandHandlers& handlers);
 
-    ThreadPool pool(4);
-
-    auto sender = [](int fd, const std::string& message)
+// BATCH: 先完整解析并校验所有子帧，任何一个不合法则整批拒绝；
+// 之后逐条处理，期间产生的投递按接收方合并。
+void handle_binary_batch(int fd, BinaryReader& reader, ServerContext& ctx,
+                         const CommandHandlers& handlers)
+{
+    auto reply_malformed = [fd]()
     {
-        send_message_with_length(fd, message);
+        send_binary_reply(fd, encode_error(Opcode::Batch, ProtocolError::MalformedFrame,
+                                           protocol_error_text(ProtocolError::MalformedFrame)));
     };
 
-    std::map<std::string, std::string> env_config = load_env();
+    uint64_t count = 0;
+    if (!reader.varint(count) || count == 0 || count > MAX_BATCH_MESSAGES)
+    {
+        reply_malformed();
+        return;
+    }
 
-    if (env_config.empty())
+    std::vector<std::string_view> frames;
+    frames.reserve(count);
+    for (uint64_t i = 0; i < count; ++i)
     {
-        LOG_FATAL("无法加载 .env 配置文件。服务器退出。");
-        return 1;
+        std::string_view frame;
+        if (!reader.str(frame) || frame.empty())
+        {
+            reply_malformed();
+            return;
+        }
+        // 子帧只能是普通请求，不能嵌套批量、请求 ID 或协商。
+        auto op = static_cast<Opcode>(frame[0]);
+        if (op == Opcode::Batch || op == Opcode::Tagged || frame[0] == BINARY_HELLO_MAGIC[0])
+        {
+            reply_malformed();
+            return;
+        }
+        frames.push_back(frame);
+    }
+    if (!reader.at_end())
+    {
+        reply_malformed();
+        return;
+    }
+
+    LOG_DEBUG("handle_binary_batch: fd=" << fd << ", count=" << count);
+
+    DeliveryBatch batch;
+    for (std::string_view frame : frames)
+    {
+        handle_binary_message(fd, frame, ctx, handlers);
+    }
+}
+
+void handle_binary_message(int fd, std::string_view msg, ServerContext& ctx,
+                           const CommandHandlers& handlers)
+{
+    BinaryReader reader(msg);
+    uint8_t raw_op = 0;
+    if (!reader.u8(raw_op))
+    {
+        return;
+    }
+    auto op = static_cast<Opcode>(raw_op);
+
+    auto reply_error = [fd, op](ProtocolError code)
+    {
+        send_binary_reply(fd, encode_error(op, code, protocol_error_text(code)));
+    };
+
+    if (op == Opcode::Batch)
+    {
+        handle_binary_batch(fd, reader, ctx, handlers);
+        return;
+    }
+
+    if (op == Opcode::Command)
+    {
+        std::string_view line;
+        if (!reader.str(line) || !reader.at_end() || line.empty())
+        {
+            reply_error(ProtocolError::MalformedFrame);
+            return;
+        }
+        handle_text_message(fd, line, ctx, handlers);
+        return;
+    }
+
+    std::string nickname = ctx.get_username(fd);
+
+    switch (op)
+    {
+    case Opcode::Chat:
+    case Opcode::Whisper:
+    case Opcode::GroupSend:
+        if (nickname.empty())
+        {
+            reply_error(ProtocolError::NotLoggedIn);
+            return;
+        }
+        break;
+    default:
+        // 协商只发生在第一帧，之后的 HELLO (以 NUL 开头) 同样按未知 opcode 处理。
+        reply_error(ProtocolError::UnknownOpcode);
+        return;
+    }
+
+    std::string_view first;
+    std::string_view text;
+    if (op == Opcode::Chat)
+    {
+        if (!reader.str(text) || !reader.at_end())
+        {
+            reply_error(ProtocolError::MalformedFrame);
+            return;
+        }
+        publish_chat_message(fd, nickname, text, false, ctx);
+        return;
+    }
+
+    if (!reader.str(first) || !reader.str(text) || !reader.at_end() ||
+        first.empty())
+    {
+        reply_error(ProtocolError::MalformedFrame);
+        return;
+    }
+
+    ProtocolError err = op == Opcode::Whisper
+                            ? send_whisper(ctx, nickname, std::string(first),
+                                           std::string(text))
+                            : publish_group_message(fd, nickname, std::string(first), text, ctx);
+    if (err == ProtocolError::None)
+    {
+        send_binary_reply(fd, encode_ack(op));
+    }
+    else
+    {
+        reply_error(err);
+    }
+}
+
+// 文本协议的批量帧："/batch" 独占第一行，之后每行是一条普通消息或命令。
+void handle_text_batch(int fd, std::string_view body, ServerContext& ctx,
+                       const CommandHandlers& handlers)
+{
+    std::vector<std::string_view> lines;
+    while (!body.empty())
+    {
+        size_t end = body.find('\n');
+        std::string_view line = body.substr(0, end);
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.remove_suffix(1);
+        }
+        if (!line.empty())
+        {
+            lines.push_back(line);
+        }
+        if (end == std::string_view::npos)
+        {
+            break;
+        }
+        body.remove_prefix(end + 1);
+    }
+
+    if (lines.empty() || lines.size() > MAX_BATCH_MESSAGES)
+    {
+        send_message_with_length(fd, "错误：批量消息为空或超过 " +
+                                     std::to_string(MAX_BATCH_MESSAGES) + " 条。");
+        return;
+    }
+
+    LOG_DEBUG("handle_text_batch: fd=" << fd << ", count=" << lines.size());
+
+    DeliveryBatch batch;
+    for (std::string_view line : lines)
+    {
+        handle_text_message(fd, line, ctx, handlers);
+    }
+}
+
+// 批量帧只对协商了 CAP_BATCH 的连接生效：二进制会话回复未知操作码，
+// 文本会话把 "/batch" 当作普通命令。
+void dispatch_frame(int fd, ProtocolMode protocol, uint32_t capabilities, std::string_view msg,
+                    ServerContext& ctx, const CommandHandlers& handlers)
+{
+    if (protocol == ProtocolMode::Binary)
+    {
+        if (!(capabilities & CAP_BATCH) && !msg.empty() &&
+            static_cast<Opcode>(msg[0]) == Opcode::Batch)
+        {
+            send_binary_reply(fd, encode_error(Opcode::Batch, ProtocolError::UnknownOpcode,
+                                               protocol_error_text(ProtocolError::UnknownOpcode)));
+            return;
+        }
+        handle_binary_message(fd, msg, ctx, handlers);
+        return;
+    }
+
+    if (!(capabilities & CAP_BATCH))
+    {
+        handle_text_message(fd, msg, ctx, handlers);
+        return;
+    }
+
+    constexpr std::string_view batch_prefix = "/batch\n";
+    constexpr std::string_view batch_prefix_crlf = "/batch\r\n";
+    if (msg.substr(0, batch_prefix.size()) == batch_prefix)
+    {
+        handle_text_batch(fd, msg.substr(batch_prefix.size()), ctx, handlers);
+        return;
+    }
+    if (msg.substr(0, batch_prefix_crlf.size()) == batch_prefix_crlf)
+    {
+        handle_text_batch(fd, msg.substr(batch_prefix_crlf.size()), ctx, handlers);
+        return;
+    }
+    handle_text_message(fd, msg, ctx, handlers);
+}
+
+// 服务器在当前配置下支持的能力，压缩只对二进制会话有效。
+uint32_t server_capabilities(ProtocolMode protocol)
+{
+    uint32_t caps = CAP_BATCH | CAP_TAGGED;
+    if (protocol == ProtocolMode::Binary && FrameCompressor::getInstance().enabled())
+    {
+        caps |= CAP_ZSTD;
+    }
+    if (ResumeTokenManager::getInstance().enabled())
+    {
+        caps |= CAP_RESUME;
+    }
+    return caps;
+}
+
+// 处理连接的第一帧。是 HELLO 时完成协商并返回 true。
+bool negotiate(int fd, std::string_view msg)
+{
+    uint8_t version = 0;
+    uint32_t requested = 0;
+    ProtocolMode protocol;
+    if (parse_binary_hello(msg, version, requested))
+    {
+        protocol = ProtocolMode::Binary;
+    }
+    else if (parse_text_hello(msg, version, requested))
+    {
+        protocol = ProtocolMode::Text;
+    }
+    else
+    {
+        return false;
+    }
+
+    // 版本取双方较小者，低于服务器支持的最低版本时拒绝。
+    if (version < MIN_PROTOCOL_VERSION)
+    {
+        send_message_with_length(fd, protocol_error_text(ProtocolError::UnsupportedVersion));
+        return true;
+    }
+
+    const FrameCompressor& compressor = FrameCompressor::getInstance();
+    ServerHello hello;
+    hello.version = std::min(version, PROTOCOL_VERSION);
+    hello.capabilities = requested & server_capabilities(protocol);
+    hello.dictionary_id = (hello.capabilities & CAP_ZSTD) ? compressor.dictionary_id() : 0;
+    hello.max_frame_size = static_cast<uint32_t>(connection_limits().max_frame_size);
+    hello.heartbeat_timeout = HEARTBEAT_TIMEOUT;
+    hello.max_pipelined = MAX_PIPELINED_REQUESTS;
+    hello.max_batch = MAX_BATCH_MESSAGES;
+    hello.compression_threshold = static_cast<uint32_t>(compressor.threshold());
+
+    SessionTable::getInstance().set_protocol(fd, protocol, hello.version, hello.capabilities);
+    write_frame(fd, protocol == ProtocolMode::Binary ? encode_hello_ack(hello)
+                                                     : format_text_hello(hello));
+    LOG_DEBUG("negotiate: fd=" << fd << ", version=" << static_cast<int>(hello.version)
+              << ", capabilities=" << hello.capabilities);
+    return true;
+}
+
+void handle_message(int fd, std::string_view msg, ServerContext& ctx,
+                    const CommandHandlers& handlers)
+{
+    SessionTable& sessions = SessionTable::getInstance();
+    Session session = sessions.get(fd);
+
+    if (!session.negotiated)
+    {
+        sessions.mark_negotiated(fd);
+        if (negotiate(fd, msg))
+        {
+            return;
+        }
+    }
+
+    uint64_t request_id = 0;
+    std::string_view inner;
+    bool tagged = false;
+    // 未协商请求 ID 的连接 (包括旧客户端) 不识别 TAGGED 和 "@<id> " 前缀，按原样处理。
+    if (!(session.capabilities & CAP_TAGGED))
+    {
+    }
+    else if (session.protocol == ProtocolMode::Binary)
+    {
+        BinaryReader reader(msg);
+        uint8_t op = 0;
+        if (reader.u8(op) && static_cast<Opcode>(op) == Opcode::Tagged)
+        {
+            if (!reader.varint(request_id))
+            {
+                write_frame(fd, encode_error(Opcode::Tagged, ProtocolError::MalformedFrame,
+                                             protocol_error_text(ProtocolError::MalformedFrame)));
+                return;
+            }
+            inner = msg.substr(msg.size() - reader.remaining());
+            tagged = true;
+        }
+    }
+    else
+    {
+        tagged = parse_text_request_tag(msg, request_id, inner);
+    }
+
+    if (!tagged)
+    {
+        dispatch_frame(fd, session.protocol, session.capabilities, msg, ctx, handlers);
+        return;
+    }
+
+    RequestTag tag{fd, session.connection_id, request_id, true};
+    if (!sessions.begin_request(fd, MAX_PIPELINED_REQUESTS))
+    {
+        RequestScope scope(tag);
+        if (session.protocol == ProtocolMode::Binary)
+        {
+            send_binary_reply(fd, encode_error(Opcode::Tagged, ProtocolError::TooManyRequests,
+                                               protocol_error_text(ProtocolError::TooManyRequests)));
+        }
+        else
+        {
+            send_message_with_length(fd, protocol_error_text(ProtocolError::TooManyRequests));
+        }
+        return;
+    }
+
+    // 带 ID 的请求交给线程池并发执行，接收缓冲区会被复用，因此拷贝一份帧体，
+    // 拷贝计入该连接的接收预算，执行完才释放。
+    std::shared_ptr<ConnectionIO> io = session.io;
+    if (io)
+    {
+        io->pending_request_bytes += inner.size();
+    }
+    ctx.pool.enqueue([tag, protocol = session.protocol, caps = session.capabilities,
+                      frame = std::string(inner), io, &ctx, handlers]()
+    {
+        RequestScope scope(tag);
+        SessionTable& sessions = SessionTable::getInstance();
+        if (sessions.get(tag.fd).connection_id == tag.connection_id)
+        {
+            dispatch_frame(tag.fd, protocol, caps, frame, ctx, handlers);
+        }
+        sessions.end_request(tag.fd, tag.connection_id);
+        if (io)
+        {
+            io->pending_request_bytes -= frame.size();
+        }
+    });
+}
+
+// 处理接收缓冲区中所有完整的长度前缀帧，pos 返回已消费的字节数。
+bool consume_stream_frames(int fd, ConnectionIO& io, ServerContext& ctx,
+                           const CommandHandlers& handlers, size_t& pos)
+{
+    const ConnectionLimits& limits = connection_limits();
+
+    // 长度头来自不可信的客户端，超过上限直接断开，不按它分配内存。
+    while (io.inbound.size() - pos >= sizeof(uint32_t))
+    {
+        uint32_t net_len;
+        std::memcpy(&net_len, io.inbound.data() + pos, sizeof(net_len));
+        uint32_t msg_len = ntohl(net_len);
+        if (msg_len > limits.max_frame_size)
+        {
+            LOG_WARNING("客户端 fd=" << fd << " 发送的帧长度 " << msg_len
+                        << " 超过上限 " << limits.max_frame_size << "，断开连接。");
+            return false;
+        }
+        if (io.inbound.size() - pos - sizeof(net_len) < msg_len)
+        {
+            break;
+        }
+
+        std::string_view msg(io.inbound.data() + pos + sizeof(net_len), msg_len);
+        handle_message(fd, msg, ctx, handlers);
+        pos += sizeof(net_len) + msg_len;
+    }
+    return true;
+}
+
+void write_ws_control(int fd, ConnectionIO& io, WsOpcode opcode, std::string_view payload)
+{
+    char header[WS_MAX_HEADER_SIZE];
+    size_t header_size = encode_ws_header(opcode, payload.size(), header);
+    io.write(fd, std::string_view(header, header_size), payload);
+}
+
+// 关闭码 (RFC 6455 7.4.1) 以大端 u16 作为 CLOSE 帧的负载。
+void write_ws_close(int fd, ConnectionIO& io, uint16_t code)
+{
+    char payload[2] = {static_cast<char>(code >> 8), static_cast<char>(code)};
+    write_ws_control(fd, io, WsOpcode::Close, std::string_view(payload, sizeof(payload)));
+}
+
+// WebSocket 的帧类型与协议一一对应：文本帧走文本协议，二进制帧走二进制协议。
+// 尚未协商的连接只能用二进制帧发送二进制 HELLO 切换协议。msg 为整条消息，类型不符时返回 false。
+bool ws_opcode_matches(int fd, uint8_t opcode, std::string_view msg)
+{
+    Session session = SessionTable::getInstance().get(fd);
+    bool binary_hello = !session.negotiated && msg.size() >= sizeof(BINARY_HELLO_MAGIC) &&
+                        std::memcmp(msg.data(), BINARY_HELLO_MAGIC,
+                                    sizeof(BINARY_HELLO_MAGIC)) == 0;
+    if (opcode == static_cast<uint8_t>(WsOpcode::Binary))
+    {
+        return session.protocol == ProtocolMode::Binary || binary_hello;
+    }
+    return session.protocol == ProtocolMode::Text && !binary_hello;
+}
+
+// 完成握手并处理接收缓冲区中所有完整的 WebSocket 帧，pos 返回已消费的字节数。
+// 负载在接收缓冲区内原地去掉掩码，未分片的消息直接以视图交给 handle_message。
+bool consume_websocket_frames(int fd, ConnectionIO& io, ServerContext& ctx,
+                              const CommandHandlers& handlers, size_t& pos)
+{
+    const ConnectionLimits& limits = connection_limits();
+
+    if (!io.ws_open)
+    {
+        std::string response;
+        size_t request_size = 0;
+        switch (parse_ws_handshake(io.inbound, response, request_size))
+        {
+        case WsHandshakeResult::Incomplete:
+            return true;
+        case WsHandshakeResult::Rejected:
+            LOG_WARNING("客户端 fd=" << fd << " WebSocket 握手失败，断开连接。");
+            if (!response.empty())
+            {
+                io.write(fd, response, {});
+            }
+            return false;
+        case WsHandshakeResult::Accepted:
+            // 先写出 101 应答再置位，其他线程的帧不会排到应答前面。
+            io.write(fd, response, {});
+            io.ws_open = true;
+            pos = request_size;
+            break;
+        }
+    }
+
+    while (true)
+    {
+        WsFrame frame;
+        WsParseResult result = parse_ws_frame(io.inbound.data() + pos,
+                                              io.inbound.size() - pos,
+                                              limits.max_frame_size, frame);
+        if (result == WsParseResult::Incomplete)
+        {
+            return true;
+        }
+        if (result == WsParseResult::Error)
+        {
+            LOG_WARNING("客户端 fd=" << fd << " 发送了不合法或过大的 WebSocket 帧，断开连接。");
+            write_ws_close(fd, io, 1002);
+            return false;
+        }
+        pos += frame.frame_size;
+
+        std::string_view payload(frame.payload, frame.payload_size);
+        switch (frame.opcode)
+        {
+        case WsOpcode::Ping:
+            write_ws_control(fd, io, WsOpcode::Pong, payload);
+            break;
+        case WsOpcode::Pong:
+            break;
+        case WsOpcode::Close:
+        {
+            // 负载为空时回复空的 CLOSE；否则必须以 2 字节关闭码开头，只回显关闭码。
+            if (payload.empty())
+            {
+                write_ws_control(fd, io, WsOpcode::Close, {});
+                return false;
+            }
+            if (payload.size() < 2)
+            {
+                write_ws_close(fd, io, 1002);
+                return false;
+            }
+            auto code = static_cast<uint16_t>((static_cast<uint8_t>(payload[0]) << 8) |
+                                              static_cast<uint8_t>(payload[1]));
+            // 1005/1006/1015 只在本地表示状态，不能出现在帧里 (RFC 6455 7.4.1)。
+            bool valid = code >= 1000 && code != 1004 && code != 1005 && code != 1006 &&
+                         code != 1015;
+            write_ws_close(fd, io, valid ? code : 1002);
+            return false;
+        }
+        case WsOpcode::Text:
+        case WsOpcode::Binary:
+            if (io.ws_message_opcode != 0)
+            {
+                write_ws_close(fd, io, 1002);
+                return false;
+            }
+            if (frame.fin)
+            {
+                if (!ws_opcode_matches(fd, static_cast<uint8_t>(frame.opcode), payload))
+                {
+                    LOG_WARNING("客户端 fd=" << fd << " 的 WebSocket 帧类型与协议不符，断开连接。");
+                    write_ws_close(fd, io, 1003);
+                    return false;
+                }
+                handle_message(fd, payload, ctx, handlers);
+            }
+            else
+            {
+                io.ws_message.assign(payload.data(), payload.size());
+                io.ws_message_opcode = static_cast<uint8_t>(frame.opcode);
+                io.account_inbound();
+            }
+            break;
+        case WsOpcode::Continuation:
+            if (io.ws_message_opcode == 0)
+            {
+                write_ws_close(fd, io, 1002);
+                return false;
+            }
+            if (io.ws_message.size() + payload.size() > limits.max_frame_size)
+            {
+                LOG_WARNING("客户端 fd=" << fd << " 的分片消息超过上限 "
+                            << limits.max_frame_size << "，断开连接。");
+                write_ws_close(fd, io, 1009);
+                return false;
+            }
+            io.ws_message.append(payload.data(), payload.size());
+            if (frame.fin)
+            {
+                if (!ws_opcode_matches(fd, io.ws_message_opcode, io.ws_message))
+                {
+                    LOG_WARNING("客户端 fd=" << fd << " 的 WebSocket 帧类型与协议不符，断开连接。");
+                    write_ws_close(fd, io, 1003);
+                    return false;
+                }
+                handle_message(fd, io.ws_message, ctx, handlers);
+                io.ws_message.clear();
+                io.ws_message_opcode = 0;
+            }
+            io.account_inbound();
+            break;
+        }
+    }
+}
+
+// 读取并处理 fd 上所有完整的帧。连接需要断开时返回 false。
+// 达到接收或发送预算时暂停读取，把 fd 放入 paused，由事件循环稍后恢复。
+bool read_client(int fd, ServerContext& ctx, const CommandHandlers& handlers,
+                 std::unordered_set<int>& paused)
+{
+    std::shared_ptr<ConnectionIO> io = SessionTable::getInstance().io(fd);
+    if (!io)
+    {
+        return true;
+    }
+
+    constexpr size_t READ_CHUNK = 16 * 1024;
+    const ConnectionLimits& limits = connection_limits();
+    bool active = false;
+
+    while (true)
+    {
+        if (io->should_pause_reading())
+        {
+            if (!io->read_paused)
+            {
+                io->read_paused = true;
+                io->paused_since = std::chrono::steady_clock::now();
+                paused.insert(fd);
+            }
+            break;
+        }
+
+        size_t used = io->inbound.size() + io->pending_request_bytes.load();
+        size_t chunk = std::min(READ_CHUNK, limits.max_inbound_bytes - used);
+        size_t old_size = io->inbound.size();
+        io->inbound.resize(old_size + chunk);
+
+        ssize_t n = io->read(fd, &io->inbound[old_size], chunk);
+        if (n <= 0)
+        {
+            io->inbound.resize(old_size);
+            io->account_inbound();
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            {
+                return false;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        io->inbound.resize(old_size + static_cast<size_t>(n));
+        io->account_inbound();
+        active = true;
+
+        size_t pos = 0;
+        bool ok = io->transport() == Transport::WebSocket
+                      ? consume_websocket_frames(fd, *io, ctx, handlers, pos)
+                      : consume_stream_frames(fd, *io, ctx, handlers, pos);
+        io->inbound.erase(0, pos);
+        if (!ok)
+        {
+            return false;
+        }
+    }
+
+    io->shrink_inbound();
+
+    if (active)
+    {
+        std::lock_guard<std::mutex> lock(ctx.clients_mtx);
+        auto it = ctx.clients.find(fd);
+        if (it != ctx.clients.end())
+        {
+            it->second.last_activity = std::chrono::steady_clock::now();
+        }
+    }
+    return true;
+}
+
+// 监听端口及其上连接的分帧方式，端口为 0 时不监听。
+struct Listener
+{
+    const char* name;
+    int port;
+    Transport transport;
+    bool tls;
+    int fd = -1;
+};
+
+int env_port(const std::map<std::string, std::string>& env, const char* key, int default_port)
+{
+    auto it = env.find(key);
+    if (it == env.end())
+    {
+        return default_port;
+    }
+    try
+    {
+        return std::stoi(it->second);
+    }
+    catch (const std::exception& e)
+    {
+        LOG_WARNING(key << " 配置无效，使用默认端口 " << default_port << ": " << e.what());
+        return default_port;
+    }
+}
+
+int create_listener(int port)
+{
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd == -1)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+
+    int opt = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    if (bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) == -1)
+    {
+        perror("bind");
+        close(listen_fd);
+        return -1;
+    }
+
+    if (listen(listen_fd, SOMAXCONN) == -1)
+    {
+        perror("listen");
+        close(listen_fd);
+        return -1;
+    }
+
+    set_nonblocking(listen_fd);
+    return listen_fd;
+}
+
+// 边沿触发下一次事件可能对应多个连接，循环 accept 直到队列为空。
+void accept_clients(int listen_fd, Transport transport, bool tls, ServerContext& ctx)
+{
+    while (true)
+    {
+        sockaddr_in client_addr{};
+        socklen_t client_addr_len = sizeof(client_addr);
+        int client_fd = accept(listen_fd, (sockaddr*)&client_addr, &client_addr_len);
+
+        if (client_fd == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                perror("accept");
+            }
+            return;
+        }
+
+        set_nonblocking(client_fd);
+        if (!SessionTable::getInstance().open(client_fd, transport, tls))
+        {
+            close(client_fd);
+            continue;
+        }
+        epoll_event ev_client{};
+        ev_client.events = EPOLLIN | EPOLLET;
+        ev_client.data.fd = client_fd;
+        epoll_ctl(ctx.epoll_fd, EPOLL_CTL_ADD, client_fd, &ev_client);
+        char ip_str[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr.sin_addr, ip_str, INET_ADDRSTRLEN);
+
+        {
+            std::lock_guard<std::mutex> lock(ctx.clients_mtx);
+            ctx.clients.emplace(client_fd, Client(client_fd, std::string(ip_str)));
+        }
+    }
+}
+
+int main()
+{
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, sigint_hadler);
+
+    ThreadPool pool(4);
+
+    auto sender = [](int fd, const std::string& message)
+    {
+        send_message_with_length(fd, message);
+    };
+
+    std::map<std::string, std::string> env_config = load_env();
+
+    if (env_config.empty())
+    {
+        LOG_FATAL("无法加载 .env 配置文件。服务器退出。");
+        return 1;
+    }
+
+    DatabaseManager& db_manager = DatabaseManager::getInstance();
+    if (!db_manager.connect(env_config))
+    {
+        LOG_FATAL("数据库连接失败。服务器退出。");
+        return 1;
+    }
+    LOG_INFO("数据库连接成功。");
+
+    ServerContext ctx(pool, sender, db_manager);
+    if (env_config.empty())
+    {
+        LOG_FATAL("无法加载 .env 配置文件。服务器退出。");
+        return 1;
+    }
+
+    HistoryConfig history_config;
+    try
+    {
+        if (env_config.count("GROUP_HISTORY_MESSAGES"))
+        {
+            history_config.max_messages =
+                std::stoul(env_config.at("GROUP_HISTORY_MESSAGES"));
+        }
+        if (env_config.count("GROUP_HISTORY_BYTES"))
+        {
+            history_config.max_bytes =
+                std::stoul(env_config.at("GROUP_HISTORY_BYTES"));
+        }
+        if (env_config.count("GROUP_HISTORY_DIR"))
+        {
+            history_config.spill_dir = env_config.at("GROUP_HISTORY_DIR");
+        }
+    }
+    catch (const std::exception& e)
+    {
+        LOG_WARNING("群消息历史配置无效，使用默认值: " << e.what());
+    }
+    ctx.group_manager->configure_history(history_config);
+
+    try
+    {
+        ctx.group_manager->load_groups(SNAPSHOT_FILE, JSON_FILE);
+        LOG_INFO("成功加载群组数据。");
+    }
+    catch (const std::exception& e)
+    {
+        LOG_ERROR("加载群组数据失败: " << e.what() << "。将从空状态启动。");
+    }
+
+    CompressionConfig compression_config;
+    bool compression_enabled = true;
+    try
+    {
+        if (env_config.count("COMPRESSION_ENABLED"))
+        {
+            compression_enabled = env_config.at("COMPRESSION_ENABLED") != "0";
+        }
+        if (env_config.count("COMPRESSION_LEVEL"))
+        {
+            compression_config.level = std::stoi(env_config.at("COMPRESSION_LEVEL"));
+        }
+        if (env_config.count("COMPRESSION_THRESHOLD"))
+        {
+            compression_config.threshold =
+                std::stoul(env_config.at("COMPRESSION_THRESHOLD"));
+        }
+        if (env_config.count("COMPRESSION_DICTIONARY"))
+        {
+            compression_config.dictionary_file = env_config.at("COMPRESSION_DICTIONARY");
+        }
+    }
+    catch (const std::exception& e)
+    {
+        LOG_WARNING("压缩配置无效，使用默认值: " << e.what());
+    }
+    if (compression_enabled)
+    {
+        FrameCompressor::getInstance().configure(compression_config);
+    }
+
+    ConnectionLimits limits;
+    try
+    {
+        if (env_config.count("MAX_FRAME_SIZE"))
+        {
+            limits.max_frame_size = std::stoul(env_config.at("MAX_FRAME_SIZE"));
+        }
+        if (env_config.count("CONN_INBOUND_LIMIT"))
+        {
+            limits.max_inbound_bytes = std::stoul(env_config.at("CONN_INBOUND_LIMIT"));
+        }
+        if (env_config.count("CONN_OUTBOUND_LIMIT"))
+        {
+            limits.max_outbound_bytes = std::stoul(env_config.at("CONN_OUTBOUND_LIMIT"));
+        }
+        if (env_config.count("GLOBAL_BUFFER_LIMIT"))
+        {
+            limits.max_global_bytes = std::stoul(env_config.at("GLOBAL_BUFFER_LIMIT"));
+        }
+        if (env_config.count("BACKPRESSURE_TIMEOUT"))
+        {
+            limits.backpressure_timeout =
+                std::chrono::seconds(std::stoi(env_config.at("BACKPRESSURE_TIMEOUT")));
+        }
     }
-
-    DatabaseManager& db_manager = DatabaseManager::getInstance();
-    if (!db_manager.connect(env_config))
+    catch (const std::exception& e)
     {
-        LOG_FATAL("数据库连接失败。服务器退出。");
-        return 1;
+        LOG_WARNING("连接缓冲区限制配置无效，使用默认值: " << e.what());
     }
-    LOG_INFO("数据库连接成功。");
+    configure_connection_limits(limits);
 
-    ServerContext ctx(pool, sender, db_manager);
-    if (env_config.empty())
+    std::chrono::seconds resume_ttl{900};
+    if (env_config.count("RESUME_TOKEN_TTL"))
     {
-        LOG_FATAL("无法加载 .env 配置文件。服务器退出。");
-        return 1;
+        try
+        {
+            resume_ttl = std::chrono::seconds(std::stoi(env_config.at("RESUME_TOKEN_TTL")));
+        }
+        catch (const std::exception& e)
+        {
+            LOG_WARNING("RESUME_TOKEN_TTL 配置无效，使用默认值 900 秒: " << e.what());
+        }
     }
+    ResumeTokenManager::getInstance().configure(
+        env_config.count("RESUME_TOKEN_SECRET") ? env_config.at("RESUME_TOKEN_SECRET") : "",
+        resume_ttl);
 
-    const std::string GROUP_FILE = "groups_data.json";
-    try
+    int snapshot_interval_sec = 60;
+    if (env_config.count("GROUP_SNAPSHOT_INTERVAL"))
     {
-        ctx.group_manager->load_groups_from_file(GROUP_FILE);
-        LOG_INFO("成功加载群组数据。");
+        try
+        {
+            snapshot_interval_sec = std::stoi(env_config.at("GROUP_SNAPSHOT_INTERVAL"));
+        }
+        catch (const std::exception& e)
+        {
+            LOG_WARNING("GROUP_SNAPSHOT_INTERVAL 无效，使用默认值 60 秒。");
+        }
     }
-    catch (const std::exception& e)
+    if (snapshot_interval_sec > 0)
     {
-        LOG_ERROR("加载群组数据失败: " << e.what() << "。将从空状态启动。");
+        ctx.group_manager->start_background_snapshots(
+            SNAPSHOT_FILE, std::chrono::seconds(snapshot_interval_sec));
     }
 
     try
     {
         LuaManager& lua_manager = LuaManager::initializeInstance(ctx);
 
+        LuaBudget lua_budget;
+        try
+        {
+            if (env_config.count("LUA_MAX_INSTRUCTIONS"))
+            {
+                lua_budget.max_instructions = std::stoull(env_config.at("LUA_MAX_INSTRUCTIONS"));
+            }
+            if (env_config.count("LUA_MAX_TIME_MS"))
+            {
+                lua_budget.max_time =
+                    std::chrono::milliseconds(std::stoi(env_config.at("LUA_MAX_TIME_MS")));
+            }
+            if (env_config.count("LUA_MAX_STRIKES"))
+            {
+                lua_budget.max_strikes = std::stoi(env_config.at("LUA_MAX_STRIKES"));
+            }
+            if (env_config.count("LUA_MEMORY_LIMIT_MB"))
+            {
+                lua_budget.max_memory =
+                    std::stoul(env_config.at("LUA_MEMORY_LIMIT_MB")) * 1024 * 1024;
+            }
+            if (env_config.count("LUA_MAX_TIMERS"))
+            {
+                lua_budget.max_timers = std::stoul(env_config.at("LUA_MAX_TIMERS"));
+            }
+        }
+        catch (const std::exception& e)
+        {
+            LOG_WARNING("Lua 执行预算配置无效，使用默认值: " << e.what());
+        }
+        lua_manager.configure_budget(lua_budget);
+
+        // 默认缓存在脚本旁边，LUA_BYTECODE_CACHE=0 时不使用磁盘缓存。
+        std::string bytecode_cache = "src/commands.luac";
+        if (env_config.count("LUA_BYTECODE_CACHE"))
+        {
+            bytecode_cache = env_config.at("LUA_BYTECODE_CACHE");
+            if (bytecode_cache == "0")
+            {
+                bytecode_cache.clear();
+            }
+        }
+        lua_manager.configure_bytecode_cache(bytecode_cache);
+
         if (!lua_manager.initialize())
         {
             LOG_FATAL("LuaManager 初始化失败 (加载 commands.lua 失败)，服务器退出。");
@@ -392,12 +1713,15 @@ int main()
         return 1;
     }
 
-    std::unordered_map<std::string, ServerCommandHandler> admin_commands;
-    std::unordered_map<std::string, ServerCommandHandler> user_commands;
+    CommandHandlers handlers{};
+    auto slot = [&handlers](CommandId id) -> ServerCommandHandler&
+    {
+        return handlers[static_cast<size_t>(id)];
+    };
 
     // 非群组命令
-    user_commands["/list"] =
-        [&ctx](const std::vector<std::string>& args, int fd)
+    slot(CommandId::List) =
+        [](ServerContext& ctx, const CommandArgs& args, int fd) -> std::string
         {
             std::lock_guard<std::mutex> lock(ctx.clients_mtx);
             std::string list_str = "在线用户：\n";
@@ -412,14 +1736,14 @@ int main()
             return list_str;
         };
 
-    user_commands["whoami"] =
-        [&ctx](const std::vector<std::string>& args, int fd)
+    slot(CommandId::Whoami) =
+        [](ServerContext& ctx, const CommandArgs& args, int fd) -> std::string
         {
             return "你的昵称是：" + ctx.get_username(fd) + "\n";
         };
 
-    user_commands["/w"] = [&ctx](const std::vector<std::string>& args,
-                                 int fd) -> std::string
+    slot(CommandId::Whisper) = [](ServerContext& ctx, const CommandArgs& args,
+                                  int fd) -> std::string
     {
         if (args.size() < 3)
         {
@@ -432,46 +1756,29 @@ int main()
             return "无法获取您的昵称。\n";
         }
 
-        const std::string& target_nickname = args[1];
-        if (target_nickname == sender_nickname)
-        {
-            return "不能和自己私聊。\n";
-        }
-
-        std::string whisper_message;
-        for (size_t i = 2; i < args.size(); ++i)
-        {
-            whisper_message += args[i] + " ";
-        }
-
-        if (!whisper_message.empty())
-        {
-            whisper_message.pop_back();
-        }
-
-        int target_fd = ctx.get_fd_by_nickname(target_nickname);
+        std::string target_nickname(args[1]);
+        std::string whisper_message(args.rest(2));
 
-        if (target_fd != -1)
+        switch (send_whisper(ctx, sender_nickname, target_nickname,
+                             whisper_message))
         {
-            std::string whisper_reply_to_target =
-                "来自 " + sender_nickname + " 的私聊：" + whisper_message;
-
-            send_message_with_length(target_fd, whisper_reply_to_target + "\n");
+        case ProtocolError::None:
             return "已向 " + target_nickname + " 发送私聊消息。\n";
-        }
-        else
-        {
+        case ProtocolError::InvalidArgument:
+            return "不能和自己私聊。\n";
+        default:
             return "用户 '" + target_nickname + "' 不在线或不存在。\n";
         }
     };
 
-    user_commands["/help"] =
-        [&ctx](const std::vector<std::string>& args, int fd)
+    slot(CommandId::Help) =
+        [](ServerContext& ctx, const CommandArgs& args, int fd) -> std::string
         {
             std::string help_msg =
                 "--- 认证命令 ---\n"
                 "/register <用户> <密码> - 注册新用户\n"
                 "/login <用户> <密码> - 登录\n"
+                "/resume <令牌> - 用登录时下发的令牌恢复会话\n"
                 "--- 可用的命令 ---\n"
                 "/list - 列出所有在线用户\n"
                 "/w <昵称> <消息> - 向指定用户发送私聊消息\n"
@@ -480,10 +1787,12 @@ int main()
                 "/create <群名> - 创建一个新群（您将成为群主）\n"
                 "/join <群名> - 加入一个群\n"
                 "/send <群名> <消息> - 向特定群发送消息\n"
+                "/history <群名> [before_seq] [条数] - 查看群历史消息\n"
                 "/listgroups - 列出所有群\n"
                 "/hello - Lua 脚本示例命令\n"
                 "/roll [max] - 掷骰子（Lua 脚本）\n"
                 "/quit - 退出聊天室\n"
+                "/revoke - 作废当前的会话令牌\n"
                 "/leave <群名> - 退出群聊\n";
 
             bool is_server_admin = false;
@@ -499,7 +1808,10 @@ int main()
             {
                 help_msg +=
                     "\n--- 服务器管理员命令（全局）---\n"
-                    "/kick <昵称> - 踢出指定用户（全局）\n";
+                    "/kick <昵称> - 踢出指定用户（全局）\n"
+                    "/snapshot - 立即在后台保存群组快照\n"
+                    "/reloadlua - 重新加载 commands.lua，不断开任何连接\n"
+                    "/luamem - 查看 Lua 虚拟机的内存用量\n";
             }
 
             help_msg +=
@@ -511,17 +1823,19 @@ int main()
             return help_msg;
         };
 
-    user_commands["/quit"] =
-        [&ctx](const std::vector<std::string>& args, int fd)
+    slot(CommandId::Quit) =
+        [](ServerContext& ctx, const CommandArgs& args, int fd) -> std::string
         {
+            // 主动退出后不允许再用令牌恢复。
+            ResumeTokenManager::getInstance().revoke(ctx.get_username(fd));
             std::string reply = "正在安全退出服务器，再见！\n";
             send_message_with_length(fd, reply);
             disconnect_client(fd, ctx);
             return "";
         };
 
-    user_commands["/create"] = [&ctx](const std::vector<std::string>& args,
-                                      int fd)-> std::string
+    slot(CommandId::Create) = [](ServerContext& ctx, const CommandArgs& args,
+                                 int fd) -> std::string
     {
         std::string username = ctx.get_username(fd);
         if (username.empty())
@@ -531,8 +1845,8 @@ int main()
         return ctx.group_manager->handle_create_group(username, args);
     };
 
-    user_commands["/join"] = [&ctx](const std::vector<std::string>& args,
-                                    int fd) -> std::string
+    slot(CommandId::Join) = [](ServerContext& ctx, const CommandArgs& args,
+                               int fd) -> std::string
     {
         std::string username = ctx.get_username(fd);
         if (username.empty())
@@ -542,19 +1856,37 @@ int main()
         return ctx.group_manager->handle_join_group(username, args);
     };
 
-    user_commands["/send"] = [&ctx](const std::vector<std::string>& args,
-                                    int fd) -> std::string
+    slot(CommandId::Send) = [](ServerContext& ctx, const CommandArgs& args,
+                               int fd) -> std::string
+    {
+        std::string username = ctx.get_username(fd);
+        if (username.empty())
+        {
+            return "请先设置昵称。\n";
+        }
+        if (args.size() < 3)
+        {
+            return "用法: /send <群名> <消息>\n";
+        }
+
+        ProtocolError err = publish_group_message(fd, username, std::string(args[1]),
+                                                  args.rest(2), ctx);
+        return err == ProtocolError::None ? "" : protocol_error_text(err);
+    };
+
+    slot(CommandId::History) = [](ServerContext& ctx, const CommandArgs& args,
+                                  int fd) -> std::string
     {
         std::string username = ctx.get_username(fd);
         if (username.empty())
         {
             return "请先设置昵称。\n";
         }
-        return ctx.group_manager->handle_send_message(username, args);
+        return ctx.group_manager->handle_history(username, args);
     };
 
-    user_commands["/listgroups"] = [&ctx](const std::vector<std::string>& args,
-                                          int fd) -> std::string
+    slot(CommandId::ListGroups) = [](ServerContext& ctx, const CommandArgs& args,
+                                     int fd) -> std::string
     {
         std::string username = ctx.get_username(fd);
         if (username.empty())
@@ -564,8 +1896,8 @@ int main()
         return ctx.group_manager->handle_list_groups();
     };
 
-    user_commands["/groupkick"] = [&ctx](const std::vector<std::string>& args,
-                                         int fd)-> std::string
+    slot(CommandId::GroupKick) = [](ServerContext& ctx, const CommandArgs& args,
+                                    int fd) -> std::string
     {
         std::string username = ctx.get_username(fd);
 
@@ -577,8 +1909,8 @@ int main()
         return ctx.group_manager->handle_group_kick(username, args);
     };
 
-    user_commands["/leave"] = [&ctx](const std::vector<std::string>& args,
-                                     int fd)-> std::string
+    slot(CommandId::Leave) = [](ServerContext& ctx, const CommandArgs& args,
+                                int fd) -> std::string
     {
         std::string username = ctx.get_username(fd);
         if (username.empty())
@@ -589,8 +1921,8 @@ int main()
         return ctx.group_manager->handle_group_leave(username, args);
     };
 
-    user_commands["/transfer"] = [&ctx](const std::vector<std::string>& args,
-                                        int fd)-> std::string
+    slot(CommandId::Transfer) = [](ServerContext& ctx, const CommandArgs& args,
+                                   int fd) -> std::string
     {
         std::string kicker_nickname = ctx.get_username(fd);
 
@@ -607,8 +1939,8 @@ int main()
         return ctx.group_manager->handle_group_transfer(kicker_nickname, args);
     };
 
-    user_commands["/groupunban"] = [&ctx](const std::vector<std::string>& args,
-                                          int fd)-> std::string
+    slot(CommandId::GroupUnban) = [](ServerContext& ctx, const CommandArgs& args,
+                                     int fd) -> std::string
     {
         std::string username = ctx.get_username(fd);
 
@@ -625,15 +1957,15 @@ int main()
         return ctx.group_manager->handle_group_unban(username, args);
     };
 
-    admin_commands["/kick"] = [&ctx](const std::vector<std::string>& args,
-                                     int fd)-> std::string
+    slot(CommandId::Kick) = [](ServerContext& ctx, const CommandArgs& args,
+                               int fd) -> std::string
     {
         if (args.size() < 2)
         {
             return "用法: /kick <昵称>。\n";
         }
 
-        const std::string& target_nickname_raw = args[1];
+        std::string target_nickname_raw(args[1]);
 
         std::string admin_name = ctx.get_username(fd);
 
@@ -646,6 +1978,7 @@ int main()
 
             ctx.broadcast(ss.str(), fd);
 
+            ResumeTokenManager::getInstance().revoke(target_nickname_raw);
             std::string reply_to_kick = "您已被管理员踢出聊天室。\n";
             send_message_with_length(target_fd, reply_to_kick);
 
@@ -659,51 +1992,264 @@ int main()
         }
     };
 
-    epoll_event events[MAX_EVENTS];
+    slot(CommandId::Snapshot) = [](ServerContext& ctx, const CommandArgs& args,
+                                   int fd) -> std::string
+    {
+        LOG_INFO("管理员 [" << ctx.get_username(fd) << "] 请求立即保存群组快照。");
+        if (ctx.group_manager->request_snapshot())
+        {
+            return "已提交后台群组快照任务。\n";
+        }
 
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(PORT);
+        // GROUP_SNAPSHOT_INTERVAL <= 0 时没有后台线程，直接在线程池中保存一次。
+        ctx.pool.enqueue([&ctx]()
+        {
+            if (ctx.group_manager->save_snapshot(SNAPSHOT_FILE))
+            {
+                LOG_INFO("群组快照已保存到 " << SNAPSHOT_FILE);
+            }
+            else
+            {
+                LOG_ERROR("保存群组快照 " << SNAPSHOT_FILE << " 失败。");
+            }
+        });
+        return "已提交群组快照任务。\n";
+    };
 
-    int opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    slot(CommandId::Resume) = [](ServerContext& ctx, const CommandArgs& args,
+                                 int fd) -> std::string
+    {
+        return "您已登录，无需恢复会话。\n";
+    };
 
-    if (bind(server_fd, (sockaddr*)&addr, sizeof(addr)) == -1)
+    slot(CommandId::Revoke) = [](ServerContext& ctx, const CommandArgs& args,
+                                 int fd) -> std::string
     {
-        perror("bind");
-        return -1;
-    }
+        ResumeTokenManager::getInstance().revoke(ctx.get_username(fd));
+        return "已作废您的会话令牌，下次需使用 /login 登录。\n";
+    };
 
-    if (listen(server_fd, SOMAXCONN) == -1)
+    slot(CommandId::ReloadLua) = [](ServerContext& ctx, const CommandArgs& args,
+                                    int fd) -> std::string
     {
-        perror("listen");
-        return -1;
+        std::string admin_name = ctx.get_username(fd);
+        uint64_t connection_id = SessionTable::getInstance().get(fd).connection_id;
+        // 加载脚本不在事件循环上进行，完成后再回复。
+        ctx.pool.enqueue([fd, connection_id, admin_name]()
+        {
+            std::string error;
+            bool ok = LuaManager::getInstance().reload(error);
+            if (ok)
+            {
+                LOG_INFO("管理员 [" << admin_name << "] 重新加载了 commands.lua。");
+            }
+
+            // 加载期间管理员可能已断开，fd 被新连接复用，脚本错误不能发给别人。
+            if (SessionTable::getInstance().get(fd).connection_id != connection_id)
+            {
+                return;
+            }
+            if (ok)
+            {
+                send_message_with_length(fd, "commands.lua 已重新加载。\n");
+            }
+            else
+            {
+                send_message_with_length(fd, "重新加载失败，继续使用旧脚本: " + error + "\n");
+            }
+        });
+        return "";
+    };
+
+    slot(CommandId::LuaMem) = [](ServerContext& ctx, const CommandArgs& args,
+                                 int fd) -> std::string
+    {
+        LuaManager& lua_manager = LuaManager::getInstance();
+        LuaMemoryStats stats = lua_manager.memory_stats();
+        auto kib = [](size_t bytes) { return std::to_string(bytes / 1024) + " KiB"; };
+
+        return "Lua 虚拟机: " + std::to_string(stats.states) + " 个\n"
+               "已用内存: " + kib(stats.used) + " (向系统申请 " + kib(stats.reserved) + ")\n"
+               "单个虚拟机峰值: " + kib(stats.peak) + " / 上限 " + kib(stats.limit) + "\n"
+               "因超出上限失败的分配: " + std::to_string(stats.failures) + " 次\n"
+               "因超出执行预算中止的命令: " + std::to_string(lua_manager.budget_aborts()) + " 次\n";
+    };
+
+    epoll_event events[MAX_EVENTS];
+
+    std::vector<Listener> listeners = {
+        {"TCP", PORT, Transport::Stream, false},
+        // 供浏览器和移动端直连，WS_PORT=0 时关闭。
+        {"WebSocket", env_port(env_config, "WS_PORT", DEFAULT_WS_PORT), Transport::WebSocket, false},
+    };
+
+    if (env_config.count("TLS_CERT_FILE") && env_config.count("TLS_KEY_FILE"))
+    {
+        TlsConfig tls_config;
+        tls_config.cert_file = env_config.at("TLS_CERT_FILE");
+        tls_config.key_file = env_config.at("TLS_KEY_FILE");
+        if (env_config.count("TLS_KTLS"))
+        {
+            tls_config.ktls = env_config.at("TLS_KTLS") != "0";
+        }
+        if (env_config.count("TLS_SESSION_TIMEOUT"))
+        {
+            try
+            {
+                tls_config.session_timeout =
+                    std::chrono::seconds(std::stoi(env_config.at("TLS_SESSION_TIMEOUT")));
+            }
+            catch (const std::exception& e)
+            {
+                LOG_WARNING("TLS_SESSION_TIMEOUT 配置无效，使用默认值: " << e.what());
+            }
+        }
+        if (!TlsContext::getInstance().configure(tls_config))
+        {
+            return -1;
+        }
+
+        listeners.push_back({"TLS", env_port(env_config, "TLS_PORT", DEFAULT_TLS_PORT),
+                             Transport::Stream, true});
+        listeners.push_back({"WebSocket TLS", env_port(env_config, "WSS_PORT", DEFAULT_WSS_PORT),
+                             Transport::WebSocket, true});
     }
 
-    set_nonblocking(server_fd);
+    auto close_listeners = [&listeners]()
+    {
+        for (Listener& listener : listeners)
+        {
+            if (listener.fd != -1)
+            {
+                close(listener.fd);
+                listener.fd = -1;
+            }
+        }
+    };
+
+    for (Listener& listener : listeners)
+    {
+        if (listener.port <= 0)
+        {
+            continue;
+        }
+        listener.fd = create_listener(listener.port);
+        if (listener.fd == -1)
+        {
+            close_listeners();
+            return -1;
+        }
+    }
 
     int epoll_fd = epoll_create1(0);
     if (epoll_fd == -1)
     {
         perror("epoll_create1");
+        close_listeners();
+        return -1;
+    }
+
+    for (const Listener& listener : listeners)
+    {
+        if (listener.fd == -1)
+        {
+            continue;
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = listener.fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listener.fd, &ev) == -1)
+        {
+            perror("epoll_ctl add listener");
+            close_listeners();
+            return -1;
+        }
+        LOG_INFO(listener.name << " 监听端口: " << listener.port);
+    }
+
+    // 脚本被修改时自动重新加载，LUA_HOT_RELOAD=0 关闭。
+    int lua_watch_fd = -1;
+    if (!env_config.count("LUA_HOT_RELOAD") || env_config.at("LUA_HOT_RELOAD") != "0")
+    {
+        lua_watch_fd = LuaManager::getInstance().watch_script();
+        if (lua_watch_fd != -1)
+        {
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.fd = lua_watch_fd;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, lua_watch_fd, &ev) == -1)
+            {
+                perror("epoll_ctl add inotify");
+                lua_watch_fd = -1;
+            }
+        }
+    }
+
+    // 本线程 Lua 状态上挂起的命令 (Chat.sleep 等) 经此交回事件循环恢复。
+    int lua_loop_fd = LuaManager::getInstance().open_loop_queue();
+    if (lua_loop_fd != -1)
+    {
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = lua_loop_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, lua_loop_fd, &ev) == -1)
+        {
+            perror("epoll_ctl add lua eventfd");
+            close_listeners();
+            return -1;
+        }
+    }
+
+    int pipeline_fd = -1;
+    if (MessagePipeline::getInstance().open())
+    {
+        pipeline_fd = MessagePipeline::getInstance().event_fd();
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = pipeline_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pipeline_fd, &ev) == -1)
+        {
+            perror("epoll_ctl add eventfd");
+            close_listeners();
+            return -1;
+        }
+    }
+    else
+    {
+        close_listeners();
         return -1;
     }
 
-    epoll_event ev{};
-    ev.events = EPOLLIN | EPOLLET;
-    ev.data.fd = server_fd;
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &ev) == -1)
+    int timer_fd = -1;
+    if (TimerWheel::getInstance().open())
+    {
+        timer_fd = TimerWheel::getInstance().timer_fd();
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = timer_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) == -1)
+        {
+            perror("epoll_ctl add timerfd");
+            close_listeners();
+            return -1;
+        }
+    }
+    else
     {
-        perror("epoll_ctl add server_fd");
-        close(server_fd);
+        close_listeners();
         return -1;
     }
 
     ctx.epoll_fd = epoll_fd;
+    set_connection_epoll_fd(epoll_fd);
 
     LOG_INFO("服务器启动，等待客户端连接...\n");
 
+    // 因缓冲区预算而暂停读取的连接。
+    std::unordered_set<int> paused_fds;
+
+    auto last_heartbeat_check = std::chrono::steady_clock::now();
+
     while (running)
     {
         int nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, EPOLL_TIMEOUT_MS);
@@ -724,17 +2270,18 @@ int main()
             break;
         }
 
-        // 心跳检测
-        if (nfds == 0)
+        // 心跳检测。按间隔而不是按 epoll_wait 超时进行：有定时器时 timerfd 每拍都会唤醒事件循环。
+        auto loop_now = std::chrono::steady_clock::now();
+        if (loop_now - last_heartbeat_check >= std::chrono::milliseconds(EPOLL_TIMEOUT_MS))
         {
+            last_heartbeat_check = loop_now;
             std::vector<int> inactive_fds;
             {
                 std::lock_guard<std::mutex> lock(ctx.clients_mtx);
-                auto now = std::chrono::steady_clock::now();
                 for (const auto& pair : ctx.clients)
                 {
                     if (std::chrono::duration_cast<std::chrono::seconds>(
-                            now - pair.second.last_activity)
+                            loop_now - pair.second.last_activity)
                         .count() > HEARTBEAT_TIMEOUT)
                     {
                         inactive_fds.push_back(pair.first);
@@ -757,13 +2304,17 @@ int main()
                 std::lock_guard<std::mutex> client_lock(ctx.clients_mtx);
                 for (int cfd : ctx.to_remove)
                 {
-                    epoll_ctl(ctx.epoll_fd, EPOLL_CTL_DEL, cfd, nullptr);
-                    if (ctx.clients.count(cfd))
+                    // 同一个 fd 可能因为多个原因被重复加入，只清理一次。
+                    if (!ctx.clients.count(cfd))
                     {
-                        ctx.clients.erase(cfd);
+                        continue;
                     }
+                    epoll_ctl(ctx.epoll_fd, EPOLL_CTL_DEL, cfd, nullptr);
+                    ctx.clients.erase(cfd);
+                    paused_fds.erase(cfd);
                     safe_print("[CLEAN] 客户端[" + std::to_string(cfd) +
                                "] 已被清理\n");
+                    SessionTable::getInstance().close(cfd);
                     close(cfd);
                 }
                 ctx.to_remove.clear();
@@ -774,95 +2325,99 @@ int main()
         {
             int fd = events[i].data.fd;
 
-            if (fd == server_fd)
+            auto listener = std::find_if(listeners.begin(), listeners.end(),
+                                         [fd](const Listener& l) { return l.fd == fd; });
+            if (listener != listeners.end())
             {
-                sockaddr_in client_addr{};
-                socklen_t client_addr_len = sizeof(client_addr);
-                int client_fd = accept(server_fd, (sockaddr*)&client_addr,
-                                       &client_addr_len);
-
-                if (client_fd == -1)
+                accept_clients(listener->fd, listener->transport, listener->tls, ctx);
+            }
+            else if (fd == lua_watch_fd)
+            {
+                LuaManager::getInstance().handle_watch_events();
+            }
+            else if (fd == lua_loop_fd)
+            {
+                LuaManager::getInstance().run_loop_tasks();
+            }
+            else if (fd == pipeline_fd)
+            {
+                run_message_pipeline(ctx);
+            }
+            else if (fd == timer_fd)
+            {
+                TimerWheel::getInstance().expire();
+            }
+            else
+            {
+                std::shared_ptr<ConnectionIO> io = SessionTable::getInstance().io(fd);
+                if (!io)
                 {
-                    if (errno != EAGAIN || errno != EWOULDBLOCK)
-                    {
-                        perror("accept");
-                    }
                     continue;
                 }
 
-                set_nonblocking(client_fd);
-                epoll_event ev_client{};
-                ev_client.events = EPOLLIN | EPOLLET;
-                ev_client.data.fd = client_fd;
-                epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &ev_client);
-                char ip_str[INET_ADDRSTRLEN];
-                inet_ntop(AF_INET, &client_addr.sin_addr, ip_str,
-                          INET_ADDRSTRLEN);
+                bool disconnect = (events[i].events & (EPOLLERR | EPOLLHUP)) != 0 &&
+                                  (events[i].events & EPOLLIN) == 0;
 
+                if (!disconnect && (events[i].events & EPOLLOUT))
                 {
-                    std::lock_guard<std::mutex> lock(ctx.clients_mtx);
-                    ctx.clients.emplace(client_fd,
-                                        Client(client_fd, std::string(ip_str)));
+                    disconnect = !io->flush(fd);
                 }
-            }
-            else if (events[i].events & EPOLLIN)
-            {
-                bool disconnect = false;
-                while (true)
+                // TLS 握手可能在等待可写，握手期间任何事件都推进一次。
+                if (!disconnect && !io->read_paused &&
+                    ((events[i].events & EPOLLIN) || io->tls_handshaking()))
                 {
-                    uint32_t net_len;
-                    ssize_t n_len =
-                        recv(fd, &net_len, sizeof(net_len), MSG_PEEK);
-
-                    if (n_len <= 0)
-                    {
-                        if (n_len == 0 ||
-                            (errno != EAGAIN && errno != EWOULDBLOCK))
-                        {
-                            disconnect = true;
-                        }
-                        break;
-                    }
-
-                    if (n_len < sizeof(net_len))
-                    {
-                        break;
-                    }
-
-                    uint32_t msg_len = ntohl(net_len);
-
-                    std::vector<char> buf(msg_len + sizeof(net_len));
-
-                    ssize_t total_n = recv(fd, buf.data(), buf.size(), 0);
-
-                    if (total_n <= 0)
-                    {
-                        if (total_n == 0 ||
-                            (errno != EAGAIN && errno != EWOULDBLOCK))
-                        {
-                            disconnect = true;
-                        }
-                        break;
-                    }
-
-                    if (total_n < msg_len + sizeof(net_len))
-                    {
-                        break;
-                    }
+                    disconnect = !read_client(fd, ctx, handlers, paused_fds);
+                }
+                if (disconnect)
+                {
+                    disconnect_client(fd, ctx);
+                }
+            }
+        }
 
-                    {
-                        std::lock_guard<std::mutex> lock(ctx.clients_mtx);
-                        if (ctx.clients.count(fd))
-                        {
-                            ctx.clients.at(fd).last_activity =
-                                std::chrono::steady_clock::now();
-                        }
-                    }
+        // 输出积压超限的连接直接断开。
+        for (int overflowed_fd : take_overflowed_connections())
+        {
+            disconnect_client(overflowed_fd, ctx);
+        }
 
-                    std::string msg(buf.begin() + sizeof(net_len), buf.end());
-                    handle_message(fd, msg, ctx, admin_commands, user_commands);
+        // 恢复预算已经回落的连接；暂停过久的连接视为无法跟上，断开。
+        if (!paused_fds.empty())
+        {
+            auto now = std::chrono::steady_clock::now();
+            std::vector<int> resume;
+            std::vector<int> expired;
+            for (int paused_fd : paused_fds)
+            {
+                std::shared_ptr<ConnectionIO> io = SessionTable::getInstance().io(paused_fd);
+                if (!io)
+                {
+                    expired.push_back(paused_fd);
                 }
-                if (disconnect)
+                else if (!io->should_pause_reading())
+                {
+                    resume.push_back(paused_fd);
+                }
+                else if (now - io->paused_since > connection_limits().backpressure_timeout)
+                {
+                    LOG_WARNING("客户端 fd=" << paused_fd << " 背压持续超时，断开连接。");
+                    disconnect_client(paused_fd, ctx);
+                    expired.push_back(paused_fd);
+                }
+            }
+            for (int fd : expired)
+            {
+                paused_fds.erase(fd);
+            }
+            for (int fd : resume)
+            {
+                paused_fds.erase(fd);
+                if (std::shared_ptr<ConnectionIO> io = SessionTable::getInstance().io(fd))
+                {
+                    io->read_paused = false;
+                }
+                // 边沿触发下暂停期间到达的数据不会再产生事件，需要主动读一次。
+                if (!read_client(fd, ctx, handlers, paused_fds))
                 {
                     disconnect_client(fd, ctx);
                 }
@@ -872,12 +2427,17 @@ int main()
 
     LOG_INFO("服务器关闭流程：保存数据...");
 
+    // 先等线程池中的请求执行完，它们还会访问数据库和群组。
+    pool.shutdown();
+
     db_manager.disconnect();
     LOG_INFO("数据库已断开连接。");
 
     try
     {
-        ctx.group_manager->save_groups_to_file(JSON_FILE);
+        ctx.group_manager->stop_background_snapshots();
+        ctx.group_manager->save_snapshot(SNAPSHOT_FILE);
+        ctx.group_manager->flush_history();
         LOG_INFO("群组数据保存完成。");
     }
     catch (const std::exception& e)
@@ -895,7 +2455,7 @@ int main()
         }
     }
 
-    close(server_fd);
+    close_listeners();
     close(epoll_fd);
     safe_print("服务器已安全退出。\n");
     return 0;